@@ -0,0 +1,1002 @@
+/* ***********************************************************************
+ * Amaunet: High-order Lattice Perturbation Theory
+ *          for Non-Relativistic Quantum Matter
+ *
+ * High-order Perturbation Theory Analytics
+ * Weak-coupling Expansion for Fermionic Contact Interactions
+ *
+ * Compact Binary Serialization of Expanded Expressions Source
+ * Implementation
+ *
+ * Andrew C. Loheac, Joaquin E. Drut
+ * Department of Physics and Astronomy
+ * University of North Carolina at Chapel Hill
+ * ***********************************************************************
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "omp.h"
+#include "PathIntegration.h"
+#include "ExpressionSerialization.h"
+#include "BinarySerialization.h"
+
+using namespace std;
+
+const unsigned int Amaunet::BINARY_FORMAT_VERSION = 2;
+
+static const char BINARY_FORMAT_MAGIC[4] = { 'A', 'M', 'N', 'B' };
+
+/*
+ * Tags preceding the body of an encoded CoefficientFraction.
+ */
+static const char FRACTION_INTEGRAL = 0;
+static const char FRACTION_DOUBLE = 1;
+
+/*
+ * Codecs of the stored bytes of a block.
+ */
+static const char BLOCK_CODEC_RAW = 0;
+static const char BLOCK_CODEC_DEFLATE = 1;
+
+/*
+ * Upper bound of the compression ratio of deflate, used to reject corrupt payload lengths before allocating.
+ */
+static const unsigned long long DEFLATE_MAX_RATIO = 1032;
+
+/*
+ * ***********************************************************************
+ * PRIMITIVE ENCODING
+ * ***********************************************************************
+ */
+
+void appendVarint( string &buffer, unsigned long long value ) {
+    while ( value >= 0x80 ) {
+        buffer.push_back( (char)( ( value & 0x7F ) | 0x80 ) );
+        value >>= 7;
+    }
+    buffer.push_back( (char)value );
+}
+
+bool readVarint( const char* &position, const char* end, unsigned long long &value ) {
+    value = 0;
+    for ( int shift = 0; shift < 64; shift += 7 ) {
+        if ( position >= end ) return false;
+
+        unsigned char byte = (unsigned char)*position++;
+        value |= (unsigned long long)( byte & 0x7F ) << shift;
+        if ( ( byte & 0x80 ) == 0 ) return true;
+    }
+
+    return false;
+}
+
+void appendSignedVarint( string &buffer, long long value ) {
+    appendVarint( buffer, ( (unsigned long long)value << 1 ) ^ (unsigned long long)( value >> 63 ) );
+}
+
+bool readSignedVarint( const char* &position, const char* end, long long &value ) {
+    unsigned long long encoded;
+    if ( not readVarint( position, end, encoded ) ) return false;
+
+    value = (long long)( encoded >> 1 ) ^ -(long long)( encoded & 1 );
+    return true;
+}
+
+void appendDouble( string &buffer, double value ) {
+    char bytes[ sizeof( double ) ];
+    memcpy( bytes, &value, sizeof( double ) );
+    buffer.append( bytes, sizeof( double ) );
+}
+
+bool readDouble( const char* &position, const char* end, double &value ) {
+    if ( end - position < (long)sizeof( double ) ) return false;
+
+    memcpy( &value, position, sizeof( double ) );
+    position += sizeof( double );
+    return true;
+}
+
+void appendUInt32( string &buffer, unsigned int value ) {
+    for ( int i = 0; i < 4; i++ ) buffer.push_back( (char)( ( value >> ( 8 * i ) ) & 0xFF ) );
+}
+
+bool readUInt32( const char* &position, const char* end, unsigned int &value ) {
+    if ( end - position < 4 ) return false;
+
+    value = 0;
+    for ( int i = 0; i < 4; i++ ) value |= (unsigned int)(unsigned char)position[ i ] << ( 8 * i );
+    position += 4;
+    return true;
+}
+
+unsigned int computeChecksum( const char* data, size_t length ) {
+    const unsigned int MOD_ADLER = 65521;
+    unsigned int a = 1;
+    unsigned int b = 0;
+
+    for ( size_t i = 0; i < length; i++ ) {
+        a = ( a + (unsigned char)data[ i ] ) % MOD_ADLER;
+        b = ( b + a ) % MOD_ADLER;
+    }
+
+    return ( b << 16 ) | a;
+}
+
+/*
+ * ***********************************************************************
+ * TERM AND BLOCK ENCODING
+ * ***********************************************************************
+ */
+
+template <class Key>
+static unsigned long long getTableIndex( const Key &key, map<Key, unsigned long long> &table ) {
+    typename map<Key, unsigned long long>::iterator entry = table.find( key );
+    if ( entry != table.end() ) return entry->second;
+
+    unsigned long long index = table.size();
+    table[ key ] = index;
+    return index;
+}
+
+static bool encodeFactor( SymbolicTermPtr factor, BlockEncodingTables &tables, string &buffer ) {
+    TermTypes id = factor->getTermID();
+    int* indices;
+
+    buffer.push_back( (char)id );
+
+    switch ( id ) {
+        case TermTypes::MATRIX_K:
+            indices = factor->getIndices();
+            appendVarint( buffer, getTableIndex( factor->getFlavorLabel(), tables.flavors ) );
+            appendSignedVarint( buffer, indices[ 0 ] );
+            appendSignedVarint( buffer, indices[ 1 ] );
+            buffer.push_back( (char)static_cast<MatrixK*>( factor.get() )->isTransformed() );
+            return true;
+
+        case TermTypes::MATRIX_S:
+            indices = factor->getIndices();
+            appendSignedVarint( buffer, indices[ 0 ] );
+            appendSignedVarint( buffer, indices[ 1 ] );
+            return true;
+
+        case TermTypes::DELTA:
+            indices = factor->getIndices();
+            appendSignedVarint( buffer, indices[ 0 ] );
+            appendSignedVarint( buffer, indices[ 1 ] );
+            buffer.push_back( (char)static_cast<Delta*>( factor.get() )->isDeltaBar() );
+            return true;
+
+        case TermTypes::TERM_A:
+            return true;
+
+        case TermTypes::TERM_E:
+            appendVarint( buffer, static_cast<TermE*>( factor.get() )->getOrder() );
+            appendVarint( buffer, getTableIndex( factor->getFlavorLabel(), tables.flavors ) );
+            return true;
+
+        case TermTypes::COEFFICIENT_FLOAT:
+            appendDouble( buffer, static_cast<CoefficientFloat*>( factor.get() )->eval() );
+            return true;
+
+        case TermTypes::COEFFICIENT_FRACTION: {
+            CoefficientFraction* fraction = static_cast<CoefficientFraction*>( factor.get() );
+            double num = fraction->getNumerator();
+            double den = fraction->getDenominator();
+
+            // Fractions arising from the expansion are ratios of integers, which are far smaller as varints.
+            if ( num == floor( num ) && den == floor( den ) && fabs( num ) < 9.0e15 && fabs( den ) < 9.0e15 ) {
+                buffer.push_back( FRACTION_INTEGRAL );
+                appendSignedVarint( buffer, (long long)num );
+                appendSignedVarint( buffer, (long long)den );
+            } else {
+                buffer.push_back( FRACTION_DOUBLE );
+                appendDouble( buffer, num );
+                appendDouble( buffer, den );
+            }
+            return true;
+        }
+
+        case TermTypes::FOURIER_SUM: {
+            vector<IndexContraction> contractions = static_cast<FourierSum*>( factor.get() )->getContractionVector();
+
+            appendVarint( buffer, getTableIndex( contractions, tables.diagrams ) );
+            return true;
+        }
+
+        default:
+            cout << "***ERROR: A term of type '" << (char)id << "' cannot be written in the binary format." << endl;
+            return false;
+    }
+}
+
+bool encodeTerm( SymbolicTermPtr term, BlockEncodingTables &tables, string &buffer ) {
+    if ( term->getTermID() != TermTypes::PRODUCT ) term = Product( term ).copy();
+
+    Product* product = static_cast<Product*>( term.get() );
+    string encoded;
+
+    appendVarint( encoded, product->getNumberOfTerms() );
+    for ( vector<SymbolicTermPtr>::iterator factor = product->getIteratorBegin(); factor != product->getIteratorEnd(); ++factor ) {
+        if ( not encodeFactor( *factor, tables, encoded ) ) return false;
+    }
+
+    buffer.append( encoded );
+    return true;
+}
+
+/*
+ * Writes a table of the block, ordered by index so that it may be read directly into a vector.
+ */
+template <class Key>
+static vector<Key> getOrderedTable( const map<Key, unsigned long long> &table ) {
+    vector<Key> ordered( table.size() );
+    for ( typename map<Key, unsigned long long>::const_iterator it = table.begin(); it != table.end(); ++it ) {
+        ordered[ it->second ] = it->first;
+    }
+
+    return ordered;
+}
+
+static void appendBlockTables( string &payload, BlockEncodingTables &tables ) {
+    vector<string> flavors = getOrderedTable( tables.flavors );
+    appendVarint( payload, flavors.size() );
+    for ( vector<string>::iterator flavor = flavors.begin(); flavor != flavors.end(); ++flavor ) {
+        appendVarint( payload, flavor->size() );
+        payload.append( *flavor );
+    }
+
+    vector<vector<IndexContraction> > diagrams = getOrderedTable( tables.diagrams );
+    appendVarint( payload, diagrams.size() );
+    for ( vector<vector<IndexContraction> >::iterator diagram = diagrams.begin(); diagram != diagrams.end(); ++diagram ) {
+        long long i = 0;
+        long long j = 0;
+
+        appendVarint( payload, diagram->size() );
+        for ( vector<IndexContraction>::iterator it = diagram->begin(); it != diagram->end(); ++it ) {
+            appendSignedVarint( payload, it->i - i );
+            appendSignedVarint( payload, it->j - j );
+            i = it->i;
+            j = it->j;
+        }
+    }
+}
+
+BlockStatistics::BlockStatistics() : numTerms( 0 ), payloadLength( 0 ), storedLength( 0 ), seconds( 0 ) { }
+
+bool encodeBlock( vector<SymbolicTermPtr>::iterator begin, vector<SymbolicTermPtr>::iterator end, string &buffer,
+                  bool compress, BlockStatistics* statistics ) {
+    double start = omp_get_wtime();
+    BlockEncodingTables tables;
+    string terms;
+    string payload;
+    unsigned long long numTerms = 0;
+
+    for ( vector<SymbolicTermPtr>::iterator term = begin; term != end; ++term ) {
+        string encoded;
+        if ( not encodeTerm( *term, tables, encoded ) ) return false;
+
+        appendVarint( terms, encoded.size() );
+        terms.append( encoded );
+        numTerms++;
+    }
+
+    appendBlockTables( payload, tables );
+    payload.append( terms );
+
+    char codec = BLOCK_CODEC_RAW;
+    string compressed;
+
+    if ( compress ) {
+        uLongf compressedLength = compressBound( payload.size() );
+        compressed.resize( compressedLength );
+
+        // Keep the block raw if deflate fails or does not make it smaller.
+        if ( compress2( (Bytef*)&compressed[ 0 ], &compressedLength, (const Bytef*)payload.data(), payload.size(), Z_BEST_SPEED ) == Z_OK
+             && compressedLength < payload.size() ) {
+            compressed.resize( compressedLength );
+            codec = BLOCK_CODEC_DEFLATE;
+        }
+    }
+
+    const string &stored = ( codec == BLOCK_CODEC_RAW ) ? payload : compressed;
+
+    appendVarint( buffer, numTerms );
+    buffer.push_back( codec );
+    appendVarint( buffer, stored.size() );
+    appendVarint( buffer, payload.size() );
+    buffer.append( stored );
+    appendUInt32( buffer, computeChecksum( stored.data(), stored.size() ) );
+
+    if ( statistics != nullptr ) {
+        statistics->numTerms = numTerms;
+        statistics->payloadLength = payload.size();
+        statistics->storedLength = stored.size();
+        statistics->seconds = omp_get_wtime() - start;
+    }
+
+    return true;
+}
+
+/*
+ * ***********************************************************************
+ * TERM AND BLOCK DECODING
+ * ***********************************************************************
+ */
+
+static bool readFlavor( const char* &position, const char* end, const vector<string> &flavors, string &flavorLabel ) {
+    unsigned long long index;
+    if ( not readVarint( position, end, index ) || index >= flavors.size() ) return false;
+
+    flavorLabel = flavors[ index ];
+    return true;
+}
+
+static bool readIndexPair( const char* &position, const char* end, long long &i, long long &j ) {
+    return readSignedVarint( position, end, i ) && readSignedVarint( position, end, j );
+}
+
+static bool decodeFactor( const char* &position, const char* end, const BlockTables &tables, Product &term ) {
+    if ( position >= end ) return false;
+
+    TermTypes id = (TermTypes)*position++;
+    long long i, j;
+    string flavorLabel;
+
+    switch ( id ) {
+        case TermTypes::MATRIX_K: {
+            if ( not readFlavor( position, end, tables.flavors, flavorLabel ) ) return false;
+            if ( not readIndexPair( position, end, i, j ) || position >= end ) return false;
+
+            MatrixK factor( flavorLabel );
+            factor.setIndices( (int)i, (int)j );
+            if ( *position++ ) factor.fourierTransform();
+            term.addTerm( factor.copy() );
+            return true;
+        }
+
+        case TermTypes::MATRIX_S: {
+            if ( not readIndexPair( position, end, i, j ) ) return false;
+
+            MatrixS factor;
+            factor.setIndices( (int)i, (int)j );
+            term.addTerm( factor.copy() );
+            return true;
+        }
+
+        case TermTypes::DELTA: {
+            if ( not readIndexPair( position, end, i, j ) || position >= end ) return false;
+
+            term.addTerm( Delta( (int)i, (int)j, *position++ != 0 ).copy() );
+            return true;
+        }
+
+        case TermTypes::TERM_A:
+            term.addTerm( TermA().copy() );
+            return true;
+
+        case TermTypes::TERM_E: {
+            unsigned long long order;
+            if ( not readVarint( position, end, order ) ) return false;
+            if ( not readFlavor( position, end, tables.flavors, flavorLabel ) ) return false;
+
+            term.addTerm( TermE( (int)order, flavorLabel ).copy() );
+            return true;
+        }
+
+        case TermTypes::COEFFICIENT_FLOAT: {
+            double value;
+            if ( not readDouble( position, end, value ) ) return false;
+
+            term.addTerm( CoefficientFloat( value ).copy() );
+            return true;
+        }
+
+        case TermTypes::COEFFICIENT_FRACTION: {
+            if ( position >= end ) return false;
+
+            char tag = *position++;
+            double num, den;
+
+            if ( tag == FRACTION_INTEGRAL ) {
+                if ( not readIndexPair( position, end, i, j ) ) return false;
+                num = (double)i;
+                den = (double)j;
+            } else if ( tag == FRACTION_DOUBLE ) {
+                if ( not readDouble( position, end, num ) || not readDouble( position, end, den ) ) return false;
+            } else {
+                return false;
+            }
+
+            term.addTerm( CoefficientFraction( num, den ).copy() );
+            return true;
+        }
+
+        case TermTypes::FOURIER_SUM: {
+            unsigned long long diagram;
+            if ( not readVarint( position, end, diagram ) || diagram >= tables.diagrams.size() ) return false;
+
+            const vector<IndexContraction> &contractions = tables.diagrams[ diagram ];
+            term.addTerm( FourierSum( contractions, (int)contractions.size() ).copy() );
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
+
+bool readBlockHeader( const char* &position, const char* end, unsigned long long &numTerms, const char* &payload, const char* &payloadEnd,
+                      string &scratch ) {
+    const char* cursor = position;
+    unsigned long long storedLength, payloadLength;
+
+    if ( not readVarint( cursor, end, numTerms ) || cursor >= end ) return false;
+
+    char codec = *cursor++;
+    if ( not readVarint( cursor, end, storedLength ) || not readVarint( cursor, end, payloadLength ) ) return false;
+    if ( storedLength > (unsigned long long)( end - cursor ) || end - cursor - (long)storedLength < 4 ) return false;
+
+    const char* stored = cursor;
+    unsigned int checksum;
+
+    cursor += storedLength;
+    readUInt32( cursor, end, checksum );
+    if ( checksum != computeChecksum( stored, storedLength ) ) return false;
+
+    if ( codec == BLOCK_CODEC_RAW ) {
+        if ( payloadLength != storedLength ) return false;
+
+        payload = stored;
+    } else if ( codec == BLOCK_CODEC_DEFLATE ) {
+        if ( payloadLength > storedLength * DEFLATE_MAX_RATIO + 64 ) return false;
+
+        uLongf inflatedLength = payloadLength;
+        scratch.resize( payloadLength );
+        if ( uncompress( (Bytef*)&scratch[ 0 ], &inflatedLength, (const Bytef*)stored, storedLength ) != Z_OK
+             || inflatedLength != payloadLength ) return false;
+
+        payload = scratch.data();
+    } else {
+        return false;
+    }
+
+    payloadEnd = payload + payloadLength;
+    position = cursor;
+    return true;
+}
+
+/*
+ * Counts the distinct momentum-space indices of a set of contractions, which are the vertices of its diagram.
+ */
+static int countVertices( const vector<IndexContraction> &contractions ) {
+    vector<int> vertices;
+    for ( vector<IndexContraction>::const_iterator it = contractions.begin(); it != contractions.end(); ++it ) {
+        vertices.push_back( it->i );
+        vertices.push_back( it->j );
+    }
+
+    sort( vertices.begin(), vertices.end() );
+    return (int)( unique( vertices.begin(), vertices.end() ) - vertices.begin() );
+}
+
+bool readBlockTables( const char* &position, const char* end, BlockTables &tables ) {
+    unsigned long long numFlavors, numDiagrams;
+
+    tables.flavors.clear();
+    tables.diagrams.clear();
+    tables.numVertices.clear();
+
+    if ( not readVarint( position, end, numFlavors ) ) return false;
+    for ( unsigned long long n = 0; n < numFlavors; n++ ) {
+        unsigned long long length;
+        if ( not readVarint( position, end, length ) || length > (unsigned long long)( end - position ) ) return false;
+
+        tables.flavors.push_back( string( position, length ) );
+        position += length;
+    }
+
+    if ( not readVarint( position, end, numDiagrams ) || numDiagrams > (unsigned long long)( end - position ) ) return false;
+    tables.diagrams.resize( numDiagrams );
+    for ( unsigned long long n = 0; n < numDiagrams; n++ ) {
+        unsigned long long numPairs;
+        long long i = 0;
+        long long j = 0;
+
+        if ( not readVarint( position, end, numPairs ) || numPairs > (unsigned long long)( end - position ) ) return false;
+        for ( unsigned long long m = 0; m < numPairs; m++ ) {
+            long long di, dj;
+            if ( not readIndexPair( position, end, di, dj ) ) return false;
+
+            i += di;
+            j += dj;
+            tables.diagrams[ n ].push_back( IndexContraction( (int)i, (int)j ) );
+        }
+
+        tables.numVertices.push_back( countVertices( tables.diagrams[ n ] ) );
+    }
+
+    return true;
+}
+
+bool readTermBounds( const char* &position, const char* end, const char* &termBegin, const char* &termEnd ) {
+    unsigned long long termLength;
+    if ( not readVarint( position, end, termLength ) || termLength > (unsigned long long)( end - position ) ) return false;
+
+    termBegin = position;
+    termEnd = position + termLength;
+    position = termEnd;
+    return true;
+}
+
+bool decodeTerm( const char* begin, const char* end, const BlockTables &tables, Product &term ) {
+    unsigned long long numFactors;
+    if ( not readVarint( begin, end, numFactors ) ) return false;
+
+    for ( unsigned long long f = 0; f < numFactors; f++ ) {
+        if ( not decodeFactor( begin, end, tables, term ) ) return false;
+    }
+
+    return begin == end;
+}
+
+bool decodeBlock( const char* &position, const char* end, Sum &terms ) {
+    const char* cursor = position;
+    const char* payload;
+    const char* payloadEnd;
+    unsigned long long numTerms;
+    BlockTables tables;
+    string scratch;
+
+    if ( not readBlockHeader( cursor, end, numTerms, payload, payloadEnd, scratch ) ) return false;
+    if ( not readBlockTables( payload, payloadEnd, tables ) ) return false;
+
+    Sum decoded;
+    for ( unsigned long long n = 0; n < numTerms; n++ ) {
+        const char* termBegin;
+        const char* termEnd;
+        Product term;
+
+        if ( not readTermBounds( payload, payloadEnd, termBegin, termEnd ) ) return false;
+        if ( not decodeTerm( termBegin, termEnd, tables, term ) ) return false;
+
+        decoded.addTerm( term.copy() );
+    }
+
+    for ( vector<SymbolicTermPtr>::iterator term = decoded.getIteratorBegin(); term != decoded.getIteratorEnd(); ++term ) {
+        terms.addTerm( *term );
+    }
+
+    position = cursor;
+    return true;
+}
+
+/*
+ * ***********************************************************************
+ * ZERO-COPY TERM VIEWS
+ * ***********************************************************************
+ */
+
+TermView::TermView() : begin( nullptr ), end( nullptr ), tables( nullptr ), orderInA( 0 ), coefficient( 1 ),
+                       diagram( -1 ), numContractions( 0 ), numVertices( 0 ) { }
+
+/*
+ * Advances past a single encoded factor, accumulating the summary statistics of the term into view.
+ */
+bool scanFactor( const char* &position, const char* end, TermView &view ) {
+    if ( position >= end ) return false;
+
+    TermTypes id = (TermTypes)*position++;
+    unsigned long long value;
+    long long i, j;
+
+    switch ( id ) {
+        case TermTypes::MATRIX_K:
+            if ( not readVarint( position, end, value ) || not readIndexPair( position, end, i, j ) ) return false;
+            if ( position >= end || value >= view.flavorCounts.size() ) return false;
+            position++;
+            view.flavorCounts[ value ]++;
+            return true;
+
+        case TermTypes::MATRIX_S:
+            return readIndexPair( position, end, i, j );
+
+        case TermTypes::DELTA:
+            if ( not readIndexPair( position, end, i, j ) || position >= end ) return false;
+            position++;
+            return true;
+
+        case TermTypes::TERM_A:
+            view.orderInA++;
+            return true;
+
+        case TermTypes::TERM_E:
+            return readVarint( position, end, value ) && readVarint( position, end, value );
+
+        case TermTypes::COEFFICIENT_FLOAT: {
+            double x;
+            if ( not readDouble( position, end, x ) ) return false;
+
+            view.coefficient *= x;
+            return true;
+        }
+
+        case TermTypes::COEFFICIENT_FRACTION: {
+            if ( position >= end ) return false;
+
+            char tag = *position++;
+            double num, den;
+
+            if ( tag == FRACTION_INTEGRAL ) {
+                if ( not readIndexPair( position, end, i, j ) ) return false;
+                num = (double)i;
+                den = (double)j;
+            } else if ( tag == FRACTION_DOUBLE ) {
+                if ( not readDouble( position, end, num ) || not readDouble( position, end, den ) ) return false;
+            } else {
+                return false;
+            }
+
+            view.coefficient *= num / den;
+            return true;
+        }
+
+        case TermTypes::FOURIER_SUM:
+            if ( not readVarint( position, end, value ) || value >= view.tables->diagrams.size() ) return false;
+
+            view.diagram = (int)value;
+            view.numContractions = (int)view.tables->diagrams[ value ].size();
+            view.numVertices = view.tables->numVertices[ value ];
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+bool TermView::assign( const char* termBegin, const char* termEnd, const BlockTables* blockTables ) {
+    begin = termBegin;
+    end = termEnd;
+    tables = blockTables;
+    orderInA = 0;
+    coefficient = 1;
+    diagram = -1;
+    numContractions = 0;
+    numVertices = 0;
+    flavorCounts.assign( blockTables->flavors.size(), 0 );
+
+    const char* position = termBegin;
+    unsigned long long numFactors;
+    if ( not readVarint( position, termEnd, numFactors ) ) return false;
+
+    for ( unsigned long long f = 0; f < numFactors; f++ ) {
+        if ( not scanFactor( position, termEnd, *this ) ) return false;
+    }
+
+    return position == termEnd;
+}
+
+int TermView::getOrderInA() const {
+    return orderInA;
+}
+
+double TermView::getCoefficient() const {
+    return coefficient;
+}
+
+int TermView::getNumberOfContractions() const {
+    return numContractions;
+}
+
+int TermView::getNumberOfVertices() const {
+    return numVertices;
+}
+
+int TermView::getNumberOfMatrixK( const string &flavorLabel ) const {
+    for ( size_t n = 0; n < tables->flavors.size(); n++ ) {
+        if ( tables->flavors[ n ] == flavorLabel ) return flavorCounts[ n ];
+    }
+
+    return 0;
+}
+
+int TermView::getNumberOfMatrixK() const {
+    int total = 0;
+    for ( size_t n = 0; n < flavorCounts.size(); n++ ) total += flavorCounts[ n ];
+    return total;
+}
+
+void TermView::getContractions( vector<IndexContraction> &pairs ) const {
+    pairs.clear();
+    if ( diagram >= 0 ) pairs = tables->diagrams[ diagram ];
+}
+
+SymbolicTermPtr TermView::materialize() const {
+    Product term;
+    decodeTerm( begin, end, *tables, term );
+    return term.copy();
+}
+
+TermFilter::TermFilter() : minOrderInA( 0 ), maxOrderInA( -1 ), minVertices( 0 ), maxVertices( -1 ) { }
+
+bool TermFilter::matches( const TermView &term ) const {
+    if ( term.getOrderInA() < minOrderInA || ( maxOrderInA >= 0 && term.getOrderInA() > maxOrderInA ) ) return false;
+    if ( term.getNumberOfVertices() < minVertices || ( maxVertices >= 0 && term.getNumberOfVertices() > maxVertices ) ) return false;
+
+    if ( not flavorCounts.empty() ) {
+        int total = 0;
+        for ( map<string, int>::const_iterator flavor = flavorCounts.begin(); flavor != flavorCounts.end(); ++flavor ) {
+            if ( term.getNumberOfMatrixK( flavor->first ) != flavor->second ) return false;
+            total += flavor->second;
+        }
+
+        // A term with matrices K of any flavor not named by the filter does not match.
+        if ( term.getNumberOfMatrixK() != total ) return false;
+    }
+
+    return true;
+}
+
+bool decodeFilteredBlock( const char* &position, const char* end, const TermFilter &filter, Sum &terms ) {
+    const char* cursor = position;
+    const char* payload;
+    const char* payloadEnd;
+    unsigned long long numTerms;
+    BlockTables tables;
+    string scratch;
+    TermView view;
+
+    if ( not readBlockHeader( cursor, end, numTerms, payload, payloadEnd, scratch ) ) return false;
+    if ( not readBlockTables( payload, payloadEnd, tables ) ) return false;
+
+    Sum decoded;
+    for ( unsigned long long n = 0; n < numTerms; n++ ) {
+        const char* termBegin;
+        const char* termEnd;
+
+        if ( not readTermBounds( payload, payloadEnd, termBegin, termEnd ) ) return false;
+        if ( not view.assign( termBegin, termEnd, &tables ) ) return false;
+
+        // Only terms which satisfy the filter are ever constructed.
+        if ( not filter.matches( view ) ) continue;
+
+        Product term;
+        if ( not decodeTerm( termBegin, termEnd, tables, term ) ) return false;
+        decoded.addTerm( term.copy() );
+    }
+
+    for ( vector<SymbolicTermPtr>::iterator term = decoded.getIteratorBegin(); term != decoded.getIteratorEnd(); ++term ) {
+        terms.addTerm( *term );
+    }
+
+    position = cursor;
+    return true;
+}
+
+/*
+ * ***********************************************************************
+ * MEMORY-MAPPED FILES
+ * ***********************************************************************
+ */
+
+MappedFile::MappedFile( string filename ) : data( nullptr ), length( 0 ) {
+    int fd = open( filename.c_str(), O_RDONLY );
+    if ( fd < 0 ) return;
+
+    struct stat st;
+    if ( fstat( fd, &st ) == 0 && st.st_size > 0 ) {
+        void* mapping = mmap( nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if ( mapping != MAP_FAILED ) {
+            madvise( mapping, (size_t)st.st_size, MADV_SEQUENTIAL );
+            data = (const char*)mapping;
+            length = (size_t)st.st_size;
+        }
+    }
+
+    close( fd );
+}
+
+MappedFile::~MappedFile() {
+    if ( data != nullptr ) munmap( (void*)data, length );
+}
+
+bool MappedFile::isOpen() const {
+    return data != nullptr;
+}
+
+const char* MappedFile::begin() const {
+    return data;
+}
+
+const char* MappedFile::end() const {
+    return data + length;
+}
+
+MappedExpressionReader::MappedExpressionReader( string filename ) : file( filename ), position( nullptr ), end( nullptr ),
+                                                                    payload( nullptr ), payloadEnd( nullptr ),
+                                                                    termsRemaining( 0 ), error( false ) {
+    if ( not file.isOpen() ) {
+        cout << "***ERROR: Failed to map file '" << filename << "' for reading." << endl;
+        error = true;
+        return;
+    }
+
+    position = file.begin();
+    end = file.end();
+
+    if ( not readBinaryHeader( position, end ) ) {
+        cout << "***ERROR: File '" << filename << "' is not a supported binary expression file." << endl;
+        error = true;
+    }
+}
+
+bool MappedExpressionReader::next() {
+    if ( error ) return false;
+
+    while ( termsRemaining == 0 ) {
+        if ( position >= end ) return false;
+
+        if ( not readBlockHeader( position, end, termsRemaining, payload, payloadEnd, scratch )
+             || not readBlockTables( payload, payloadEnd, tables ) ) {
+            error = true;
+            return false;
+        }
+    }
+
+    const char* termBegin;
+    const char* termEnd;
+    if ( not readTermBounds( payload, payloadEnd, termBegin, termEnd ) || not view.assign( termBegin, termEnd, &tables ) ) {
+        error = true;
+        return false;
+    }
+
+    termsRemaining--;
+    return true;
+}
+
+const TermView& MappedExpressionReader::getTerm() const {
+    return view;
+}
+
+bool MappedExpressionReader::hasError() const {
+    return error;
+}
+
+/*
+ * ***********************************************************************
+ * FILE INPUT AND OUTPUT
+ * ***********************************************************************
+ */
+
+void appendBinaryHeader( string &buffer ) {
+    buffer.append( BINARY_FORMAT_MAGIC, 4 );
+    appendVarint( buffer, Amaunet::BINARY_FORMAT_VERSION );
+}
+
+bool readBinaryHeader( const char* &position, const char* end ) {
+    if ( end - position < 4 || memcmp( position, BINARY_FORMAT_MAGIC, 4 ) != 0 ) return false;
+
+    const char* cursor = position + 4;
+    unsigned long long version;
+    if ( not readVarint( cursor, end, version ) || version != Amaunet::BINARY_FORMAT_VERSION ) return false;
+
+    position = cursor;
+    return true;
+}
+
+int saveSumToBinaryFile( Sum &expr, string filename, int termsPerBlock, bool compress ) {
+    if ( termsPerBlock < 1 ) termsPerBlock = 1;
+
+    ofstream ofs;
+    ofs.open( filename.c_str(), ios::out | ios::binary );
+
+    if ( not ofs.is_open() ) {
+        cout << "***ERROR: Failed to open file '" << filename << "' for writing." << endl;
+        return -1;
+    }
+
+    string buffer;
+    appendBinaryHeader( buffer );
+    ofs.write( buffer.data(), buffer.size() );
+
+    int blockNo = 0;
+    vector<SymbolicTermPtr>::iterator blockBegin = expr.getIteratorBegin();
+    while ( blockBegin != expr.getIteratorEnd() ) {
+        vector<SymbolicTermPtr>::iterator blockEnd = blockBegin;
+        for ( int n = 0; n < termsPerBlock && blockEnd != expr.getIteratorEnd(); n++ ) ++blockEnd;
+
+        BlockStatistics statistics;
+        buffer.clear();
+        if ( not encodeBlock( blockBegin, blockEnd, buffer, compress, &statistics ) ) {
+            cout << "***ERROR: Failed to encode expression for file '" << filename << "'." << endl;
+            ofs.close();
+            return -1;
+        }
+
+        ofs.write( buffer.data(), buffer.size() );
+        blockBegin = blockEnd;
+
+        if ( compress ) {
+            cout << "Block " << blockNo << " of '" << filename << "': " << statistics.numTerms << " terms, "
+                 << statistics.payloadLength << " -> " << statistics.storedLength << " bytes (ratio "
+                 << (double)statistics.payloadLength / statistics.storedLength << "), "
+                 << statistics.payloadLength / ( statistics.seconds * 1.0e6 ) << " MB/s." << endl;
+        }
+        blockNo++;
+    }
+
+    ofs.close();
+    return 0;
+}
+
+Sum loadSumFromBinaryFile( string filename ) {
+    MappedFile file( filename );
+
+    if ( not file.isOpen() ) {
+        cout << "***ERROR: Failed to open file '" << filename << "' for reading." << endl;
+        return Sum();
+    }
+
+    const char* position = file.begin();
+
+    if ( not readBinaryHeader( position, file.end() ) ) {
+        cout << "***ERROR: File '" << filename << "' is not a supported binary expression file." << endl;
+        return Sum();
+    }
+
+    Sum expr;
+    while ( position < file.end() ) {
+        if ( not decodeBlock( position, file.end(), expr ) ) {
+            cout << "***ERROR: Corrupt block at byte " << ( position - file.begin() ) << " of file '" << filename << "'." << endl;
+            return Sum();
+        }
+    }
+
+    return expr;
+}
+
+Sum loadFilteredSumFromBinaryFile( string filename, const TermFilter &filter ) {
+    MappedFile file( filename );
+
+    if ( not file.isOpen() ) {
+        cout << "***ERROR: Failed to open file '" << filename << "' for reading." << endl;
+        return Sum();
+    }
+
+    const char* position = file.begin();
+
+    if ( not readBinaryHeader( position, file.end() ) ) {
+        cout << "***ERROR: File '" << filename << "' is not a supported binary expression file." << endl;
+        return Sum();
+    }
+
+    // Without an index there are no block statistics to test, so every block is scanned.
+    Sum expr;
+    while ( position < file.end() ) {
+        if ( not decodeFilteredBlock( position, file.end(), filter, expr ) ) {
+            cout << "***ERROR: Corrupt block at byte " << ( position - file.begin() ) << " of file '" << filename << "'." << endl;
+            return Sum();
+        }
+    }
+
+    return expr;
+}
+
+int convertTextFileToBinaryFile( string textFilename, string binaryFilename, int termsPerBlock, bool compress ) {
+    Sum expr = loadSumFromFile( textFilename );
+    return saveSumToBinaryFile( expr, binaryFilename, termsPerBlock, compress );
+}
+
+int convertBinaryFileToTextFile( string binaryFilename, string textFilename ) {
+    Sum expr = loadSumFromBinaryFile( binaryFilename );
+    return saveSumToFile( expr, textFilename );
+}
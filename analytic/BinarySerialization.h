@@ -0,0 +1,475 @@
+/* ***********************************************************************
+ * Amaunet: High-order Lattice Perturbation Theory
+ *          for Non-Relativistic Quantum Matter
+ *
+ * High-order Perturbation Theory Analytics
+ * Weak-coupling Expansion for Fermionic Contact Interactions
+ *
+ * Compact Binary Serialization of Expanded Expressions Header
+ *
+ * Andrew C. Loheac, Joaquin E. Drut
+ * Department of Physics and Astronomy
+ * University of North Carolina at Chapel Hill
+ * ***********************************************************************
+ */
+
+#ifndef AMAUNETC_BINARYSERIALIZATION_H
+#define AMAUNETC_BINARYSERIALIZATION_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include "PTSymbolicObjects.h"
+#include "PathIntegration.h"
+
+/*
+ * A binary expression file begins with the four byte magic string "AMNB" and the format version as a varint, followed
+ * by a sequence of blocks until the end of the file. Each block is laid out as
+ *
+ *     varint numTerms | 1 byte codec | varint storedLength | varint payloadLength | stored bytes |
+ *     4 byte little-endian Adler-32 checksum of the stored bytes
+ *
+ * where the stored bytes are the payload itself for the raw codec, or the payload compressed with deflate. The payload
+ * is a flavor table and a diagram table followed by the terms of the block, each prefixed by its length in bytes:
+ *
+ *     varint numFlavors | ( varint length | bytes )... |
+ *     varint numDiagrams | ( varint numPairs | zigzag i | zigzag j | ( zigzag delta i | zigzag delta j )... )... |
+ *     ( varint termLength | term )...
+ *
+ * The diagram table interns each distinct contraction vector of a FourierSum in the block once; the first pair of a
+ * vector is written as is and every following pair as its difference from the previous pair, which is small for the
+ * sorted vectors produced by the expansion.
+ *
+ * A term is a varint number of factors followed by each factor as its one byte TermTypes tag and a type-specific
+ * body. Unsigned integers are written as LEB128 varints and indices as zigzag varints; flavor labels and FourierSum
+ * contraction vectors are written as their position in the tables of the block. Integral fractions are written as a
+ * pair of zigzag varints, and all other coefficients as raw doubles. Only Sums of Products of MatrixK, MatrixS, TermA,
+ * TermE, Delta, CoefficientFloat, CoefficientFraction, and FourierSum factors may be written; a term of the Sum which
+ * is not a Product is written as a Product of one factor.
+ */
+
+namespace Amaunet {
+    extern const unsigned int BINARY_FORMAT_VERSION;
+}
+
+void appendVarint( std::string &buffer, unsigned long long value );
+
+/**
+ * Reads a varint and advances the position past it.
+ * @return True on success, false if the varint is truncated by end.
+ */
+bool readVarint( const char* &position, const char* end, unsigned long long &value );
+
+/**
+ * Appends a signed integer as a zigzag varint.
+ */
+void appendSignedVarint( std::string &buffer, long long value );
+
+/**
+ * Reads a zigzag varint and advances the position past it.
+ * @return True on success, false if the varint is truncated by end.
+ */
+bool readSignedVarint( const char* &position, const char* end, long long &value );
+
+/**
+ * Appends the raw bytes of a double in the byte order of the machine.
+ */
+void appendDouble( std::string &buffer, double value );
+
+/**
+ * Reads a double written by appendDouble() and advances the position past it.
+ * @return True on success, false if fewer than eight bytes remain.
+ */
+bool readDouble( const char* &position, const char* end, double &value );
+
+/**
+ * Appends a 32-bit unsigned integer in little-endian byte order.
+ */
+void appendUInt32( std::string &buffer, unsigned int value );
+
+/**
+ * Reads a little-endian 32-bit unsigned integer and advances the position past it.
+ * @return True on success, false if fewer than four bytes remain.
+ */
+bool readUInt32( const char* &position, const char* end, unsigned int &value );
+
+/**
+ * Computes the Adler-32 checksum of a sequence of bytes.
+ */
+unsigned int computeChecksum( const char* data, size_t length );
+
+/**
+ * Flavor labels and FourierSum contraction vectors encountered while encoding a block, each mapped to its position in
+ * the corresponding table of the block.
+ */
+struct BlockEncodingTables {
+
+    std::map<std::string, unsigned long long> flavors;
+
+    std::map<std::vector<IndexContraction>, unsigned long long> diagrams;
+
+};
+
+/**
+ * Flavor and diagram tables read from the start of a block payload. The number of vertices of each diagram is counted
+ * once per block rather than once per term.
+ */
+struct BlockTables {
+
+    std::vector<std::string> flavors;
+
+    std::vector<std::vector<IndexContraction> > diagrams;
+
+    std::vector<int> numVertices;
+
+};
+
+/**
+ * Sizes and encoding time of one block, as reported by encodeBlock().
+ */
+struct BlockStatistics {
+
+    BlockStatistics();
+
+    unsigned long long numTerms;
+
+    /**
+     * Length of the uncompressed payload.
+     */
+    unsigned long long payloadLength;
+
+    /**
+     * Length of the payload as stored in the block, which equals payloadLength if the block is not compressed.
+     */
+    unsigned long long storedLength;
+
+    /**
+     * Wall time spent encoding and compressing the block, in seconds.
+     */
+    double seconds;
+
+};
+
+/**
+ * Encodes a single term of an expanded expression.
+ * @param term The term to encode.
+ * @param tables Tables of the block so far; updated in place with any new flavor label or contraction vector.
+ * @param buffer The buffer to which the encoded term is appended.
+ * @return True on success, false if the term contains a factor which cannot be encoded.
+ */
+bool encodeTerm( SymbolicTermPtr term, BlockEncodingTables &tables, std::string &buffer );
+
+/**
+ * Encodes a range of terms as one complete block, including its header and checksum.
+ * @param buffer The buffer to which the block is appended.
+ * @param compress If true, the payload is compressed with deflate, unless that would not make it smaller.
+ * @param statistics If not nullptr, set to the sizes and encoding time of the block.
+ * @return True on success, false if any term cannot be encoded, in which case buffer is unmodified.
+ */
+bool encodeBlock( std::vector<SymbolicTermPtr>::iterator begin, std::vector<SymbolicTermPtr>::iterator end, std::string &buffer,
+                  bool compress = false, BlockStatistics* statistics = nullptr );
+
+/**
+ * Reads the header of a block, verifies its checksum, and decompresses its payload if necessary.
+ * @param position Position of the start of the block; advanced past the block on success.
+ * @param end End of the readable data.
+ * @param numTerms Set to the number of terms in the block.
+ * @param payload Set to the start of the payload of the block.
+ * @param payloadEnd Set to the end of the payload of the block.
+ * @param scratch Buffer into which a compressed payload is decompressed, in which case payload points into it. It may be
+ * reused between blocks to avoid allocation.
+ * @return True on success, false if the block is truncated, its checksum does not match, or it cannot be decompressed.
+ */
+bool readBlockHeader( const char* &position, const char* end, unsigned long long &numTerms, const char* &payload, const char* &payloadEnd,
+                      std::string &scratch );
+
+/**
+ * Reads the flavor and diagram tables at the start of a block payload and advances the position past them.
+ * @return True on success, false if either table is malformed.
+ */
+bool readBlockTables( const char* &position, const char* end, BlockTables &tables );
+
+/**
+ * Reads the length prefix of the next term of a block payload and advances the position past the term.
+ * @return True on success, false if the term is truncated.
+ */
+bool readTermBounds( const char* &position, const char* end, const char* &termBegin, const char* &termEnd );
+
+/**
+ * Decodes a single term, as bounded by readTermBounds(), into a Product.
+ * @return True on success, false if the term is malformed.
+ */
+bool decodeTerm( const char* begin, const char* end, const BlockTables &tables, Product &term );
+
+/**
+ * Decodes one block and adds its terms to a Sum. The checksum of the block is verified before any term is decoded.
+ * @param position Position of the start of the block; advanced past the block on success.
+ * @param end End of the readable data.
+ * @param terms The Sum to which decoded terms are added.
+ * @return True on success, false if the block is truncated, corrupt, or malformed.
+ */
+bool decodeBlock( const char* &position, const char* end, Sum &terms );
+
+/**
+ * Read-only view of a single encoded term, referencing the encoded bytes in place. The order in A, overall coefficient,
+ * and diagram of the FourierSum of the term are found by a single scan when the view is assigned, so that filtering
+ * and statistics over a file require no heap allocation per term. A Product is only built by materialize(). A view is
+ * only valid as long as the data and block tables it references.
+ */
+class TermView {
+
+public:
+
+    TermView();
+
+    /**
+     * Points this view at an encoded term and scans it.
+     * @return True on success, false if the term is malformed.
+     */
+    bool assign( const char* termBegin, const char* termEnd, const BlockTables* blockTables );
+
+    /**
+     * Gets the number of factors TermA in the term.
+     */
+    int getOrderInA() const;
+
+    /**
+     * Gets the product of all CoefficientFloat and CoefficientFraction factors in the term.
+     */
+    double getCoefficient() const;
+
+    /**
+     * Gets the number of contraction pairs of the FourierSum of the term, or zero if it has none.
+     */
+    int getNumberOfContractions() const;
+
+    /**
+     * Gets the number of vertices of the diagram of the term, which is the number of distinct indices among the
+     * contraction pairs of its FourierSum, or zero if it has none.
+     */
+    int getNumberOfVertices() const;
+
+    /**
+     * Gets the number of factors MatrixK of the given flavor in the term.
+     */
+    int getNumberOfMatrixK( const std::string &flavorLabel ) const;
+
+    /**
+     * Gets the number of factors MatrixK of any flavor in the term.
+     */
+    int getNumberOfMatrixK() const;
+
+    /**
+     * Decodes the contraction pairs of the FourierSum of the term into a caller-owned vector, which is cleared first.
+     */
+    void getContractions( std::vector<IndexContraction> &pairs ) const;
+
+    /**
+     * Builds the Product represented by this view on the heap.
+     */
+    SymbolicTermPtr materialize() const;
+
+private:
+
+    friend bool scanFactor( const char* &position, const char* end, TermView &view );
+
+    const char* begin;
+
+    const char* end;
+
+    const BlockTables* tables;
+
+    int orderInA;
+
+    double coefficient;
+
+    /**
+     * Position of the diagram of the FourierSum in the diagram table, or -1.
+     */
+    int diagram;
+
+    int numContractions;
+
+    int numVertices;
+
+    /**
+     * Number of factors MatrixK of each flavor, indexed by position in the flavor table.
+     */
+    std::vector<int> flavorCounts;
+
+};
+
+/**
+ * Simple predicate on the terms of an expanded expression, evaluated directly on a TermView. Every condition left at
+ * its default value matches any term.
+ */
+struct TermFilter {
+
+    TermFilter();
+
+    /**
+     * Range of the order in A; a negative maximum is unbounded.
+     */
+    int minOrderInA;
+
+    int maxOrderInA;
+
+    /**
+     * Required number of factors MatrixK of each flavor. If not empty, a matching term has exactly these counts and no
+     * MatrixK of any other flavor.
+     */
+    std::map<std::string, int> flavorCounts;
+
+    /**
+     * Range of the number of vertices of the diagram of the term; a negative maximum is unbounded.
+     */
+    int minVertices;
+
+    int maxVertices;
+
+    /**
+     * Determines if a term satisfies every condition of this filter.
+     */
+    bool matches( const TermView &term ) const;
+
+};
+
+/**
+ * Decodes the terms of one block which satisfy a filter and adds them to a Sum. Terms which do not match are scanned but
+ * never constructed. A block carries no statistics of its terms, so every term of the block is scanned; blocks are only
+ * skipped whole when read through the index of an archive (see ExpressionArchiveReader::readFilteredBlock()).
+ * @return True on success, false if the block is truncated, corrupt, or malformed.
+ */
+bool decodeFilteredBlock( const char* &position, const char* end, const TermFilter &filter, Sum &terms );
+
+/**
+ * Read-only memory mapping of an entire file, released on destruction.
+ */
+class MappedFile {
+
+public:
+
+    MappedFile( std::string filename );
+
+    ~MappedFile();
+
+    /**
+     * Determines if the file was successfully mapped. Empty files are never mapped.
+     */
+    bool isOpen() const;
+
+    const char* begin() const;
+
+    const char* end() const;
+
+private:
+
+    MappedFile( const MappedFile &other );
+
+    MappedFile& operator=( const MappedFile &rhs );
+
+    const char* data;
+
+    size_t length;
+};
+
+/**
+ * Sequential reader of a binary expression file over a memory mapping of the file. Each call to next() exposes the
+ * next term as a TermView directly over the mapped pages, which remains valid until the following call to next().
+ */
+class MappedExpressionReader {
+
+public:
+
+    MappedExpressionReader( std::string filename );
+
+    /**
+     * Advances to the next term of the file.
+     * @return True if a term is available, false at the end of the file or on error.
+     */
+    bool next();
+
+    /**
+     * Gets the view of the current term.
+     */
+    const TermView& getTerm() const;
+
+    /**
+     * Determines if the file could not be read or a corrupt block was encountered.
+     */
+    bool hasError() const;
+
+private:
+
+    MappedFile file;
+
+    const char* position;
+
+    const char* end;
+
+    const char* payload;
+
+    const char* payloadEnd;
+
+    unsigned long long termsRemaining;
+
+    BlockTables tables;
+
+    /**
+     * Decompressed payload of the current block, if it is compressed.
+     */
+    std::string scratch;
+
+    TermView view;
+
+    bool error;
+};
+
+/**
+ * Writes the header of a binary expression file.
+ */
+void appendBinaryHeader( std::string &buffer );
+
+/**
+ * Verifies the header of a binary expression file and advances the position past it.
+ * @return True if the header is valid and of a supported version, false otherwise.
+ */
+bool readBinaryHeader( const char* &position, const char* end );
+
+/**
+ * Saves a Sum of expanded Products in the binary format.
+ * @param expr The expression to save.
+ * @param filename The file to write.
+ * @param termsPerBlock The number of terms written to each block.
+ * @param compress If true, each block is compressed, and its compression ratio and encoding throughput are reported.
+ * @return 0 on success, -1 otherwise.
+ */
+int saveSumToBinaryFile( Sum &expr, std::string filename, int termsPerBlock, bool compress = false );
+
+/**
+ * Loads a Sum from a file written by saveSumToBinaryFile(). An empty Sum is returned if the file cannot be read or is
+ * corrupt.
+ */
+Sum loadSumFromBinaryFile( std::string filename );
+
+/**
+ * Loads only the terms of a file written by saveSumToBinaryFile() which satisfy a filter. The blocks of a binary file
+ * carry no order or vertex ranges, so every block is decompressed and scanned. Expressions which are to be filtered
+ * repeatedly should be written with splitSumToArchive() and loaded with loadFilteredSumFromArchive(), which skips whole
+ * blocks by the statistics in the index of the archive.
+ */
+Sum loadFilteredSumFromBinaryFile( std::string filename, const TermFilter &filter );
+
+/**
+ * Converts a file written by saveSumToFile() to the binary format.
+ * @return 0 on success, -1 otherwise.
+ */
+int convertTextFileToBinaryFile( std::string textFilename, std::string binaryFilename, int termsPerBlock, bool compress = false );
+
+/**
+ * Converts a file in the binary format to the Boost text format of saveSumToFile().
+ * @return 0 on success, -1 otherwise.
+ */
+int convertBinaryFileToTextFile( std::string binaryFilename, std::string textFilename );
+
+#endif //AMAUNETC_BINARYSERIALIZATION_H
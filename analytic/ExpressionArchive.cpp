@@ -0,0 +1,515 @@
+/* ***********************************************************************
+ * Amaunet: High-order Lattice Perturbation Theory
+ *          for Non-Relativistic Quantum Matter
+ *
+ * High-order Perturbation Theory Analytics
+ * Weak-coupling Expansion for Fermionic Contact Interactions
+ *
+ * Indexed Single-file Expression Archive Source Implementation
+ *
+ * Andrew C. Loheac, Joaquin E. Drut
+ * Department of Physics and Astronomy
+ * University of North Carolina at Chapel Hill
+ * ***********************************************************************
+ */
+
+#include <iostream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "PathIntegration.h"
+#include "ExpressionArchive.h"
+
+using namespace std;
+
+static const char ARCHIVE_MAGIC[4] = { 'A', 'M', 'N', 'C' };
+
+static const char ARCHIVE_TRAILER_MAGIC[4] = { 'A', 'M', 'N', 'E' };
+
+static const unsigned int ARCHIVE_VERSION = 4;
+
+/*
+ * Length of the fixed-size trailer: index offset (8), index checksum (4), and magic (4).
+ */
+static const long ARCHIVE_TRAILER_LENGTH = 16;
+
+ArchiveBlockInfo::ArchiveBlockInfo() : offset( 0 ), length( 0 ), numTerms( 0 ), minOrderInA( 0 ), maxOrderInA( 0 ),
+                                       minVertices( 0 ), maxVertices( 0 ), checksum( 0 ), group( 0 ) { }
+
+/*
+ * Gets the header with which every archive starts.
+ */
+static string getArchiveHeader() {
+    string header( ARCHIVE_MAGIC, 4 );
+    appendVarint( header, ARCHIVE_VERSION );
+    return header;
+}
+
+/*
+ * Reads the archive header and advances the position past it.
+ */
+static bool readArchiveHeader( const char* &position, const char* end ) {
+    unsigned long long version;
+
+    if ( end - position < 4 || memcmp( position, ARCHIVE_MAGIC, 4 ) != 0 ) return false;
+    position += 4;
+
+    return readVarint( position, end, version ) && version == ARCHIVE_VERSION;
+}
+
+/*
+ * Computes the statistics of the index entry of an encoded block by scanning each of its terms.
+ */
+static bool computeBlockStatistics( const char* begin, const char* end, ArchiveBlockInfo &entry ) {
+    const char* position = begin;
+    const char* payload;
+    const char* payloadEnd;
+    BlockTables tables;
+    string scratch;
+    TermView view;
+
+    if ( not readBlockHeader( position, end, entry.numTerms, payload, payloadEnd, scratch ) ) return false;
+    if ( not readBlockTables( payload, payloadEnd, tables ) ) return false;
+
+    for ( unsigned long long n = 0; n < entry.numTerms; n++ ) {
+        const char* termBegin;
+        const char* termEnd;
+
+        if ( not readTermBounds( payload, payloadEnd, termBegin, termEnd ) ) return false;
+        if ( not view.assign( termBegin, termEnd, &tables ) ) return false;
+
+        if ( n == 0 || view.getOrderInA() < entry.minOrderInA ) entry.minOrderInA = view.getOrderInA();
+        if ( n == 0 || view.getOrderInA() > entry.maxOrderInA ) entry.maxOrderInA = view.getOrderInA();
+        if ( n == 0 || view.getNumberOfVertices() < entry.minVertices ) entry.minVertices = view.getNumberOfVertices();
+        if ( n == 0 || view.getNumberOfVertices() > entry.maxVertices ) entry.maxVertices = view.getNumberOfVertices();
+    }
+
+    return true;
+}
+
+/*
+ * Writes an entire buffer at an offset of a file, retrying partial writes.
+ */
+static bool writeAt( int fd, const string &buffer, unsigned long long offset ) {
+    size_t written = 0;
+
+    while ( written < buffer.size() ) {
+        ssize_t result = pwrite( fd, buffer.data() + written, buffer.size() - written, (off_t)( offset + written ) );
+        if ( result <= 0 ) return false;
+        written += (size_t)result;
+    }
+
+    return true;
+}
+
+bool readArchiveIndex( const char* begin, const char* end, vector<ArchiveBlockInfo> &index, unsigned long long &indexOffset ) {
+    const char* header = begin;
+    if ( end - begin < 5 + ARCHIVE_TRAILER_LENGTH || not readArchiveHeader( header, end ) ) return false;
+
+    const char* trailer = end - ARCHIVE_TRAILER_LENGTH;
+    unsigned int low, high, indexChecksum;
+
+    if ( memcmp( trailer + 12, ARCHIVE_TRAILER_MAGIC, 4 ) != 0 ) return false;
+    readUInt32( trailer, end, low );
+    readUInt32( trailer, end, high );
+    readUInt32( trailer, end, indexChecksum );
+
+    unsigned long long offset = ( (unsigned long long)high << 32 ) | low;
+    if ( offset > (unsigned long long)( end - begin - ARCHIVE_TRAILER_LENGTH ) ) return false;
+
+    const char* position = begin + offset;
+    const char* indexEnd = end - ARCHIVE_TRAILER_LENGTH;
+    if ( computeChecksum( position, indexEnd - position ) != indexChecksum ) return false;
+
+    unsigned long long numBlocks;
+    if ( not readVarint( position, indexEnd, numBlocks ) ) return false;
+
+    vector<ArchiveBlockInfo> entries;
+    for ( unsigned long long n = 0; n < numBlocks; n++ ) {
+        ArchiveBlockInfo entry;
+        unsigned long long minOrder, maxOrder, minVertices, maxVertices, group, labelLength;
+
+        if ( not readVarint( position, indexEnd, entry.offset ) || not readVarint( position, indexEnd, entry.length )
+             || not readVarint( position, indexEnd, entry.numTerms ) || not readVarint( position, indexEnd, minOrder )
+             || not readVarint( position, indexEnd, maxOrder ) || not readVarint( position, indexEnd, minVertices )
+             || not readVarint( position, indexEnd, maxVertices ) || not readUInt32( position, indexEnd, entry.checksum )
+             || not readVarint( position, indexEnd, group ) || not readVarint( position, indexEnd, labelLength ) ) {
+            return false;
+        }
+        if ( entry.offset > offset || entry.length > offset - entry.offset ) return false;
+        if ( labelLength > (unsigned long long)( indexEnd - position ) ) return false;
+
+        entry.group = (int)group;
+        entry.label.assign( position, labelLength );
+        position += labelLength;
+
+        entry.minOrderInA = (int)minOrder;
+        entry.maxOrderInA = (int)maxOrder;
+        entry.minVertices = (int)minVertices;
+        entry.maxVertices = (int)maxVertices;
+        entries.push_back( entry );
+    }
+
+    index.swap( entries );
+    indexOffset = offset;
+    return true;
+}
+
+bool recoverArchiveIndex( const char* begin, const char* end, vector<ArchiveBlockInfo> &index, unsigned long long &endOfBlocks ) {
+    const char* position = begin;
+    if ( not readArchiveHeader( position, end ) ) return false;
+
+    vector<ArchiveBlockInfo> entries;
+    string scratch;
+
+    while ( position < end ) {
+        ArchiveBlockInfo entry;
+        const char* block = position;
+        const char* payload;
+        const char* payloadEnd;
+        unsigned long long group, labelLength, numTerms;
+
+        if ( not readVarint( block, end, group ) || not readVarint( block, end, labelLength )
+             || labelLength > (unsigned long long)( end - block ) ) {
+            break;
+        }
+        entry.group = (int)group;
+        entry.label.assign( block, labelLength );
+        block += labelLength;
+
+        // The block header verifies the checksum of the block, so a record which was never completely written ends the scan.
+        const char* blockEnd = block;
+        if ( not readBlockHeader( blockEnd, end, numTerms, payload, payloadEnd, scratch ) ) break;
+        if ( not computeBlockStatistics( block, blockEnd, entry ) ) break;
+
+        entry.offset = block - begin;
+        entry.length = blockEnd - block;
+        entry.checksum = computeChecksum( block, entry.length );
+        entries.push_back( entry );
+        position = blockEnd;
+    }
+
+    index.swap( entries );
+    endOfBlocks = position - begin;
+    return true;
+}
+
+/*
+ * Reads the index of a mapped archive, or recovers it from the log of records if it is missing or corrupt.
+ */
+static bool openArchiveIndex( const MappedFile &archive, const string &filename, vector<ArchiveBlockInfo> &index,
+                              unsigned long long &endOfBlocks ) {
+    if ( readArchiveIndex( archive.begin(), archive.end(), index, endOfBlocks ) ) return true;
+    if ( not recoverArchiveIndex( archive.begin(), archive.end(), index, endOfBlocks ) ) return false;
+
+    cout << "***WARNING: The index of archive '" << filename << "' is missing or corrupt. Recovered " << index.size()
+         << " blocks from its log." << endl;
+    return true;
+}
+
+/*
+ * ***********************************************************************
+ * ARCHIVE WRITER
+ * ***********************************************************************
+ */
+
+ExpressionArchiveWriter::ExpressionArchiveWriter( string thisFilename, bool thisCompress ) : filename( thisFilename ), fd( -1 ),
+                                                                                             compress( thisCompress ), endOfBlocks( 0 ),
+                                                                                             failed( false ), closed( false ) {
+    struct stat st;
+    bool exists = ( stat( filename.c_str(), &st ) == 0 && st.st_size > 0 );
+
+    if ( exists ) {
+        // Read the index of the existing archive before the file is opened for writing.
+        MappedFile existing( filename );
+        if ( not existing.isOpen() || not openArchiveIndex( existing, filename, index, endOfBlocks ) ) {
+            cout << "***ERROR: File '" << filename << "' is not a valid expression archive." << endl;
+            closed = true;
+            return;
+        }
+    }
+
+    fd = open( filename.c_str(), O_RDWR | O_CREAT, 0644 );
+    if ( fd < 0 ) {
+        cout << "***ERROR: Failed to open file '" << filename << "' for writing." << endl;
+        closed = true;
+        return;
+    }
+
+    if ( exists ) {
+        // Blocks appended from here on overwrite the old index, which is rewritten by close(). Until then, the index is
+        // recovered from the log should the writer stop.
+        if ( ftruncate( fd, (off_t)endOfBlocks ) != 0 ) failed = true;
+    } else {
+        string header = getArchiveHeader();
+        if ( not writeAt( fd, header, 0 ) ) failed = true;
+        endOfBlocks = header.size();
+    }
+}
+
+ExpressionArchiveWriter::~ExpressionArchiveWriter() {
+    if ( not closed ) close();
+}
+
+bool ExpressionArchiveWriter::isOpen() const {
+    return fd >= 0;
+}
+
+int ExpressionArchiveWriter::appendBlock( Sum &terms, int group, string label ) {
+    if ( fd < 0 || closed ) return -1;
+
+    ArchiveBlockInfo entry;
+    string record;
+
+    appendVarint( record, (unsigned long long)group );
+    appendVarint( record, label.size() );
+    record.append( label );
+    const size_t blockOffset = record.size();
+
+    BlockStatistics blockStatistics;
+    if ( not encodeBlock( terms.getIteratorBegin(), terms.getIteratorEnd(), record, compress, &blockStatistics ) ) {
+        cout << "***ERROR: Failed to encode a block for archive '" << filename << "'." << endl;
+        return -1;
+    }
+
+    entry.length = record.size() - blockOffset;
+    entry.checksum = computeChecksum( record.data() + blockOffset, entry.length );
+    entry.group = group;
+    entry.label = label;
+    computeBlockStatistics( record.data() + blockOffset, record.data() + record.size(), entry );
+
+    // Reserve the space of the record, then write it without holding the lock.
+    unsigned long long recordOffset;
+    int blockNo;
+    {
+        lock_guard<std::mutex> guard( mutex );
+        recordOffset = endOfBlocks;
+        entry.offset = recordOffset + blockOffset;
+        endOfBlocks += record.size();
+        blockNo = (int)index.size();
+        index.push_back( entry );
+
+        statistics.numTerms += blockStatistics.numTerms;
+        statistics.payloadLength += blockStatistics.payloadLength;
+        statistics.storedLength += blockStatistics.storedLength;
+        statistics.seconds += blockStatistics.seconds;
+    }
+
+    if ( compress ) {
+        lock_guard<std::mutex> guard( Amaunet::CONSOLE_MUTEX );
+        cout << "Block " << blockNo << " of '" << filename << "': " << blockStatistics.numTerms << " terms, "
+             << blockStatistics.payloadLength << " -> " << blockStatistics.storedLength << " bytes (ratio "
+             << (double)blockStatistics.payloadLength / blockStatistics.storedLength << "), "
+             << blockStatistics.payloadLength / ( blockStatistics.seconds * 1.0e6 ) << " MB/s." << endl;
+    }
+
+    if ( not writeAt( fd, record, recordOffset ) ) {
+        cout << "***ERROR: Failed to write block " << blockNo << " of archive '" << filename << "'." << endl;
+        lock_guard<std::mutex> guard( mutex );
+        failed = true;
+        return -1;
+    }
+
+    return blockNo;
+}
+
+int ExpressionArchiveWriter::truncate( int numBlocks ) {
+    if ( fd < 0 || closed ) return -1;
+
+    lock_guard<std::mutex> guard( mutex );
+    if ( numBlocks < 0 || numBlocks > (int)index.size() ) return -1;
+
+    index.resize( numBlocks );
+    endOfBlocks = index.empty() ? getArchiveHeader().size() : index.back().offset + index.back().length;
+
+    return ftruncate( fd, (off_t)endOfBlocks ) == 0 ? 0 : -1;
+}
+
+int ExpressionArchiveWriter::sync() {
+    if ( fd < 0 || closed ) return -1;
+    return fsync( fd ) == 0 ? 0 : -1;
+}
+
+int ExpressionArchiveWriter::getNumberOfBlocks() {
+    lock_guard<std::mutex> guard( mutex );
+    return (int)index.size();
+}
+
+ArchiveBlockInfo ExpressionArchiveWriter::getBlockInfo( int block ) {
+    lock_guard<std::mutex> guard( mutex );
+    return index[ block ];
+}
+
+BlockStatistics ExpressionArchiveWriter::getStatistics() {
+    lock_guard<std::mutex> guard( mutex );
+    return statistics;
+}
+
+int ExpressionArchiveWriter::close() {
+    if ( closed ) return -1;
+    closed = true;
+
+    string buffer;
+    appendVarint( buffer, index.size() );
+    for ( vector<ArchiveBlockInfo>::iterator entry = index.begin(); entry != index.end(); ++entry ) {
+        appendVarint( buffer, entry->offset );
+        appendVarint( buffer, entry->length );
+        appendVarint( buffer, entry->numTerms );
+        appendVarint( buffer, (unsigned long long)entry->minOrderInA );
+        appendVarint( buffer, (unsigned long long)entry->maxOrderInA );
+        appendVarint( buffer, (unsigned long long)entry->minVertices );
+        appendVarint( buffer, (unsigned long long)entry->maxVertices );
+        appendUInt32( buffer, entry->checksum );
+        appendVarint( buffer, (unsigned long long)entry->group );
+        appendVarint( buffer, entry->label.size() );
+        buffer.append( entry->label );
+    }
+
+    unsigned int indexChecksum = computeChecksum( buffer.data(), buffer.size() );
+    appendUInt32( buffer, (unsigned int)( endOfBlocks & 0xFFFFFFFF ) );
+    appendUInt32( buffer, (unsigned int)( endOfBlocks >> 32 ) );
+    appendUInt32( buffer, indexChecksum );
+    buffer.append( ARCHIVE_TRAILER_MAGIC, 4 );
+
+    // The trailer must end the file, which may hold a longer index of the archive as it was opened.
+    if ( not writeAt( fd, buffer, endOfBlocks ) || ftruncate( fd, (off_t)( endOfBlocks + buffer.size() ) ) != 0 || fsync( fd ) != 0 ) {
+        cout << "***ERROR: Failed to write the index of archive '" << filename << "'." << endl;
+        failed = true;
+    }
+
+    ::close( fd );
+    fd = -1;
+
+    return failed ? -1 : (int)index.size();
+}
+
+/*
+ * ***********************************************************************
+ * ARCHIVE READER
+ * ***********************************************************************
+ */
+
+ExpressionArchiveReader::ExpressionArchiveReader( string filename ) : file( filename ), valid( false ) {
+    unsigned long long endOfBlocks;
+
+    if ( file.isOpen() && openArchiveIndex( file, filename, index, endOfBlocks ) ) {
+        valid = true;
+    } else {
+        cout << "***ERROR: File '" << filename << "' is not a valid expression archive." << endl;
+    }
+}
+
+bool ExpressionArchiveReader::isOpen() const {
+    return valid;
+}
+
+int ExpressionArchiveReader::getNumberOfBlocks() const {
+    return (int)index.size();
+}
+
+const ArchiveBlockInfo& ExpressionArchiveReader::getBlockInfo( int block ) const {
+    return index[ block ];
+}
+
+bool ExpressionArchiveReader::verifyBlock( int block ) const {
+    if ( not valid || block < 0 || block >= (int)index.size() ) return false;
+
+    const ArchiveBlockInfo &entry = index[ block ];
+    return computeChecksum( file.begin() + entry.offset, entry.length ) == entry.checksum;
+}
+
+int ExpressionArchiveReader::readBlock( int block, Sum &terms ) const {
+    if ( not valid || block < 0 || block >= (int)index.size() ) return -1;
+
+    const ArchiveBlockInfo &entry = index[ block ];
+    const char* position = file.begin() + entry.offset;
+    const char* end = position + entry.length;
+
+    if ( computeChecksum( position, entry.length ) != entry.checksum ) return -1;
+    if ( not decodeBlock( position, end, terms ) || position != end ) return -1;
+
+    return 0;
+}
+
+int ExpressionArchiveReader::readFilteredBlock( int block, const TermFilter &filter, Sum &terms ) const {
+    if ( not valid || block < 0 || block >= (int)index.size() ) return -1;
+
+    const ArchiveBlockInfo &entry = index[ block ];
+    if ( not blockMayMatch( entry, filter ) ) return 0;
+
+    const char* position = file.begin() + entry.offset;
+    const char* end = position + entry.length;
+
+    if ( computeChecksum( position, entry.length ) != entry.checksum ) return -1;
+    if ( not decodeFilteredBlock( position, end, filter, terms ) || position != end ) return -1;
+
+    return 0;
+}
+
+bool blockMayMatch( const ArchiveBlockInfo &block, const TermFilter &filter ) {
+    if ( filter.maxOrderInA >= 0 && block.minOrderInA > filter.maxOrderInA ) return false;
+    if ( block.maxOrderInA < filter.minOrderInA ) return false;
+    if ( filter.maxVertices >= 0 && block.minVertices > filter.maxVertices ) return false;
+    if ( block.maxVertices < filter.minVertices ) return false;
+
+    return true;
+}
+
+/*
+ * ***********************************************************************
+ * WHOLE-EXPRESSION FUNCTIONS
+ * ***********************************************************************
+ */
+
+int splitSumToArchive( Sum &expr, int blockSize, string filename, bool compress ) {
+    if ( blockSize < 1 ) blockSize = 1;
+
+    // Always write a new archive.
+    remove( filename.c_str() );
+    ExpressionArchiveWriter writer( filename, compress );
+    if ( not writer.isOpen() ) return -1;
+
+    vector<SymbolicTermPtr>::iterator blockBegin = expr.getIteratorBegin();
+    while ( blockBegin != expr.getIteratorEnd() ) {
+        Sum block;
+        for ( int n = 0; n < blockSize && blockBegin != expr.getIteratorEnd(); n++ ) block.addTerm( *blockBegin++ );
+
+        if ( writer.appendBlock( block ) < 0 ) {
+            writer.close();
+            return -1;
+        }
+    }
+
+    return writer.close();
+}
+
+Sum loadSumFromArchive( string filename ) {
+    ExpressionArchiveReader reader( filename );
+    if ( not reader.isOpen() ) return Sum();
+
+    Sum expr;
+    for ( int block = 0; block < reader.getNumberOfBlocks(); block++ ) {
+        if ( reader.readBlock( block, expr ) != 0 ) {
+            cout << "***ERROR: Corrupt block " << block << " of archive '" << filename << "'." << endl;
+            return Sum();
+        }
+    }
+
+    return expr;
+}
+
+Sum loadFilteredSumFromArchive( string filename, const TermFilter &filter ) {
+    ExpressionArchiveReader reader( filename );
+    if ( not reader.isOpen() ) return Sum();
+
+    Sum expr;
+    for ( int block = 0; block < reader.getNumberOfBlocks(); block++ ) {
+        if ( reader.readFilteredBlock( block, filter, expr ) != 0 ) {
+            cout << "***ERROR: Corrupt block " << block << " of archive '" << filename << "'." << endl;
+            return Sum();
+        }
+    }
+
+    return expr;
+}
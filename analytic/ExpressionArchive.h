@@ -0,0 +1,281 @@
+/* ***********************************************************************
+ * Amaunet: High-order Lattice Perturbation Theory
+ *          for Non-Relativistic Quantum Matter
+ *
+ * High-order Perturbation Theory Analytics
+ * Weak-coupling Expansion for Fermionic Contact Interactions
+ *
+ * Indexed Single-file Expression Archive Header
+ *
+ * Andrew C. Loheac, Joaquin E. Drut
+ * Department of Physics and Astronomy
+ * University of North Carolina at Chapel Hill
+ * ***********************************************************************
+ */
+
+#ifndef AMAUNETC_EXPRESSIONARCHIVE_H
+#define AMAUNETC_EXPRESSIONARCHIVE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include "PTSymbolicObjects.h"
+#include "BinarySerialization.h"
+
+/*
+ * An expression archive holds an entire expression in a single file as an append-only log of records, each holding
+ * one block in the format of encodeBlock(), followed by an index of the blocks and a fixed-size trailer:
+ *
+ *     "AMNC" varint version | record | record | ... | index | trailer
+ *
+ *     record:  varint group | varint label length | label | block
+ *     index:   varint numBlocks | ( varint offset | varint length | varint numTerms | varint minOrderInA
+ *              | varint maxOrderInA | varint minVertices | varint maxVertices | 4 byte checksum | varint group
+ *              | varint label length | label )...
+ *     trailer: 4 byte low word of index offset | 4 byte high word of index offset | 4 byte index checksum | "AMNE"
+ *
+ * All fixed-size integers are little-endian and all checksums are Adler-32. The offset and checksum of an index entry
+ * refer to the encoded block of its record. An archive which is reopened for writing is truncated at its index, and new
+ * blocks are appended after the existing ones. Since each record carries its own label and each block its own checksum,
+ * the index of an archive whose writer did not close it is rebuilt by scanning the log (see recoverArchiveIndex()).
+ */
+
+/**
+ * Index entry of a single block of an expression archive.
+ */
+struct ArchiveBlockInfo {
+
+    ArchiveBlockInfo();
+
+    /**
+     * Byte offset of the block from the start of the archive.
+     */
+    unsigned long long offset;
+
+    /**
+     * Length of the encoded block in bytes.
+     */
+    unsigned long long length;
+
+    unsigned long long numTerms;
+
+    /**
+     * Lowest and highest order in A of the terms of the block.
+     */
+    int minOrderInA;
+
+    int maxOrderInA;
+
+    /**
+     * Lowest and highest number of diagram vertices of the terms of the block (see TermView::getNumberOfVertices()).
+     */
+    int minVertices;
+
+    int maxVertices;
+
+    unsigned int checksum;
+
+    /**
+     * Group number and label given to the block when it was appended, e.g. the block of terms and the partition (see
+     * getPartitionLabel()) of the terms it holds.
+     */
+    int group;
+
+    std::string label;
+
+};
+
+/**
+ * Writer of an expression archive. Blocks may be appended concurrently from any number of threads: the space of each
+ * block is reserved under a lock, and the block is written to its reserved offset outside of it. The index is written
+ * by close().
+ */
+class ExpressionArchiveWriter {
+
+public:
+
+    /**
+     * Opens an archive for writing. A new archive is created if the file does not exist or is empty; otherwise the
+     * existing archive is opened for appending. If the index of the existing archive is missing or corrupt, as it is
+     * when its writer did not close it, the index is recovered with recoverArchiveIndex().
+     * @param filename The archive file.
+     * @param compress If true, each block appended by this writer is compressed (see encodeBlock()).
+     */
+    ExpressionArchiveWriter( std::string filename, bool compress = false );
+
+    /**
+     * Destructor. Closes the archive if close() has not already been called.
+     */
+    ~ExpressionArchiveWriter();
+
+    /**
+     * Determines if the archive was successfully opened.
+     */
+    bool isOpen() const;
+
+    /**
+     * Appends a block holding all terms of a Sum. If the writer compresses its blocks, the compression ratio and
+     * throughput of the block are reported. Thread-safe.
+     * @param group Group number recorded with the block.
+     * @param label Label recorded with the block.
+     * @return The index of the block on success, -1 otherwise.
+     */
+    int appendBlock( Sum &terms, int group = 0, std::string label = "" );
+
+    /**
+     * Discards every block after the first numBlocks. Must be called before any block is appended.
+     * @return 0 on success, -1 otherwise.
+     */
+    int truncate( int numBlocks );
+
+    /**
+     * Syncs the blocks appended so far to disk, such that they are recovered should the archive not be closed. Blocks
+     * whose appendBlock() has not yet returned are not covered.
+     * @return 0 on success, -1 otherwise.
+     */
+    int sync();
+
+    /**
+     * Gets the number of blocks in the archive, including those of the archive when it was opened. Thread-safe.
+     */
+    int getNumberOfBlocks();
+
+    /**
+     * Gets a copy of the index entry of a block. Thread-safe.
+     */
+    ArchiveBlockInfo getBlockInfo( int block );
+
+    /**
+     * Gets the totals of the statistics of the blocks appended by this writer. Thread-safe.
+     */
+    BlockStatistics getStatistics();
+
+    /**
+     * Writes the index and trailer and syncs the archive to disk. Must only be called once all threads have finished
+     * appending blocks.
+     * @return The number of blocks in the archive, or -1 if any block or the index could not be written.
+     */
+    int close();
+
+private:
+
+    ExpressionArchiveWriter( const ExpressionArchiveWriter &other );
+
+    ExpressionArchiveWriter& operator=( const ExpressionArchiveWriter &rhs );
+
+    std::string filename;
+
+    int fd;
+
+    bool compress;
+
+    /**
+     * Offset at which the next block will be written.
+     */
+    unsigned long long endOfBlocks;
+
+    std::vector<ArchiveBlockInfo> index;
+
+    BlockStatistics statistics;
+
+    bool failed;
+
+    bool closed;
+
+    std::mutex mutex;
+
+};
+
+/**
+ * Random-access reader of an expression archive over a memory mapping of the archive.
+ */
+class ExpressionArchiveReader {
+
+public:
+
+    ExpressionArchiveReader( std::string filename );
+
+    /**
+     * Determines if the archive was mapped and its index read successfully.
+     */
+    bool isOpen() const;
+
+    int getNumberOfBlocks() const;
+
+    const ArchiveBlockInfo& getBlockInfo( int block ) const;
+
+    /**
+     * Determines if the checksum of a block matches its index entry, without decoding the block. Thread-safe.
+     */
+    bool verifyBlock( int block ) const;
+
+    /**
+     * Decodes a block and adds its terms to a Sum. Thread-safe.
+     * @return 0 on success, -1 if the block is corrupt.
+     */
+    int readBlock( int block, Sum &terms ) const;
+
+    /**
+     * Decodes the terms of a block which satisfy a filter and adds them to a Sum. A block whose index statistics show
+     * that none of its terms can match is skipped without being read. Thread-safe.
+     * @return 0 on success, -1 if the block is corrupt.
+     */
+    int readFilteredBlock( int block, const TermFilter &filter, Sum &terms ) const;
+
+private:
+
+    MappedFile file;
+
+    std::vector<ArchiveBlockInfo> index;
+
+    bool valid;
+
+};
+
+/**
+ * Reads the index of an archive held in memory.
+ * @param begin Start of the archive.
+ * @param end End of the archive.
+ * @param index Set to the index entries of the archive.
+ * @param indexOffset Set to the offset of the index, which is also the end of the block log.
+ * @return True on success, false if the archive is truncated or its trailer or index are corrupt.
+ */
+bool readArchiveIndex( const char* begin, const char* end, std::vector<ArchiveBlockInfo> &index, unsigned long long &indexOffset );
+
+/**
+ * Rebuilds the index of an archive held in memory by scanning its log of records from the start. The scan stops at the
+ * first record which is truncated or whose block fails its checksum, such as the old index, a block which was being
+ * written when the writer stopped, or a gap left by a concurrent append which never completed; every record after it
+ * is lost.
+ * @param begin Start of the archive.
+ * @param end End of the archive.
+ * @param index Set to the index entries of the intact records.
+ * @param endOfBlocks Set to the end of the last intact record.
+ * @return True on success, false if the archive header is missing or invalid.
+ */
+bool recoverArchiveIndex( const char* begin, const char* end, std::vector<ArchiveBlockInfo> &index, unsigned long long &endOfBlocks );
+
+/**
+ * Determines from the index statistics of a block whether any of its terms may satisfy a filter. Conditions on flavor
+ * counts are not reflected in the statistics and never exclude a block.
+ */
+bool blockMayMatch( const ArchiveBlockInfo &block, const TermFilter &filter );
+
+/**
+ * Writes an expression to a new archive in blocks of blockSize terms, compressing each block if compress is true.
+ * @return The number of blocks written, or -1 on failure.
+ */
+int splitSumToArchive( Sum &expr, int blockSize, std::string filename, bool compress = false );
+
+/**
+ * Loads every block of an archive into a single Sum. An empty Sum is returned if the archive cannot be read or is
+ * corrupt.
+ */
+Sum loadSumFromArchive( std::string filename );
+
+/**
+ * Loads only the terms of an archive which satisfy a filter, skipping whole blocks by their index statistics.
+ */
+Sum loadFilteredSumFromArchive( std::string filename, const TermFilter &filter );
+
+#endif //AMAUNETC_EXPRESSIONARCHIVE_H
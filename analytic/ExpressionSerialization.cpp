@@ -4,13 +4,95 @@
 
 #include <fstream>
 #include <sstream>
+#include <cmath>
+#include <queue>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
 #include "omp.h"
 #include "ExpressionSerialization.h"
 #include "Multithreading.h"
+#include "BinarySerialization.h"
 
 using namespace std;
 
-int saveSumToFile( Sum &expr, string filename ) {
+/*
+ * Number of reader threads and number of archive blocks loaded ahead of the reduction of each partition.
+ */
+static const int PREFETCH_READERS = 2;
+static const int PREFETCH_DEPTH = 2;
+
+/*
+ * Maximum number of terms in each block of the archive written by mergeCombinePartitionsFromArchive().
+ */
+static const int MERGED_BLOCK_SIZE = 10000;
+
+/*
+ * Budget of evaluated terms held by blocks waiting to be written by multithreaded_splitExpandAndEvaluateByPartsToFiles().
+ */
+static const unsigned long long ASYNC_WRITER_MAX_PENDING_TERMS = 2000000;
+
+/*
+ * Level used to compress expression files, favoring speed since the files are written once per block of terms.
+ */
+static const int EXPRESSION_FILE_COMPRESSION_LEVEL = 1;
+
+/*
+ * Writes an expression in the Boost text format to a gzip file.
+ */
+static int saveCompressedSumToFile( Sum &expr, string filename ) {
+    double start = omp_get_wtime();
+    stringstream ss;
+
+    {
+        boost::archive::text_oarchive oa{ ss };
+        oa << expr;
+    }
+    string contents = ss.str();
+
+    gzFile file = gzopen( filename.c_str(), "wb" );
+    if ( file == NULL ) {
+        cout << "***ERROR: Failed to open file '" << filename << "' for writing." << endl;
+        return -1;
+    }
+
+    gzsetparams( file, EXPRESSION_FILE_COMPRESSION_LEVEL, Z_DEFAULT_STRATEGY );
+    bool written = contents.empty() || gzwrite( file, contents.data(), (unsigned int)contents.size() ) == (int)contents.size();
+    if ( gzclose( file ) != Z_OK || not written ) {
+        cout << "***ERROR: Failed to write file '" << filename << "'." << endl;
+        return -1;
+    }
+
+    struct stat st;
+    double seconds = omp_get_wtime() - start;
+    long long storedLength = ( stat( filename.c_str(), &st ) == 0 ) ? (long long)st.st_size : 0;
+
+    cout << "Expression written to file '" << filename << "' (" << contents.size() << " -> " << storedLength << " bytes, ratio "
+         << (double)contents.size() / max( storedLength, 1LL ) << ", " << contents.size() / ( seconds * 1.0e6 ) << " MB/s)." << endl;
+    return 0;
+}
+
+/*
+ * Reads an entire gzip file into memory.
+ */
+static bool readCompressedFile( string filename, string &contents ) {
+    gzFile file = gzopen( filename.c_str(), "rb" );
+    if ( file == NULL ) return false;
+
+    char chunk[ 1 << 16 ];
+    int length;
+    while ( ( length = gzread( file, chunk, sizeof( chunk ) ) ) > 0 ) contents.append( chunk, length );
+
+    return gzclose( file ) == Z_OK && length == 0;
+}
+
+int saveSumToFile( Sum &expr, string filename, bool compress ) {
+    if ( compress ) return saveCompressedSumToFile( expr, filename );
+
     ofstream ofs;
 
     ofs.open( filename.c_str() );
@@ -38,98 +120,776 @@ Sum loadSumFromFile( string filename ) {
         return Sum();
     }
 
-    boost::archive::text_iarchive ia{ ifs };
     Sum expr;
-    ia >> expr;
-    ifs.close();
 
-    cout << "Expression loaded from file '" << filename << "'." << endl;
+    // Files written with compression start with the two byte gzip magic number, which never begins a text archive.
+    if ( ifs.peek() == 0x1F ) {
+        ifs.close();
+
+        string contents;
+        if ( not readCompressedFile( filename, contents ) ) {
+            cout << "***ERROR: Failed to decompress file '" << filename << "'." << endl;
+            return Sum();
+        }
+
+        stringstream ss( contents );
+        boost::archive::text_iarchive ia{ ss };
+        ia >> expr;
+    } else {
+        boost::archive::text_iarchive ia{ ifs };
+        ia >> expr;
+        ifs.close();
+    }
+
+    // Files are loaded concurrently by several threads, so only the report is serialized.
+    {
+        lock_guard<std::mutex> guard( Amaunet::CONSOLE_MUTEX );
+        cout << "Expression loaded from file '" << filename << "'." << endl;
+    }
     return expr;
 }
 
+int saveDiagramCatalogToFile( DiagramCatalog &catalog, string filename ) {
+    ofstream ofs;
+
+    ofs.open( filename.c_str() );
+
+    if ( not ofs.is_open() ) {
+        cout << "***ERROR: Failed to open file '" << filename << "' for writing." << endl;
+        return -1;
+    }
+
+    boost::archive::text_oarchive oa{ ofs };
+    oa << catalog;
+    ofs.close();
+
+    cout << "Diagram catalog written to file '" << filename << "'." << endl;
+    return 0;
+}
+
+int loadDiagramCatalogFromFile( DiagramCatalog &catalog, string filename ) {
+    ifstream ifs;
+
+    ifs.open( filename.c_str() );
+
+    if ( not ifs.is_open() ) {
+        cout << "***ERROR: Failed to open file '" << filename << "' for reading." << endl;
+        return -1;
+    }
+
+    // The catalog is only a cache, so a truncated or incompatible file leaves it empty rather than ending the run.
+    try {
+        boost::archive::text_iarchive ia{ ifs };
+        ia >> catalog;
+    } catch ( boost::archive::archive_exception &e ) {
+        cout << "***WARNING: Failed to read diagram catalog from file '" << filename << "' (" << e.what() << "). Continuing with an empty catalog." << endl;
+        catalog.clear();
+        return -1;
+    } catch ( std::exception &e ) {
+        cout << "***WARNING: Failed to read diagram catalog from file '" << filename << "' (" << e.what() << "). Continuing with an empty catalog." << endl;
+        catalog.clear();
+        return -1;
+    }
+    ifs.close();
+
+    cout << "Diagram catalog loaded from file '" << filename << "'." << endl;
+    return 0;
+}
+
 int splitSumToFiles( Sum &expr, int blockSize, string saveDir ) {
-    cout << ">> Expression contains " << expr.getNumberOfTerms() << " terms to write. " << expr.getNumberOfTerms() / blockSize << " files required." << endl;
+    cout << ">> Expression contains " << expr.getNumberOfTerms() << " terms to write. " << (int)ceil( (float)expr.getNumberOfTerms() / (float)blockSize ) << " files required." << endl;
 
-    // Check for case where the number of terms in expr is less than or equal blockSize. If this is the case, save the
-    // entire sum to one file.
-    if ( expr.getNumberOfTerms() <= blockSize ) {
-        stringstream ssfilename;
-        ssfilename << saveDir << "/EX0.out";
-        cout << "***NOTE: Length of expression (" << expr.getNumberOfTerms() << " terms) less than block size. Saving expression to single file." << endl;
-        saveSumToFile( expr, ssfilename.str() );
-        return 1;
+    ExpressionFileWriter writer( saveDir, blockSize );
+
+    for ( vector<SymbolicTermPtr>::iterator iter = expr.getIteratorBegin(); iter != expr.getIteratorEnd(); ++iter ) {
+        if ( writer.addTerm( (*iter)->copy() ) != 0 ) {
+            cout << "***ERROR: Failed to save a partial sum." << endl;
+            exit( -1 );  // Critical failure -- must terminate calculation.
+        }
     }
 
-    Sum subsum;
+    int numberOfFiles = writer.close();
+    if ( numberOfFiles < 0 ) {
+        cout << "***ERROR: Failed to save a partial sum." << endl;
+        exit( -1 );  // Critical failure -- must terminate calculation.
+    }
+
+    return numberOfFiles;
+}
+
+/*
+ * Flushes a closed file to disk.
+ */
+static int syncFile( string filename ) {
+    int fd = open( filename.c_str(), O_RDONLY );
+    if ( fd < 0 ) return -1;
+
+    int result = fsync( fd );
+    close( fd );
+
+    return result == 0 ? 0 : -1;
+}
+
+ExpressionFileWriter::ExpressionFileWriter( string thisSaveDir, int thisTermsPerFile, bool thisCompress ) : saveDir( thisSaveDir ),
+    termsPerFile( thisTermsPerFile < 1 ? 1 : thisTermsPerFile ), compress( thisCompress ), numberOfFiles( 0 ), failed( false ),
+    closed( false ) {
+    omp_init_lock( &lock );
+}
+
+ExpressionFileWriter::~ExpressionFileWriter() {
+    if ( not closed ) close();
+    omp_destroy_lock( &lock );
+}
+
+int ExpressionFileWriter::writeFile( vector<SymbolicTermPtr> &terms, int fileNo ) {
+    stringstream ssfilename;
+    ssfilename << saveDir << "/EX" << fileNo << ".out";
+
+    Sum contents( terms );
+    if ( saveSumToFile( contents, ssfilename.str(), compress ) != 0 ) return -1;
+
+    // saveSumToFile() closes the stream, which only hands the data to the operating system; sync the file so that a
+    // written file survives a crash of the machine.
+    return syncFile( ssfilename.str() );
+}
+
+int ExpressionFileWriter::addTerm( SymbolicTermPtr term ) {
+    Sum batch( term );
+    return addTerms( batch );
+}
+
+int ExpressionFileWriter::addTerms( Sum &terms ) {
+    vector<SymbolicTermPtr> full;
     int fileNo = 0;
-    for ( vector<SymbolicTermPtr>::iterator iter = expr.getIteratorBegin(); iter != expr.getIteratorEnd(); ++iter ) {
-        if ( subsum.getNumberOfTerms() == blockSize ) {
-            // Concatenate filename for the next expression to serialize and output to file.
-            stringstream ssfilename;
-            ssfilename << saveDir << "/EX" << fileNo << ".out";
 
-            // Save the file.
-            int result = saveSumToFile( subsum, ssfilename.str() );
+    omp_set_lock( &lock );
+    buffer.insert( buffer.end(), terms.getIteratorBegin(), terms.getIteratorEnd() );
+    if ( (int)buffer.size() >= termsPerFile ) {
+        full.swap( buffer );
+        fileNo = numberOfFiles++;
+    }
+    omp_unset_lock( &lock );
+
+    // Serialize outside of the lock so that other threads may continue to buffer terms while this file is written.
+    if ( not full.empty() && writeFile( full, fileNo ) != 0 ) {
+        cout << "***ERROR: Failed to write file " << fileNo << " of the expression stream to '" << saveDir << "'." << endl;
+        omp_set_lock( &lock );
+        failed = true;
+        omp_unset_lock( &lock );
+        return -1;
+    }
 
-            // Check for an error from the above call.
-            if ( result != 0 ) {
-                cout << "***ERROR: Failed to save a partial sum." << endl;
-                exit( -1 );  // Critical failure -- must terminate calculation.
+    return 0;
+}
+
+int ExpressionFileWriter::close() {
+    closed = true;
+
+    if ( not buffer.empty() ) {
+        if ( writeFile( buffer, numberOfFiles ) != 0 ) {
+            cout << "***ERROR: Failed to write file " << numberOfFiles << " of the expression stream to '" << saveDir << "'." << endl;
+            failed = true;
+        }
+
+        buffer.clear();
+        numberOfFiles++;
+    }
+
+    return failed ? -1 : numberOfFiles;
+}
+
+PrefetchingLoader::PrefetchingLoader( int thisNumberOfItems, function<Sum( int )> thisLoad, int numReaders, int thisCapacity ) :
+    numberOfItems( thisNumberOfItems ), load( thisLoad ), capacity( thisCapacity < 1 ? 1 : thisCapacity ), nextToLoad( 0 ),
+    nextToDeliver( 0 ), stopping( false ) {
+    for ( int i = 0; i < max( 1, numReaders ); i++ ) {
+        readers.push_back( thread( &PrefetchingLoader::readerLoop, this ) );
+    }
+}
+
+PrefetchingLoader::~PrefetchingLoader() {
+    {
+        lock_guard<std::mutex> guard( mutex );
+        stopping = true;
+    }
+    itemDelivered.notify_all();
+
+    for ( vector<thread>::iterator reader = readers.begin(); reader != readers.end(); ++reader ) reader->join();
+}
+
+void PrefetchingLoader::readerLoop() {
+    while ( true ) {
+        int item;
+        {
+            unique_lock<std::mutex> guard( mutex );
+            itemDelivered.wait( guard, [ this ] {
+                return stopping || nextToLoad >= numberOfItems || nextToLoad < nextToDeliver + capacity;
+            } );
+
+            if ( stopping || nextToLoad >= numberOfItems ) return;
+            item = nextToLoad++;
+        }
+
+        // Share the loaded terms rather than deep copying the partial sum.
+        Sum loaded = load( item );
+        SumPtr partialSum( new Sum( vector<SymbolicTermPtr>( loaded.getIteratorBegin(), loaded.getIteratorEnd() ) ) );
+
+        {
+            lock_guard<std::mutex> guard( mutex );
+            ready[ item ] = partialSum;
+        }
+        itemLoaded.notify_all();
+    }
+}
+
+bool PrefetchingLoader::next( SumPtr &partialSum, int &item ) {
+    unique_lock<std::mutex> guard( mutex );
+    if ( nextToDeliver >= numberOfItems ) return false;
+
+    itemLoaded.wait( guard, [ this ] { return ready.count( nextToDeliver ) > 0; } );
+
+    item = nextToDeliver;
+    partialSum = ready[ item ];
+    ready.erase( item );
+    nextToDeliver++;
+    guard.unlock();
+
+    itemDelivered.notify_all();
+    return true;
+}
+
+AsyncBlockWriter::AsyncBlockWriter( unsigned long long thisMaxPendingTerms ) : maxPendingTerms( thisMaxPendingTerms ),
+    pendingTerms( 0 ), closing( false ), closed( false ), failed( false ) {
+    writer = thread( &AsyncBlockWriter::writerLoop, this );
+}
+
+AsyncBlockWriter::~AsyncBlockWriter() {
+    if ( not closed ) close();
+}
+
+void AsyncBlockWriter::writerLoop() {
+    while ( true ) {
+        pair<function<int()>, unsigned long long> job;
+        {
+            unique_lock<std::mutex> guard( mutex );
+            jobSubmitted.wait( guard, [ this ] { return closing || not pending.empty(); } );
+
+            if ( pending.empty() ) return;
+            job = pending.front();
+            pending.pop_front();
+        }
+
+        int result = job.first();
+
+        {
+            lock_guard<std::mutex> guard( mutex );
+            if ( result != 0 ) failed = true;
+
+            // The terms of a job are only released once it has completed.
+            pendingTerms -= job.second;
+        }
+        jobCompleted.notify_all();
+    }
+}
+
+void AsyncBlockWriter::submit( function<int()> write, unsigned long long numTerms ) {
+    {
+        unique_lock<std::mutex> guard( mutex );
+        jobCompleted.wait( guard, [ this, numTerms ] {
+            return pendingTerms == 0 || pendingTerms + numTerms <= maxPendingTerms;
+        } );
+
+        pending.push_back( make_pair( write, numTerms ) );
+        pendingTerms += numTerms;
+    }
+    jobSubmitted.notify_one();
+}
+
+int AsyncBlockWriter::close() {
+    if ( closed ) return failed ? -1 : 0;
+
+    {
+        lock_guard<std::mutex> guard( mutex );
+        closing = true;
+    }
+    jobSubmitted.notify_one();
+
+    writer.join();
+    closed = true;
+
+    return failed ? -1 : 0;
+}
+
+int saveSortedRunToFile( Sum &expr, DiagramCatalog &catalog, string filename ) {
+    ofstream ofs;
+
+    ofs.open( filename.c_str() );
+
+    if ( not ofs.is_open() ) {
+        cout << "***ERROR: Failed to open file '" << filename << "' for writing." << endl;
+        return -1;
+    }
+
+    vector< pair<string, string> > records;
+    for ( vector<SymbolicTermPtr>::iterator term = expr.getIteratorBegin(); term != expr.getIteratorEnd(); ++term ) {
+        SymbolicTermPtr nextTerm = *term;
+        if ( nextTerm->getTermID() != TermTypes::PRODUCT ) nextTerm = Product( nextTerm ).copy();
+
+        string groupKey;
+        CoefficientFraction coefficient;
+        vector<IndexContraction> contractions;
+        Product factors;
+        decomposeEvaluatedTerm( nextTerm, groupKey, coefficient, contractions, factors );
+
+        // The diagrams of a combined expression are already registered, so this is a lookup of the memoized form.
+        vector<IndexContraction> canonicalForm = catalog.getCanonicalForm( catalog.registerDiagram( contractions ) );
+        if ( canonicalForm.size() > 0 ) {
+            factors.addTerm( FourierSumPtr( new FourierSum( canonicalForm, (int)canonicalForm.size() ) ) );
+        }
+
+        stringstream record;
+        {
+            boost::archive::text_oarchive oa{ record };
+            oa << coefficient;
+            oa << factors;
+        }
+
+        records.push_back( make_pair( groupKey + "|" + getContractionVectorKey( canonicalForm ), record.str() ) );
+    }
+
+    sort( records.begin(), records.end() );
+    for ( vector< pair<string, string> >::iterator record = records.begin(); record != records.end(); ++record ) {
+        ofs << record->first << "\n" << record->second.size() << "\n" << record->second;
+    }
+
+    ofs.close();
+    return 0;
+}
+
+SortedRunReader::SortedRunReader( string filename ) {
+    ifs.open( filename.c_str() );
+
+    if ( not ifs.is_open() ) {
+        cout << "***ERROR: Failed to open file '" << filename << "' for reading." << endl;
+    }
+}
+
+bool SortedRunReader::next() {
+    unsigned long recordLength;
+
+    if ( not getline( ifs, key ) ) return false;
+    if ( not ( ifs >> recordLength ) ) return false;
+    ifs.ignore( 1 );  // Newline following the record length.
+
+    string record( recordLength, ' ' );
+    ifs.read( &record[0], recordLength );
+
+    stringstream ss( record );
+    boost::archive::text_iarchive ia{ ss };
+    factors = Product();
+    ia >> coefficient;
+    ia >> factors;
+
+    return true;
+}
+
+const string &SortedRunReader::getKey() const {
+    return key;
+}
+
+CoefficientFraction SortedRunReader::getCoefficient() const {
+    return coefficient;
+}
+
+Product SortedRunReader::getFactors() const {
+    return factors;
+}
+
+/*
+ * Merges sorted runs written by saveSortedRunToFile() and appends the combined terms to an archive in blocks of at most
+ * MERGED_BLOCK_SIZE terms, recorded under the given group and label. Only the current record of each run and one
+ * output block are held in memory.
+ * @return The number of terms written, or -1 on failure.
+ */
+static long long mergeSortedRunsToArchive( vector<string> &runFilenames, ExpressionArchiveWriter &output, int group, string label ) {
+    // The queue holds the key of the current record of each run; ties are broken by run number, such that the factors
+    // of a combined term are always taken from the lowest numbered run in which it appears.
+    vector< shared_ptr<SortedRunReader> > runs;
+    priority_queue< pair<string, int>, vector< pair<string, int> >, greater< pair<string, int> > > heads;
+    for ( int run = 0; run < (int)runFilenames.size(); run++ ) {
+        runs.push_back( shared_ptr<SortedRunReader>( new SortedRunReader( runFilenames[ run ] ) ) );
+
+        if ( runs.back()->next() ) heads.push( pair<string, int>( runs.back()->getKey(), run ) );
+    }
+
+    Sum mergedBlock;
+    long long numTerms = 0;
+    while ( not heads.empty() ) {
+        string key = heads.top().first;
+        Product combinedTerm = runs[ heads.top().second ]->getFactors();
+        CoefficientFraction coefficient( 0, 1 );
+
+        while ( not heads.empty() and heads.top().first == key ) {
+            int run = heads.top().second;
+            heads.pop();
+
+            coefficient += runs[ run ]->getCoefficient();
+            if ( runs[ run ]->next() ) heads.push( pair<string, int>( runs[ run ]->getKey(), run ) );
+        }
+
+        if ( coefficient.eval() == 0 ) continue;
+
+        combinedTerm.addTerm( coefficient.copy() );
+        mergedBlock.addTerm( combinedTerm.copy() );
+        numTerms++;
+
+        if ( mergedBlock.getNumberOfTerms() >= MERGED_BLOCK_SIZE ) {
+            if ( output.appendBlock( mergedBlock, group, label ) < 0 ) return -1;
+            mergedBlock = Sum();
+        }
+    }
+
+    if ( mergedBlock.getNumberOfTerms() > 0 && output.appendBlock( mergedBlock, group, label ) < 0 ) return -1;
+
+    return numTerms;
+}
+
+string getPartitionLabel( SymbolicTermPtr term, int &orderInA ) {
+    if ( term->getTermID() != TermTypes::PRODUCT ) term = Product( term ).copy();
+
+    orderInA = getProductAOrder( term );
+    map<string, int> flavorLabelOrder = getFlavorLabelOrder( term );
+
+    stringstream label;
+    label << "A" << orderInA;
+    for ( map<string, int>::iterator flavor = flavorLabelOrder.begin(); flavor != flavorLabelOrder.end(); ++flavor ) {
+        label << "_K" << flavor->first << "-" << flavor->second;
+    }
+
+    return label.str();
+}
+
+int savePartitionedSumToArchive( Sum &expr, ExpressionArchiveWriter &archive, int blockNo ) {
+    map<string, Sum> partitionedExpression;
+
+    for ( vector<SymbolicTermPtr>::iterator term = expr.getIteratorBegin(); term != expr.getIteratorEnd(); ++term ) {
+        int orderInA;
+        string label = getPartitionLabel( *term, orderInA );
+
+        partitionedExpression[ label ].addTerm( (*term)->copy() );
+    }
+
+    for ( map<string, Sum>::iterator partition = partitionedExpression.begin(); partition != partitionedExpression.end(); ++partition ) {
+        if ( archive.appendBlock( partition->second, blockNo, partition->first ) < 0 ) return -1;
+    }
+
+    return 0;
+}
+
+long long mergeCombinePartitionsFromArchive( string filename, string outputFilename, int maxOrderInA, int NUM_THREADS ) {
+    ExpressionArchiveReader archive( filename );
+    if ( not archive.isOpen() ) return -1;
+
+    // Each block of the archive holds the terms of one partition of one block of the run, which share an order in A.
+    map<string, vector<int> > blocksByPartition;
+    for ( int block = 0; block < archive.getNumberOfBlocks(); block++ ) {
+        const ArchiveBlockInfo &info = archive.getBlockInfo( block );
+        if ( info.minOrderInA <= maxOrderInA ) blocksByPartition[ info.label ].push_back( block );
+    }
+
+    vector<string> labels;
+    for ( map<string, vector<int> >::iterator partition = blocksByPartition.begin(); partition != blocksByPartition.end(); ++partition ) {
+        labels.push_back( partition->first );
+    }
+
+    remove( outputFilename.c_str() );
+    ExpressionArchiveWriter output( outputFilename );
+    if ( not output.isOpen() ) {
+        cout << "***ERROR: Failed to open archive '" << outputFilename << "' for writing." << endl;
+        return -1;
+    }
+
+    cout << ">> Reducing " << labels.size() << " partitions..." << endl;
+    long long numTerms = 0;
+    bool failed = false;
+
+    omp_set_num_threads( NUM_THREADS );
+
+#pragma omp parallel for schedule( dynamic ) shared( labels, blocksByPartition, numTerms, failed )
+    for ( int partition = 0; partition < labels.size(); partition++ ) {
+        vector<int> &blocks = blocksByPartition[ labels[ partition ] ];
+        atomic<bool> corrupt( false );
+
+        // Combine each archive block of the partition on its own and write it as a sorted run, while upcoming blocks
+        // are loaded.
+        PrefetchingLoader loader( (int)blocks.size(), [ &archive, &blocks, &corrupt, filename ]( int n ) {
+            Sum terms;
+            if ( archive.readBlock( blocks[ n ], terms ) != 0 ) {
+                lock_guard<std::mutex> guard( Amaunet::CONSOLE_MUTEX );
+                cout << "***ERROR: Corrupt block " << blocks[ n ] << " of archive '" << filename << "'." << endl;
+                corrupt = true;
             }
+            return terms;
+        }, PREFETCH_READERS, PREFETCH_DEPTH );
 
-            // Set subsum to a new instance of Sum.
-            subsum = Sum();
+        vector<string> runFilenames;
+        SumPtr loadedBlock;
+        int n;
+        while ( loader.next( loadedBlock, n ) ) {
+            if ( corrupt ) continue;
 
-            fileNo++;
+            Sum combinedBlock = combineLikeTermsByDiagramID( *loadedBlock, Amaunet::DIAGRAM_CATALOG );
+
+            stringstream ssrunname;
+            ssrunname << outputFilename << ".run" << partition << "_" << n;
+            runFilenames.push_back( ssrunname.str() );
+            if ( saveSortedRunToFile( combinedBlock, Amaunet::DIAGRAM_CATALOG, ssrunname.str() ) != 0 ) corrupt = true;
         }
 
-        subsum.addTerm( (*iter)->copy() );
+        // Merge the runs of the partition into the output, one record per run in memory.
+        long long numTermsInPartition = corrupt ? -1 : mergeSortedRunsToArchive( runFilenames, output, partition, labels[ partition ] );
+
+        for ( vector<string>::iterator run = runFilenames.begin(); run != runFilenames.end(); ++run ) {
+            remove( run->c_str() );
+        }
+
+#pragma omp critical( mergeCombinePartitionsFromArchive )
+        {
+            if ( numTermsInPartition < 0 ) failed = true;
+            else numTerms += numTermsInPartition;
+        }
     }
 
-    return fileNo;
+    if ( output.close() < 0 ) failed = true;
+    if ( failed ) {
+        cout << "***ERROR: Failed to reduce archive '" << filename << "'." << endl;
+        return -1;
+    }
+
+    return numTerms;
 }
 
-Sum loadAndEvaluateSumFromFiles( string saveDir, int numberOfFiles, int EXPANSION_ORDER_IN_A, int POOL_SIZE ) {
+RunManifest::RunManifest() : inputHash( 0 ), expansionOrderInA( 0 ), poolSize( 0 ), blockSize( 0 ), numOfBlocks( 0 ),
+                             combined( false ) { }
 
-    Sum nextPartialSum;
-    SumPtr evaluatedPartialSum;
-    Sum completeSum;
-    for ( int fileNo = 0; fileNo < numberOfFiles; fileNo++ ) {
-        stringstream ssfilename;
-        ssfilename << saveDir << "/EX" << fileNo << ".out";
-        cout << ">> Loading expression from file '" << ssfilename.str() << "'..." << endl;
-        nextPartialSum = loadSumFromFile( ssfilename.str() );
+bool RunManifest::matches( const RunManifest &other ) const {
+    return inputHash == other.inputHash && expansionOrderInA == other.expansionOrderInA && poolSize == other.poolSize
+           && blockSize == other.blockSize && numOfBlocks == other.numOfBlocks;
+}
 
-        cout << ">> Evaluating partial sum..." << endl;
-        evaluatedPartialSum = fullyEvaluateExpressionByParts( static_pointer_cast<Sum>( nextPartialSum.copy() ), EXPANSION_ORDER_IN_A, POOL_SIZE );
-        completeSum.addTerm( evaluatedPartialSum->copy() );
-        completeSum.reduceTree();
+unsigned long long computeExpressionHash( Sum &expr ) {
+    string representation = expr.to_string();
+    unsigned long long hash = 14695981039346656037ULL;
 
-        cout << ">> Combining like terms..." << endl;
-        completeSum = combineLikeTerms( completeSum, POOL_SIZE );
+    for ( string::iterator c = representation.begin(); c != representation.end(); ++c ) {
+        hash ^= (unsigned char)*c;
+        hash *= 1099511628211ULL;
     }
 
-    return completeSum;
+    return hash;
 }
 
-Sum loadAndCombineSumFromFiles( string saveDir, int numberOfFiles, int POOL_SIZE ) {
+int computeFileChecksum( string filename, unsigned int &checksum ) {
+    MappedFile file( filename );
 
-    Sum nextPartialSum;
-    Sum completeSum;
-    for ( int fileNo = 0; fileNo < numberOfFiles; fileNo++ ) {
-        stringstream ssfilename;
-        ssfilename << saveDir << "/EX" << fileNo << ".out";
-        cout << ">> Loading expression from file '" << ssfilename.str() << "'..." << endl;
-        nextPartialSum = loadSumFromFile( ssfilename.str() );
+    if ( file.isOpen() ) {
+        checksum = computeChecksum( file.begin(), file.end() - file.begin() );
+        return 0;
+    }
+
+    // Empty files cannot be mapped.
+    ifstream ifs( filename.c_str() );
+    if ( not ifs.good() ) return -1;
+
+    checksum = computeChecksum( nullptr, 0 );
+    return 0;
+}
+
+int saveRunManifest( RunManifest &manifest, string saveDir ) {
+    string filename = saveDir + "/RUN_MANIFEST.out";
+    string temporaryFilename = filename + ".tmp";
+    ofstream ofs;
 
-        completeSum.addTerm( nextPartialSum.copy() );
-        completeSum.reduceTree();
+    ofs.open( temporaryFilename.c_str() );
 
-        cout << ">> Combining like terms..." << endl;
-        completeSum = combineLikeTerms( completeSum, POOL_SIZE );
+    if ( not ofs.is_open() ) {
+        cout << "***ERROR: Failed to open file '" << temporaryFilename << "' for writing." << endl;
+        return -1;
     }
 
-    return completeSum;
+    ofs << "input " << manifest.inputHash << endl;
+    ofs << "parameters " << manifest.expansionOrderInA << " " << manifest.poolSize << " " << manifest.blockSize << " "
+        << manifest.numOfBlocks << endl;
+
+    for ( map<int, map<string, int> >::iterator block = manifest.blockPartitions.begin(); block != manifest.blockPartitions.end(); ++block ) {
+        ofs << "block " << block->first << " " << block->second.size() << endl;
+        for ( map<string, int>::iterator partition = block->second.begin(); partition != block->second.end(); ++partition ) {
+            ofs << partition->second << " " << partition->first << endl;
+        }
+    }
+
+    for ( map<string, unsigned int>::iterator file = manifest.fileChecksums.begin(); file != manifest.fileChecksums.end(); ++file ) {
+        ofs << "file " << file->first << " " << file->second << endl;
+    }
+
+    ofs << "combined " << manifest.combined << endl;
+    ofs.close();
+
+    if ( ofs.fail() || syncFile( temporaryFilename ) != 0 || rename( temporaryFilename.c_str(), filename.c_str() ) != 0 ) {
+        cout << "***ERROR: Failed to write run manifest '" << filename << "'." << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int loadRunManifest( RunManifest &manifest, string saveDir ) {
+    string filename = saveDir + "/RUN_MANIFEST.out";
+    ifstream ifs;
+
+    ifs.open( filename.c_str() );
+    if ( not ifs.is_open() ) return -1;
+
+    RunManifest loaded;
+    string field;
+    bool complete = false;
+
+    while ( ifs >> field ) {
+        if ( field == "input" ) {
+            ifs >> loaded.inputHash;
+        } else if ( field == "parameters" ) {
+            ifs >> loaded.expansionOrderInA >> loaded.poolSize >> loaded.blockSize >> loaded.numOfBlocks;
+        } else if ( field == "block" ) {
+            int block, numPartitions, orderInA;
+            string label;
+
+            ifs >> block >> numPartitions;
+            map<string, int> &partitions = loaded.blockPartitions[ block ];
+            for ( int i = 0; i < numPartitions && ifs >> orderInA >> label; i++ ) partitions[ label ] = orderInA;
+        } else if ( field == "file" ) {
+            string name;
+            unsigned int checksum;
+
+            ifs >> name >> checksum;
+            loaded.fileChecksums[ name ] = checksum;
+        } else if ( field == "combined" ) {
+            // The combined record is always written last, so its presence marks a complete manifest.
+            ifs >> loaded.combined;
+            complete = true;
+        } else {
+            break;
+        }
+
+        if ( ifs.fail() ) break;
+    }
+
+    ifs.close();
+
+    if ( not complete ) {
+        cout << "***ERROR: Run manifest '" << filename << "' is malformed." << endl;
+        return -1;
+    }
+
+    manifest = loaded;
+    return 0;
+}
+
+/*
+ * Gets the name under which the checksum of the archive block of a partition of a block is kept in the run manifest.
+ */
+static string getPartitionBlockName( int block, string label ) {
+    stringstream ssname;
+    ssname << "EX" << block << "_" << label;
+    return ssname.str();
+}
+
+string getRunArchiveFilename( string saveDir ) {
+    return saveDir + "/EX.amc";
+}
+
+int recordRunManifestBlock( RunManifest &manifest, int block, ExpressionArchiveWriter &archive ) {
+    // A block is only recorded once its partitions are on disk.
+    if ( archive.sync() != 0 ) {
+        cout << "***ERROR: Failed to sync the run archive." << endl;
+        return -1;
+    }
+
+    map<string, int> blockPartitions;
+    for ( int n = 0; n < archive.getNumberOfBlocks(); n++ ) {
+        ArchiveBlockInfo info = archive.getBlockInfo( n );
+        if ( info.group != block ) continue;
+
+        blockPartitions[ info.label ] = info.minOrderInA;
+        manifest.fileChecksums[ getPartitionBlockName( block, info.label ) ] = info.checksum;
+    }
+
+    manifest.blockPartitions[ block ] = blockPartitions;
+    return 0;
+}
+
+bool verifyRunManifestBlock( RunManifest &manifest, int block, const ExpressionArchiveReader &archive ) {
+    map<int, map<string, int> >::iterator record = manifest.blockPartitions.find( block );
+    if ( record == manifest.blockPartitions.end() ) return false;
+
+    map<string, int> intactPartitions;
+    for ( int n = 0; n < archive.getNumberOfBlocks(); n++ ) {
+        const ArchiveBlockInfo &info = archive.getBlockInfo( n );
+        map<string, unsigned int>::iterator expected = manifest.fileChecksums.find( getPartitionBlockName( block, info.label ) );
+
+        if ( info.group == block && expected != manifest.fileChecksums.end() && info.checksum == expected->second
+             && archive.verifyBlock( n ) ) {
+            intactPartitions[ info.label ] = info.minOrderInA;
+        }
+    }
+
+    if ( intactPartitions == record->second ) return true;
+
+    for ( map<string, int>::iterator partition = record->second.begin(); partition != record->second.end(); ++partition ) {
+        manifest.fileChecksums.erase( getPartitionBlockName( block, partition->first ) );
+    }
+    manifest.blockPartitions.erase( record );
+
+    return false;
+}
+
+string getCombinedArchiveFilename( string saveDir ) {
+    return saveDir + "/COMBINED.amc";
+}
+
+long long checkpointedMergeCombinePartitionsFromArchive( string saveDir, int maxOrderInA, int NUM_THREADS, bool RESUME ) {
+    string combinedFilename = getCombinedArchiveFilename( saveDir );
+    RunManifest manifest;
+    bool haveManifest = ( loadRunManifest( manifest, saveDir ) == 0 );
+
+    if ( RESUME && haveManifest && manifest.combined ) {
+        map<string, unsigned int>::iterator expected = manifest.fileChecksums.find( "COMBINED.amc" );
+        unsigned int checksum;
+
+        if ( expected != manifest.fileChecksums.end() && computeFileChecksum( combinedFilename, checksum ) == 0
+             && checksum == expected->second ) {
+            ExpressionArchiveReader combined( combinedFilename );
+            if ( combined.isOpen() ) {
+                long long numTerms = 0;
+                for ( int block = 0; block < combined.getNumberOfBlocks(); block++ ) {
+                    numTerms += combined.getBlockInfo( block ).numTerms;
+                }
+
+                cout << ">> Resuming from the combined result of a previous run." << endl;
+                return numTerms;
+            }
+        }
+    }
+
+    long long numTerms = mergeCombinePartitionsFromArchive( getRunArchiveFilename( saveDir ), combinedFilename, maxOrderInA, NUM_THREADS );
+
+    // The output archive is synced when it is closed.
+    unsigned int checksum;
+    if ( numTerms >= 0 && haveManifest && computeFileChecksum( combinedFilename, checksum ) == 0 ) {
+        manifest.fileChecksums[ "COMBINED.amc" ] = checksum;
+        manifest.combined = true;
+        saveRunManifest( manifest, saveDir );
+    }
+
+    return numTerms;
 }
 
 int splitDualExpansionByPartsToFiles( SumPtr exprA, SumPtr exprB, int blockSize, string saveDir ) {
@@ -196,182 +956,250 @@ int splitDualExpansionByPartsToFiles( SumPtr exprA, SumPtr exprB, int blockSize,
     return fileNo;
 }
 
-int multithreaded_splitDualExpansionByPartsToFiles( SumPtr exprA, SumPtr exprB, int blockSize, string saveDir, int NUM_THREADS ) {
+int multithreaded_splitDualExpansionByPartsToFiles( SumPtr exprA, SumPtr exprB, int blockSize, string saveDir, int NUM_THREADS, int TILE_SIZE ) {
     exprA->reduceTree();
     exprB->reduceTree();
 
-    Sum expandedExpression;
     SymbolicTermPtr exprBCopy = exprB->copy();
-    int fileNo = 0;
-    const int numOfBlocks = (int)ceil( (float)exprA -> getNumberOfTerms() / (float)blockSize );
-
-    omp_set_num_threads( NUM_THREADS );
+    vector<SumPtr> tilesB = splitSumIntoTiles( static_pointer_cast<Sum>( exprBCopy ), TILE_SIZE );
+    const int numOfTerms = exprA->getNumberOfTerms();
+    const int numTiles = numOfTerms * (int)tilesB.size();
+    int numTilesComplete = 0;
+    bool failed = false;
 
-    cout << ">> Note " << numOfBlocks << " files required to save expansion to disk." << endl;
-
-
-
-    for ( int block = 0; block < numOfBlocks; block++ ) {
-        cout << ">> Expanding block " << block + 1 << " of " << numOfBlocks << "..." << endl;
-
-        int numTermsComplete = 0;
-        SumPtr parallelParts[ blockSize ];
-
-#pragma omp parallel for shared( exprA, exprBCopy, parallelParts )
-        for (int term = 0; term < blockSize; term++) {
-#pragma omp critical(printcout)
-            {
-                cout << ">> Performing expression expansion for term " << term << " of "
-                     << blockSize << " (" << numTermsComplete << " terms complete) in block " << block + 1 << " of "
-                     << numOfBlocks << "..." << endl;
-                numTermsComplete++;
-            }
-
-            // Since we are working in the units of blocks, verify that the total term index (block * blockSize + term)
-            // does not exceed the number of terms in the expression.
-            if ( block * blockSize + term < exprA->getNumberOfTerms() ) {
-                Product nextExpansion;
-                nextExpansion.addTerm(exprA->getTerm(block * blockSize + term)->copy());
-                nextExpansion.addTerm(exprBCopy);
-
-                SumPtr expanded = static_pointer_cast<Sum>(nextExpansion.getExpandedExpr().copy());
-                expanded->reduceTree();
-
-                parallelParts[term] = expanded;
-                nextExpansion.clear();
-            }
-        }
+    // Each file holds roughly the expansion of blockSize terms of exprA, as when the expansion was written by blocks.
+    ExpressionFileWriter writer( saveDir, blockSize * max( 1, exprB->getNumberOfTerms() ) );
 
-        cout << ">> Evaluation of block complete. Dumping expanded expression to file..." << endl;
+    omp_set_num_threads( NUM_THREADS );
 
-        // Reduce parallel results.
-        Sum reducedExpression;
-        for ( int term = 0; term < blockSize; term++ ) {
-            // Again, verify that we are not going past the end of the total expression.
-            if ( block * blockSize + term < exprA->getNumberOfTerms() ) {
-                reducedExpression.addTerm( parallelParts[ term ] );
-            }
+#pragma omp parallel for schedule( dynamic ) shared( exprA, tilesB, writer, failed )
+    for ( int part = 0; part < numTiles; part++ ) {
+        int term = part / (int)tilesB.size();
+        {
+            lock_guard<std::mutex> guard( Amaunet::CONSOLE_MUTEX );
+            cout << ">> Performing expression expansion for term " << term << " of " << numOfTerms << ", tile "
+                 << part % tilesB.size() + 1 << " of " << tilesB.size() << " (" << numTilesComplete << " of "
+                 << numTiles << " tiles complete)..." << endl;
+            numTilesComplete++;
         }
 
-        // Concatenate filename for the next expression to serialize and output to file.
-        stringstream ssfilename;
-        ssfilename << saveDir << "/EX" << fileNo << ".out";
-
-        // Save the file.
-        int result = saveSumToFile(reducedExpression, ssfilename.str());
-
-        // Check for an error from the above call.
-        if (result != 0) {
-            cout << "***ERROR: Failed to save a partial sum." << endl;
-            exit(-1);  // Critical failure -- must terminate calculation.
-        }
+        Product nextExpansion;
+        nextExpansion.addTerm( exprA->getTerm( term )->copy() );
+        nextExpansion.addTerm( tilesB[ part % tilesB.size() ] );
 
-        // Set subsum to a new instance of Sum.
-        expandedExpression = Sum();
+        SumPtr expanded = static_pointer_cast<Sum>( nextExpansion.getExpandedExpr().copy() );
+        expanded->reduceTree();
 
-        fileNo++;
+        // Hand the expansion to the writer immediately rather than holding the whole block in memory.
+        if ( writer.addTerms( *expanded ) != 0 ) failed = true;
+        nextExpansion.clear();
     }
 
-    // Check for case where the fileNo is still zero, indicating that the expression was too small to be split across
-    // multiple files. If so, save the entire expression to one file now.
-    if ( fileNo == 0 ) {
-        stringstream ssfilename;
-        ssfilename << saveDir << "/EX0.out";
-        cout << "***NOTE: Length of expression (" << expandedExpression.getNumberOfTerms() << " terms) less than block size. Saving expression to single file." << endl;
-        saveSumToFile( expandedExpression, ssfilename.str() );
-        return 1;
+    int fileNo = writer.close();
+    if ( failed || fileNo < 0 ) {
+        cout << "***ERROR: Failed to save a partial sum." << endl;
+        exit( -1 );  // Critical failure -- must terminate calculation.
     }
 
     cout << ">> Dual expansion complete. " << fileNo << " files saved." << endl;
     return fileNo;
 }
 
-int multithreaded_splitExpandAndEvaluateByPartsToFiles( SumPtr exprA, SumPtr exprB, int EXPANSION_ORDER_IN_A, int POOL_SIZE, int blockSize, string saveDir, int NUM_THREADS ) {
+int multithreaded_splitExpandAndEvaluateByPartsToFiles( SumPtr exprA, SumPtr exprB, int EXPANSION_ORDER_IN_A, int POOL_SIZE, int blockSize, string saveDir, int NUM_THREADS, bool RESUME, int TILE_SIZE, bool COMPRESS ) {
     exprA->reduceTree();
     exprB->reduceTree();
 
-    Sum expandedExpression;
     SymbolicTermPtr exprBCopy = exprB->copy();
-    int fileNo = 0;
     const int numOfBlocks = (int)ceil( (float)exprA -> getNumberOfTerms() / (float)blockSize );
 
     omp_set_num_threads( NUM_THREADS );
 
-    cout << ">> Note " << numOfBlocks << " files required to save expansion to disk." << endl;
+    cout << ">> Note " << numOfBlocks << " blocks required to save expansion to disk." << endl;
+
+    RunManifest manifest;
+    manifest.inputHash = computeExpressionHash( *exprA ) ^ ( computeExpressionHash( *exprB ) * 1099511628211ULL );
+    manifest.expansionOrderInA = EXPANSION_ORDER_IN_A;
+    manifest.poolSize = POOL_SIZE;
+    manifest.blockSize = blockSize;
+    manifest.numOfBlocks = numOfBlocks;
+
+    RunManifest previous;
+    bool resuming = RESUME && loadRunManifest( previous, saveDir ) == 0 && previous.matches( manifest );
+    if ( resuming ) {
+        manifest = previous;
+        manifest.combined = false;
+        cout << ">> Resuming run: " << manifest.blockPartitions.size() << " blocks previously completed." << endl;
+    } else if ( RESUME ) {
+        cout << "***NOTE: No run manifest matching the input and parameters was found. Starting a new run." << endl;
+    }
+
+    // Verify previously completed blocks before any block is written, since the manifest and the partitions are only
+    // updated by the background writer from here on. The archive is a log, so it is kept only up to its first block
+    // which does not belong to a verified block of the run, and a verified block with a partition after that point is
+    // recomputed.
+    string archiveFilename = getRunArchiveFilename( saveDir );
+    vector<bool> blockVerified( numOfBlocks, false );
+    int numArchiveBlocksKept = 0;
+    bool keepArchive = false;
+
+    if ( resuming && ifstream( archiveFilename.c_str() ).good() ) {
+        ExpressionArchiveReader existing( archiveFilename );
+        keepArchive = existing.isOpen();
+
+        for ( int block = 0; keepArchive && block < numOfBlocks; block++ ) {
+            blockVerified[ block ] = verifyRunManifestBlock( manifest, block, existing );
+        }
 
+        for ( int n = 0; keepArchive && n < existing.getNumberOfBlocks(); n++ ) {
+            int group = existing.getBlockInfo( n ).group;
+            bool verified = ( group >= 0 && group < numOfBlocks && blockVerified[ group ] );
 
+            if ( verified && numArchiveBlocksKept == n ) {
+                numArchiveBlocksKept++;
+            } else if ( verified ) {
+                blockVerified[ group ] = false;
+                manifest.blockPartitions.erase( group );
+            }
+        }
+    }
+
+    if ( not keepArchive ) remove( archiveFilename.c_str() );
+    ExpressionArchiveWriter archive( archiveFilename, COMPRESS );
+    if ( not archive.isOpen() || archive.truncate( numArchiveBlocksKept ) != 0 ) {
+        cout << "***ERROR: Failed to open archive '" << archiveFilename << "' for writing." << endl;
+        exit( -1 );  // Critical failure -- must terminate calculation.
+    }
+
+    // Split the second expression into tiles of terms which share the terms of exprBCopy.
+    const int numTermsA = exprA->getNumberOfTerms();
+    vector<SumPtr> tilesB = splitSumIntoTiles( static_pointer_cast<Sum>( exprBCopy ), TILE_SIZE );
+    const int tilesPerTerm = (int)tilesB.size();
+    vector<ExpansionProfile> tileProfiles;
+    for ( vector<SumPtr>::iterator tile = tilesB.begin(); tile != tilesB.end(); ++tile ) {
+        tileProfiles.push_back( getExpansionProfile( *tile ) );
+    }
+
+    // Every term of exprA times every tile of exprB is an independent task of the pool, and a block is handed to the
+    // background writer as soon as its last task completes, so there is no barrier between blocks.
+    AsyncBlockWriter writer( ASYNC_WRITER_MAX_PENDING_TERMS );
+    WorkStealingPool pool( NUM_THREADS );
+    vector< vector<SumPtr> > blockParts( numOfBlocks );
+    unique_ptr< atomic<int>[] > tasksRemaining( new atomic<int>[ numOfBlocks ] );
+    int numTasks = 0;
+    int numTasksComplete = 0;
 
     for ( int block = 0; block < numOfBlocks; block++ ) {
-        cout << ">> Expanding block " << block + 1 << " of " << numOfBlocks << "..." << endl;
-
-        int numTermsComplete = 0;
-        SumPtr parallelParts[ blockSize ];
-
-#pragma omp parallel for shared( exprA, exprBCopy, parallelParts )
-        for (int term = 0; term < blockSize; term++) {
-#pragma omp critical(printcout)
-            {
-                cout << ">> Performing expression expansion for term " << term << " of "
-                     << blockSize << " (" << numTermsComplete << " terms complete) in block " << block + 1 << " of "
-                     << numOfBlocks << "..." << endl;
-                numTermsComplete++;
-            }
+        int numTermsInBlock = min( blockSize, numTermsA - block * blockSize );
 
-            // Since we are working in the units of blocks, verify that the total term index (block * blockSize + term)
-            // does not exceed the number of terms in the expression.
-            if ( block * blockSize + term < exprA->getNumberOfTerms() ) {
-                Product nextExpansion;
-                nextExpansion.addTerm(exprA->getTerm(block * blockSize + term)->copy());
-                nextExpansion.addTerm(exprBCopy);
+        blockParts[ block ].resize( blockVerified[ block ] ? 0 : numTermsInBlock * tilesPerTerm );
+        tasksRemaining[ block ] = (int)blockParts[ block ].size();
+        numTasks += (int)blockParts[ block ].size();
+    }
 
-                SumPtr expanded = static_pointer_cast<Sum>(nextExpansion.getExpandedExpr().copy());
-                expanded->reduceTree();
+    function<void( int )> submitBlock = [ & ]( int block ) {
+        // Reduce parallel results.
+        SumPtr reducedExpression( new Sum() );
+        unsigned long long numTerms = 0;
+        for ( vector<SumPtr>::iterator part = blockParts[ block ].begin(); part != blockParts[ block ].end(); ++part ) {
+            reducedExpression->addTerm( *part );
+            numTerms += (*part)->getNumberOfTerms();
+        }
+        blockParts[ block ].clear();
 
-                parallelParts[term] = fullyEvaluateExpressionByParts( expanded, EXPANSION_ORDER_IN_A, POOL_SIZE );
-                nextExpansion.clear();
-            }
+        {
+            lock_guard<std::mutex> guard( Amaunet::CONSOLE_MUTEX );
+            cout << ">> Evaluation of block " << block + 1 << " of " << numOfBlocks << " complete. Dumping expanded expression to file..." << endl;
         }
 
-        cout << ">> Evaluation of block complete. Dumping expanded expression to file..." << endl;
+        writer.submit( [ reducedExpression, block, saveDir, &archive, &manifest ]() {
+            // Flatten the evaluated parts into a single Sum of terms, then route each term to the archive block of its
+            // partition.
+            reducedExpression->reduceTree();
+            int result = savePartitionedSumToArchive( *reducedExpression, archive, block );
 
-        // Reduce parallel results.
-        Sum reducedExpression;
-        for ( int term = 0; term < blockSize; term++ ) {
-            // Again, verify that we are not going past the end of the total expression.
-            if ( block * blockSize + term < exprA->getNumberOfTerms() ) {
-                reducedExpression.addTerm( parallelParts[ term ] );
+            // Check for an error from the above call.
+            if (result != 0) {
+                cout << "***ERROR: Failed to save a partial sum." << endl;
+                exit(-1);  // Critical failure -- must terminate calculation.
+            }
+
+            // Checkpoint the block.
+            if ( recordRunManifestBlock( manifest, block, archive ) != 0 || saveRunManifest( manifest, saveDir ) != 0 ) {
+                cout << "***ERROR: Failed to update the run manifest." << endl;
+                exit( -1 );  // Critical failure -- must terminate calculation.
+            }
+
+            return 0;
+        }, numTerms );
+    };
+
+    for ( int block = 0; block < numOfBlocks; block++ ) {
+        if ( blockVerified[ block ] ) {
+            cout << ">> Block " << block + 1 << " of " << numOfBlocks << " verified. Skipping..." << endl;
+            continue;
+        }
+
+        // Submit the parts of the block in order of decreasing estimated cost, so that the most expensive are started
+        // first and the least expensive are left to balance the threads.
+        vector< pair<double, int> > partsByCost;
+        for ( int termInBlock = 0; termInBlock * tilesPerTerm < (int)blockParts[ block ].size(); termInBlock++ ) {
+            ExpansionProfile termProfile = getExpansionProfile( exprA->getTerm( block * blockSize + termInBlock ) );
+            for ( int tile = 0; tile < tilesPerTerm; tile++ ) {
+                partsByCost.push_back( make_pair( -estimateExpansionCost( termProfile, tileProfiles[ tile ], EXPANSION_ORDER_IN_A ),
+                                                  termInBlock * tilesPerTerm + tile ) );
             }
         }
+        sort( partsByCost.begin(), partsByCost.end() );
 
-        // Concatenate filename for the next expression to serialize and output to file.
-        stringstream ssfilename;
-        ssfilename << saveDir << "/EX" << fileNo << ".out";
+        for ( vector< pair<double, int> >::iterator partByCost = partsByCost.begin(); partByCost != partsByCost.end(); ++partByCost ) {
+            int part = partByCost->second;
+            pool.submit( [ &, block, part ]() {
+                int term = block * blockSize + part / tilesPerTerm;
 
-        // Save the file.
-        int result = saveSumToFile(reducedExpression, ssfilename.str());
+                Product nextExpansion;
+                nextExpansion.addTerm( exprA->getTerm( term )->copy() );
+                nextExpansion.addTerm( tilesB[ part % tilesPerTerm ] );
 
-        // Check for an error from the above call.
-        if (result != 0) {
-            cout << "***ERROR: Failed to save a partial sum." << endl;
-            exit(-1);  // Critical failure -- must terminate calculation.
+                SumPtr expanded = static_pointer_cast<Sum>( nextExpansion.getExpandedExpr().copy() );
+                expanded->reduceTree();
+
+                blockParts[ block ][ part ] = fullyEvaluateExpressionByParts( expanded, EXPANSION_ORDER_IN_A, POOL_SIZE );
+                nextExpansion.clear();
+
+                {
+                    lock_guard<std::mutex> guard( Amaunet::CONSOLE_MUTEX );
+                    numTasksComplete++;
+                    cout << ">> Expanded term " << term << " (tile " << part % tilesPerTerm + 1 << " of " << tilesPerTerm
+                         << ") in block " << block + 1 << " of " << numOfBlocks << " (" << numTasksComplete << " of "
+                         << numTasks << " tasks complete)." << endl;
+                }
+
+                if ( --tasksRemaining[ block ] == 0 ) submitBlock( block );
+            } );
         }
+    }
 
-        // Set subsum to a new instance of Sum.
-        expandedExpression = Sum();
+    pool.wait();
 
-        fileNo++;
+    if ( writer.close() != 0 ) {
+        cout << "***ERROR: Failed to save a partial sum." << endl;
+        exit( -1 );  // Critical failure -- must terminate calculation.
     }
 
-    // Check for case where the fileNo is still zero, indicating that the expression was too small to be split across
-    // multiple files. If so, save the entire expression to one file now.
-    if ( fileNo == 0 ) {
-        stringstream ssfilename;
-        ssfilename << saveDir << "/EX0.out";
-        cout << "***NOTE: Length of expression (" << expandedExpression.getNumberOfTerms() << " terms) less than block size. Saving expression to single file." << endl;
-        saveSumToFile( expandedExpression, ssfilename.str() );
-        return 1;
+    BlockStatistics statistics = archive.getStatistics();
+    int numArchiveBlocks = archive.close();
+    if ( numArchiveBlocks < 0 ) {
+        cout << "***ERROR: Failed to close archive '" << archiveFilename << "'." << endl;
+        exit( -1 );  // Critical failure -- must terminate calculation.
     }
 
-    cout << ">> Dual expansion complete. " << fileNo << " files saved." << endl;
-    return fileNo;
+    if ( COMPRESS && statistics.storedLength > 0 ) {
+        cout << ">> Archive '" << archiveFilename << "': " << statistics.numTerms << " terms, " << statistics.payloadLength
+             << " -> " << statistics.storedLength << " bytes (ratio " << (double)statistics.payloadLength / statistics.storedLength
+             << ")." << endl;
+    }
+
+    cout << ">> Dual expansion complete. " << numOfBlocks << " blocks saved to archive '" << archiveFilename << "' ("
+         << numArchiveBlocks << " archive blocks)." << endl;
+    return numArchiveBlocks;
 }
\ No newline at end of file
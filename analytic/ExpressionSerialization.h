@@ -7,28 +7,448 @@
 
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/string.hpp>
 #include <boost/serialization/shared_ptr.hpp>
+#include "omp.h"
 #include "PTSymbolicObjects.h"
+#include "FeynmanDiagram.h"
+#include "ExpressionArchive.h"
 
-int saveSumToFile( Sum &expr, std::string filename );
+/**
+ * Saves a Sum in the Boost text format.
+ * @param compress If true, the file is written compressed with gzip, and its compression ratio and throughput are
+ * reported.
+ * @return 0 on success, -1 otherwise.
+ */
+int saveSumToFile( Sum &expr, std::string filename, bool compress = false );
 
+/**
+ * Loads a Sum from a file written by saveSumToFile(). Files compressed with gzip are decompressed transparently.
+ */
 Sum loadSumFromFile( std::string filename );
 
+int saveDiagramCatalogToFile( DiagramCatalog &catalog, std::string filename );
+
+/**
+ * Loads a diagram catalog written by saveDiagramCatalogToFile(). If the file is truncated or was written in an
+ * incompatible format, a warning is printed and the catalog is left empty.
+ * @return 0 on success, -1 if the file cannot be opened or read.
+ */
+int loadDiagramCatalogFromFile( DiagramCatalog &catalog, std::string filename );
+
 int splitSumToFiles( Sum &expr, int blockSize, std::string saveDir );
 
-Sum loadAndEvaluateSumFromFiles( std::string saveDir, int numberOfFiles, int EXPANSION_ORDER_IN_A, int POOL_SIZE );
+/**
+ * Streaming writer of an expression to the sequence of files EX0.out, EX1.out, ... in a directory, each in the format
+ * of saveSumToFile(). Terms are accepted one at a time or in batches, from any number of threads, and are buffered
+ * until at least termsPerFile terms are held, at which point the buffer is written to the next file. A file is synced
+ * to disk before the write is considered complete, and close() writes any remaining partial file in the same way.
+ * Files may optionally be compressed, which loadSumFromFile() handles transparently.
+ */
+class ExpressionFileWriter {
+
+public:
+
+    /**
+     * Constructor.
+     * @param saveDir The directory to which files are written.
+     * @param termsPerFile The number of buffered terms at which the buffer is written to a new file.
+     * @param compress If true, each file is compressed with gzip.
+     */
+    ExpressionFileWriter( std::string saveDir, int termsPerFile, bool compress = false );
+
+    /**
+     * Destructor. Closes the writer if close() has not already been called.
+     */
+    ~ExpressionFileWriter();
+
+    /**
+     * Adds a term to the stream. Thread-safe.
+     * @return 0 on success, -1 if a file could not be written.
+     */
+    int addTerm( SymbolicTermPtr term );
+
+    /**
+     * Adds all terms of a Sum to the stream as one batch. The terms are not copied. Thread-safe.
+     * @return 0 on success, -1 if a file could not be written.
+     */
+    int addTerms( Sum &terms );
+
+    /**
+     * Writes any buffered terms to a final file. Must only be called once all threads have finished adding terms.
+     * @return The number of files written, or -1 if any file could not be written.
+     */
+    int close();
+
+private:
+
+    ExpressionFileWriter( const ExpressionFileWriter &other );
+
+    ExpressionFileWriter& operator=( const ExpressionFileWriter &rhs );
+
+    /**
+     * Writes a set of terms to the file with the given number and syncs it to disk.
+     */
+    int writeFile( std::vector<SymbolicTermPtr> &terms, int fileNo );
+
+    std::string saveDir;
+
+    int termsPerFile;
+
+    bool compress;
+
+    std::vector<SymbolicTermPtr> buffer;
+
+    int numberOfFiles;
+
+    bool failed;
+
+    bool closed;
+
+    omp_lock_t lock;
+
+};
+
+/**
+ * Loads a numbered sequence of partial sums (e.g. the files EX0.out ... EXn.out, or the blocks of an archive) on a pool
+ * of reader threads, ahead of a consumer which reduces them. Sums are delivered in order of their numbers, and at most
+ * capacity sums are loaded ahead of the one most recently delivered, which bounds the memory held by the loader.
+ */
+class PrefetchingLoader {
+
+public:
+
+    /**
+     * Constructor. Reader threads are started immediately.
+     * @param numberOfItems The number of partial sums to load.
+     * @param load Function which loads the partial sum of a given number. Called concurrently from the reader threads.
+     * @param numReaders The number of reader threads.
+     * @param capacity The maximum number of partial sums loaded but not yet delivered.
+     */
+    PrefetchingLoader( int numberOfItems, std::function<Sum( int )> load, int numReaders, int capacity );
+
+    /**
+     * Destructor. Stops loading and joins the reader threads.
+     */
+    ~PrefetchingLoader();
+
+    /**
+     * Waits for and delivers the next partial sum.
+     * @param partialSum Set to the next partial sum.
+     * @param item Set to the number of the partial sum.
+     * @return True if a partial sum was delivered, false once all have been delivered.
+     */
+    bool next( SumPtr &partialSum, int &item );
+
+private:
+
+    PrefetchingLoader( const PrefetchingLoader &other );
+
+    PrefetchingLoader& operator=( const PrefetchingLoader &rhs );
+
+    void readerLoop();
+
+    int numberOfItems;
+
+    std::function<Sum( int )> load;
+
+    int capacity;
+
+    int nextToLoad;
+
+    int nextToDeliver;
+
+    bool stopping;
+
+    std::map<int, SumPtr> ready;
+
+    std::mutex mutex;
+
+    std::condition_variable itemLoaded;
+
+    std::condition_variable itemDelivered;
+
+    std::vector<std::thread> readers;
+
+};
+
+/**
+ * Background writer which runs write jobs, in order of submission, on a single dedicated thread, so that a producer may
+ * continue to compute while earlier results are serialized. The memory held by pending jobs is bounded: each job is
+ * submitted with the number of terms it holds, and submit() blocks while accepting it would exceed the budget. A job
+ * is always accepted when no other job is pending, however large.
+ */
+class AsyncBlockWriter {
+
+public:
+
+    /**
+     * Constructor. The writer thread is started immediately.
+     * @param maxPendingTerms The budget of terms held by submitted jobs which have not yet completed.
+     */
+    AsyncBlockWriter( unsigned long long maxPendingTerms );
+
+    /**
+     * Destructor. Closes the writer if close() has not already been called.
+     */
+    ~AsyncBlockWriter();
+
+    /**
+     * Submits a write job, waiting first for pending jobs to complete if the budget would be exceeded.
+     * @param write The job, which returns 0 on success.
+     * @param numTerms The number of terms held by the job until it completes.
+     */
+    void submit( std::function<int()> write, unsigned long long numTerms );
+
+    /**
+     * Waits for all submitted jobs to complete and stops the writer thread.
+     * @return 0 if every job succeeded, -1 otherwise.
+     */
+    int close();
+
+private:
+
+    AsyncBlockWriter( const AsyncBlockWriter &other );
+
+    AsyncBlockWriter& operator=( const AsyncBlockWriter &rhs );
+
+    void writerLoop();
+
+    unsigned long long maxPendingTerms;
+
+    unsigned long long pendingTerms;
+
+    std::deque< std::pair<std::function<int()>, unsigned long long> > pending;
+
+    bool closing;
+
+    bool closed;
+
+    bool failed;
+
+    std::mutex mutex;
+
+    std::condition_variable jobSubmitted;
+
+    std::condition_variable jobCompleted;
+
+    std::thread writer;
+
+};
+
+/**
+ * Writes a Sum whose like terms have been combined (see combineLikeTermsByDiagramID()) to file as a sorted run: one
+ * record per term, each consisting of its combination key on one line, followed by the length of and a serialized
+ * archive of its coefficient and its remaining factors. Records are sorted by key before they are written.
+ * @param expr The combined expression.
+ * @param catalog The catalog with which the diagrams of the expression were registered.
+ * @param filename The file to write.
+ * @return 0 on success, -1 otherwise.
+ */
+int saveSortedRunToFile( Sum &expr, DiagramCatalog &catalog, std::string filename );
+
+/**
+ * Sequential reader of the records of a sorted run written by saveSortedRunToFile(). Only the current record is held
+ * in memory.
+ */
+class SortedRunReader {
+
+public:
+
+    SortedRunReader( std::string filename );
+
+    /**
+     * Reads the next record of the run.
+     * @return True if a record was read, false if the end of the run has been reached.
+     */
+    bool next();
+
+    const std::string &getKey() const;
+
+    CoefficientFraction getCoefficient() const;
+
+    /**
+     * Gets the factors of the current record other than its coefficient.
+     */
+    Product getFactors() const;
+
+private:
+
+    std::ifstream ifs;
+
+    std::string key;
+
+    CoefficientFraction coefficient;
+
+    Product factors;
+
+};
+
+/**
+ * Gets the label of the output partition of a term of an evaluated expression, which is formed from its order in A
+ * and the number of MatrixK factors of each flavor, e.g. "A4_Kdn-2_Kup-2". Terms in different partitions never
+ * combine.
+ * @param term The term, which should be a Product.
+ * @param orderInA Set to the order in A of the term.
+ * @return The partition label, which is safe for use in a filename.
+ */
+std::string getPartitionLabel( SymbolicTermPtr term, int &orderInA );
+
+/**
+ * Routes the terms of a block of an evaluated expression by partition (see getPartitionLabel()), and appends the terms
+ * of each partition to an archive as one archive block, recorded in its index with the number of the block as its
+ * group and the partition label as its label.
+ * @param expr The block to write.
+ * @param archive The archive to which the partitions are appended.
+ * @param blockNo The number of the block.
+ * @return 0 on success, -1 otherwise.
+ */
+int savePartitionedSumToArchive( Sum &expr, ExpressionArchiveWriter &archive, int blockNo );
+
+/**
+ * Reduces the archive of partitions written by savePartitionedSumToArchive() to an archive of the combined expression.
+ * Partitions are found from the labels in the index of the archive and reduced independently and in parallel, one
+ * partition per thread. Within a partition, each archive block is combined with combineLikeTermsByDiagramID() and
+ * written as a sorted run (see saveSortedRunToFile()), and the runs are merged into the output archive, so that at
+ * most one loaded block and one record per run are held in memory per thread. The combined terms of a partition are
+ * written in blocks recorded under the partition label, with the position of the label in sorted order as their group;
+ * blocks of different partitions appear in the order in which the partitions complete. Partitions of an order in A
+ * higher than maxOrderInA are not read.
+ * @param filename The archive.
+ * @param outputFilename The archive of the combined expression, which is overwritten.
+ * @param maxOrderInA The highest order in A to reduce.
+ * @param NUM_THREADS The number of partitions to reduce concurrently.
+ * @return The number of combined terms written, or -1 if the archive is corrupt or the output cannot be written.
+ */
+long long mergeCombinePartitionsFromArchive( std::string filename, std::string outputFilename, int maxOrderInA, int NUM_THREADS );
+
+/**
+ * Record of the progress of a run of multithreaded_splitExpandAndEvaluateByPartsToFiles() and of the reduction of its
+ * output, kept in RUN_MANIFEST.out so that an interrupted run may be resumed.
+ */
+struct RunManifest {
+
+    RunManifest();
+
+    /**
+     * Hash of the string representations of the two input expressions.
+     */
+    unsigned long long inputHash;
+
+    int expansionOrderInA;
+
+    int poolSize;
+
+    int blockSize;
+
+    int numOfBlocks;
+
+    /**
+     * For each completed block, the label of each partition file written to its order in A.
+     */
+    std::map<int, std::map<std::string, int> > blockPartitions;
+
+    /**
+     * Checksum of each archive block of the run, keyed by EX<block>_<label>, and of each other output file, keyed by
+     * filename relative to the run directory.
+     */
+    std::map<std::string, unsigned int> fileChecksums;
+
+    /**
+     * Whether the combined result has been written to COMBINED.amc.
+     */
+    bool combined;
+
+    /**
+     * Determines if this manifest describes a run with the same input and parameters as another.
+     */
+    bool matches( const RunManifest &other ) const;
+
+};
+
+/**
+ * Computes the 64-bit FNV-1a hash of the string representation of an expression.
+ */
+unsigned long long computeExpressionHash( Sum &expr );
+
+/**
+ * Computes the Adler-32 checksum of the contents of a file.
+ * @return 0 on success, -1 if the file cannot be read.
+ */
+int computeFileChecksum( std::string filename, unsigned int &checksum );
+
+/**
+ * Writes RUN_MANIFEST.out atomically: the manifest is written and synced to a temporary file, which is then renamed
+ * over the previous manifest.
+ * @return 0 on success, -1 otherwise.
+ */
+int saveRunManifest( RunManifest &manifest, std::string saveDir );
+
+/**
+ * Loads RUN_MANIFEST.out.
+ * @return 0 on success, -1 if the manifest does not exist or is malformed.
+ */
+int loadRunManifest( RunManifest &manifest, std::string saveDir );
+
+/**
+ * Gets the name of the archive, EX.amc, in which a run in a directory keeps its partitions.
+ */
+std::string getRunArchiveFilename( std::string saveDir );
+
+/**
+ * Records a completed block in a manifest, along with the label and checksum of each of its partitions in the
+ * archive. The archive is synced first.
+ * @return 0 on success, -1 if the archive cannot be synced.
+ */
+int recordRunManifestBlock( RunManifest &manifest, int block, ExpressionArchiveWriter &archive );
+
+/**
+ * Determines if a block is recorded as complete in a manifest and if the archive block of each of its partitions is
+ * intact. The record of a block which fails verification is removed from the manifest.
+ * @return True if the block may be skipped, false if it must be recomputed.
+ */
+bool verifyRunManifestBlock( RunManifest &manifest, int block, const ExpressionArchiveReader &archive );
+
+/**
+ * Gets the name of the archive, COMBINED.amc, in which a run in a directory keeps its combined result.
+ */
+std::string getCombinedArchiveFilename( std::string saveDir );
 
-Sum loadAndCombineSumFromFiles( std::string saveDir, int numberOfFiles, int POOL_SIZE );
+/**
+ * Reduces the output of multithreaded_splitExpandAndEvaluateByPartsToFiles() with mergeCombinePartitionsFromArchive()
+ * to COMBINED.amc, and records its checksum in the run manifest. When resuming, a combined result recorded in the
+ * manifest whose checksum verifies is kept instead of being recomputed.
+ * @return The number of terms of the combined result, or -1 on failure.
+ */
+long long checkpointedMergeCombinePartitionsFromArchive( std::string saveDir, int maxOrderInA, int NUM_THREADS, bool RESUME );
 
 int splitDualExpansionByPartsToFiles( SumPtr exprA, SumPtr exprB, int blockSize, std::string saveDir );
 
-int multithreaded_splitDualExpansionByPartsToFiles( SumPtr exprA, SumPtr exprB, int blockSize, std::string saveDir, int NUM_THREADS );
+/**
+ * Expands the product of two expressions in parallel over tiles of one term of exprA and TILE_SIZE terms of exprB (see
+ * splitSumIntoTiles()), and writes the expansion to files of roughly blockSize terms of exprA each.
+ * @return The number of files written.
+ */
+int multithreaded_splitDualExpansionByPartsToFiles( SumPtr exprA, SumPtr exprB, int blockSize, std::string saveDir, int NUM_THREADS, int TILE_SIZE );
 
-int multithreaded_splitExpandAndEvaluateByPartsToFiles( SumPtr exprA, SumPtr exprB, int EXPANSION_ORDER_IN_A, int POOL_SIZE, int blockSize, std::string saveDir, int NUM_THREADS );
+/**
+ * Expands and evaluates the product of two expressions in blocks of terms of exprA, and appends each evaluated block to
+ * the archive EX.amc, one archive block per partition (see savePartitionedSumToArchive()). Each term of a block is
+ * evaluated against each tile of TILE_SIZE terms of exprB as a separate task. The run manifest is rewritten after each
+ * block. When RESUME is set and the run manifest matches the input and parameters, blocks whose partitions verify are
+ * skipped. When COMPRESS is set, the blocks of the archive are compressed.
+ * @return The number of archive blocks in EX.amc, one per partition of each block.
+ */
+int multithreaded_splitExpandAndEvaluateByPartsToFiles( SumPtr exprA, SumPtr exprB, int EXPANSION_ORDER_IN_A, int POOL_SIZE, int blockSize, std::string saveDir, int NUM_THREADS, bool RESUME, int TILE_SIZE, bool COMPRESS );
 
 
 #endif //AMAUNETC_EXPRESSIONSERIALIZATION_H
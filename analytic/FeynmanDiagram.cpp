@@ -7,6 +7,7 @@
 #include <set>
 #include <algorithm>
 #include <iostream>
+#include <random>
 #include "PathIntegration.h"
 #include "FeynmanDiagram.h"
 
@@ -218,4 +219,289 @@ bool compareContractionSetsViaDiagrams( DeltaContractionSet setA, DeltaContracti
     FeynmanDiagram diagramB = constructDiagram( setB );
 
     return diagramA.isSimilarTo( diagramB );
-}
\ No newline at end of file
+}
+vector<IndexContraction> getCanonicalDiagramForm( vector<IndexContraction> contractions ) {
+    // Separate infinity loops from the remaining contractions, which are treated as undirected edges.
+    int infinityLoopCount = 0;
+    vector<IndexContraction> edges;
+    map<int, vector<int> > adjacentVertices;
+    for ( vector<IndexContraction>::iterator iter = contractions.begin(); iter != contractions.end(); ++iter ) {
+        if ( iter->i == iter->j ) {
+            infinityLoopCount++;
+        } else {
+            edges.push_back( IndexContraction( min( iter->i, iter->j ), max( iter->i, iter->j ) ) );
+            adjacentVertices[ iter->i ].push_back( iter->j );
+            adjacentVertices[ iter->j ].push_back( iter->i );
+        }
+    }
+
+    // Order vertices by an invariant under relabeling: their degree, and then the sorted degrees of their neighbors.
+    vector< pair< vector<int>, int > > invariants;
+    for ( map<int, vector<int> >::iterator vertex = adjacentVertices.begin(); vertex != adjacentVertices.end(); ++vertex ) {
+        vector<int> invariant( 1, (int)vertex->second.size() );
+        vector<int> neighborDegrees;
+        for ( vector<int>::iterator neighbor = vertex->second.begin(); neighbor != vertex->second.end(); ++neighbor ) {
+            neighborDegrees.push_back( (int)adjacentVertices[ *neighbor ].size() );
+        }
+
+        sort( neighborDegrees.begin(), neighborDegrees.end() );
+        invariant.insert( invariant.end(), neighborDegrees.begin(), neighborDegrees.end() );
+        invariants.push_back( pair< vector<int>, int >( invariant, vertex->first ) );
+    }
+
+    sort( invariants.begin(), invariants.end() );
+
+    vector<int> vertexOrder;
+    vector<int> classBoundaries( 1, 0 );
+    for ( int i = 0; i < invariants.size(); i++ ) {
+        vertexOrder.push_back( invariants[ i ].second );
+        if ( i > 0 and invariants[ i ].first != invariants[ i - 1 ].first ) classBoundaries.push_back( i );
+    }
+    classBoundaries.push_back( (int)invariants.size() );
+
+    // Search every ordering of vertices within each class for the lexicographically smallest relabeled edge list.
+    // std::next_permutation() returns false and restores the sorted order once a class has been exhausted, so the
+    // classes are advanced like the digits of an odometer.
+    vector<IndexContraction> canonicalEdges;
+    bool isFirstOrdering = true;
+    bool isExhausted = false;
+    while ( not isExhausted ) {
+        map<int, int> vertexLabels;
+        for ( int i = 0; i < vertexOrder.size(); i++ ) {
+            vertexLabels[ vertexOrder[ i ] ] = i;
+        }
+
+        vector<IndexContraction> relabeledEdges;
+        for ( vector<IndexContraction>::iterator edge = edges.begin(); edge != edges.end(); ++edge ) {
+            int a = vertexLabels[ edge->i ];
+            int b = vertexLabels[ edge->j ];
+            relabeledEdges.push_back( IndexContraction( min( a, b ), max( a, b ) ) );
+        }
+
+        sort( relabeledEdges.begin(), relabeledEdges.end() );
+        if ( isFirstOrdering or relabeledEdges < canonicalEdges ) {
+            canonicalEdges = relabeledEdges;
+            isFirstOrdering = false;
+        }
+
+        isExhausted = true;
+        for ( int c = 0; c < classBoundaries.size() - 1; c++ ) {
+            if ( next_permutation( vertexOrder.begin() + classBoundaries[ c ], vertexOrder.begin() + classBoundaries[ c + 1 ] ) ) {
+                isExhausted = false;
+                break;
+            }
+        }
+    }
+
+    vector<IndexContraction> canonicalForm( infinityLoopCount, IndexContraction( 0, 0 ) );
+    canonicalForm.insert( canonicalForm.end(), canonicalEdges.begin(), canonicalEdges.end() );
+    return canonicalForm;
+}
+
+const unsigned long long FINGERPRINT_PRIME = 2147483647ULL;  // 2^31 - 1; products of two residues fit in 64 bits.
+
+const int FINGERPRINT_LATTICE_SIZE = 3;
+
+const unsigned int FINGERPRINT_SEEDS[] = { 1, 2 };
+
+unsigned long long evaluateDiagramModPrime( vector<IndexContraction> contractions, unsigned int seed ) {
+    mt19937 generator( seed );
+
+    // Random symmetric propagator values between every pair of lattice sites, and a random value for infinity loops.
+    vector< vector<unsigned long long> > propagator( FINGERPRINT_LATTICE_SIZE, vector<unsigned long long>( FINGERPRINT_LATTICE_SIZE ) );
+    for ( int x = 0; x < FINGERPRINT_LATTICE_SIZE; x++ ) {
+        for ( int y = x; y < FINGERPRINT_LATTICE_SIZE; y++ ) {
+            propagator[ x ][ y ] = generator() % FINGERPRINT_PRIME;
+            propagator[ y ][ x ] = propagator[ x ][ y ];
+        }
+    }
+    unsigned long long loopValue = generator() % FINGERPRINT_PRIME;
+
+    // Relabel vertices from 0, and fold infinity loops into a constant factor.
+    unsigned long long loopFactor = 1;
+    map<int, int> vertexLabels;
+    vector<IndexContraction> edges;
+    for ( vector<IndexContraction>::iterator iter = contractions.begin(); iter != contractions.end(); ++iter ) {
+        if ( iter->i == iter->j ) {
+            loopFactor = ( loopFactor * loopValue ) % FINGERPRINT_PRIME;
+        } else {
+            int nextLabel = (int)vertexLabels.size();
+            if ( vertexLabels.count( iter->i ) == 0 ) vertexLabels[ iter->i ] = nextLabel++;
+            if ( vertexLabels.count( iter->j ) == 0 ) vertexLabels[ iter->j ] = nextLabel;
+            edges.push_back( IndexContraction( vertexLabels[ iter->i ], vertexLabels[ iter->j ] ) );
+        }
+    }
+
+    // Sum the product of propagators over every assignment of vertices to lattice sites.
+    vector<int> sites( vertexLabels.size(), 0 );
+    unsigned long long total = 0;
+    bool isExhausted = false;
+    while ( not isExhausted ) {
+        unsigned long long term = 1;
+        for ( vector<IndexContraction>::iterator edge = edges.begin(); edge != edges.end(); ++edge ) {
+            term = ( term * propagator[ sites[ edge->i ] ][ sites[ edge->j ] ] ) % FINGERPRINT_PRIME;
+        }
+        total = ( total + term ) % FINGERPRINT_PRIME;
+
+        isExhausted = true;
+        for ( int v = 0; v < sites.size(); v++ ) {
+            if ( ++sites[ v ] < FINGERPRINT_LATTICE_SIZE ) {
+                isExhausted = false;
+                break;
+            }
+            sites[ v ] = 0;
+        }
+    }
+
+    return ( total * loopFactor ) % FINGERPRINT_PRIME;
+}
+
+unsigned long long getDiagramFingerprint( vector<IndexContraction> contractions ) {
+    unsigned long long fingerprint = 0;
+    for ( int i = 0; i < sizeof( FINGERPRINT_SEEDS ) / sizeof( FINGERPRINT_SEEDS[0] ); i++ ) {
+        fingerprint = fingerprint * FINGERPRINT_PRIME + evaluateDiagramModPrime( contractions, FINGERPRINT_SEEDS[ i ] );
+    }
+
+    return fingerprint;
+}
+
+unsigned long long getDiagramFingerprint( DeltaContractionSet contractions ) {
+    return getDiagramFingerprint( contractions.getContractions() );
+}
+
+DiagramCatalog::DiagramCatalog() {
+    hits = 0;
+    misses = 0;
+}
+
+string getContractionVectorKey( const vector<IndexContraction> &contractions ) {
+    stringstream key;
+    for ( vector<IndexContraction>::const_iterator iter = contractions.begin(); iter != contractions.end(); ++iter ) {
+        key << iter->i << "," << iter->j << ";";
+    }
+
+    return key.str();
+}
+
+int DiagramCatalog::registerDiagram( vector<IndexContraction> contractions ) {
+    string rawKey = getContractionVectorKey( contractions );
+    int id = -1;
+
+    // Contraction vectors which have been seen before, in this run or in a run whose catalog was loaded from file,
+    // are resolved without canonicalization.
+    {
+        lock_guard<std::mutex> guard( mutex );
+        map<string, int>::iterator entry = rawDiagramIDs.find( rawKey );
+        if ( entry != rawDiagramIDs.end() ) {
+            id = entry->second;
+            hits++;
+        } else {
+            misses++;
+        }
+    }
+
+    if ( id >= 0 ) return id;
+
+    // Otherwise, the contraction vector is compared exactly only against the registered diagrams which share its
+    // fingerprint; isomorphic diagrams always share a fingerprint, and distinct diagrams almost never do.
+    unsigned long long fingerprint = getDiagramFingerprint( contractions );
+    vector<int> candidateIDs;
+    vector< vector<IndexContraction> > candidateForms;
+
+    {
+        lock_guard<std::mutex> guard( mutex );
+        map<unsigned long long, vector<int> >::iterator entry = fingerprintIDs.find( fingerprint );
+        if ( entry != fingerprintIDs.end() ) {
+            for ( vector<int>::iterator candidate = entry->second.begin(); candidate != entry->second.end(); ++candidate ) {
+                candidateIDs.push_back( *candidate );
+                candidateForms.push_back( canonicalForms[ *candidate ] );
+            }
+        }
+    }
+
+    for ( int i = 0; i < candidateIDs.size(); i++ ) {
+        if ( compareContractionSetsViaDiagrams( DeltaContractionSet( candidateForms[ i ] ), DeltaContractionSet( contractions ) ) ) {
+            id = candidateIDs[ i ];
+            break;
+        }
+    }
+
+    // Only a diagram which has not been registered before, or whose fingerprint collides with that of a distinct
+    // diagram, is canonicalized. The canonical form remains the final key, which also resolves a diagram registered
+    // concurrently by another thread.
+    vector<IndexContraction> canonicalForm;
+    string key;
+    if ( id < 0 ) {
+        canonicalForm = getCanonicalDiagramForm( contractions );
+        key = getContractionVectorKey( canonicalForm );
+    }
+
+    {
+        lock_guard<std::mutex> guard( mutex );
+        if ( id < 0 ) {
+            map<string, int>::iterator entry = diagramIDs.find( key );
+            if ( entry != diagramIDs.end() ) {
+                id = entry->second;
+            } else {
+                id = (int)canonicalForms.size();
+                diagramIDs[ key ] = id;
+                canonicalForms.push_back( canonicalForm );
+                fingerprintIDs[ fingerprint ].push_back( id );
+            }
+        }
+
+        rawDiagramIDs[ rawKey ] = id;
+    }
+
+    return id;
+}
+
+vector<IndexContraction> DiagramCatalog::getCanonicalForm( int id ) {
+    vector<IndexContraction> canonicalForm;
+
+    {
+        lock_guard<std::mutex> guard( mutex );
+        if ( id >= 0 and id < canonicalForms.size() ) {
+            canonicalForm = canonicalForms[ id ];
+        } else {
+            cout << "***ERROR: Diagram ID " << id << " is not present in the diagram catalog." << endl;
+        }
+    }
+
+    return canonicalForm;
+}
+
+int DiagramCatalog::getNumberOfDiagrams() {
+    int numDiagrams;
+
+    {
+        lock_guard<std::mutex> guard( mutex );
+        numDiagrams = (int)canonicalForms.size();
+    }
+
+    return numDiagrams;
+}
+
+unsigned long DiagramCatalog::getNumberOfHits() {
+    lock_guard<std::mutex> guard( mutex );
+    return hits;
+}
+
+unsigned long DiagramCatalog::getNumberOfMisses() {
+    lock_guard<std::mutex> guard( mutex );
+    return misses;
+}
+
+void DiagramCatalog::clear() {
+    {
+        lock_guard<std::mutex> guard( mutex );
+        diagramIDs.clear();
+        rawDiagramIDs.clear();
+        fingerprintIDs.clear();
+        canonicalForms.clear();
+        hits = 0;
+        misses = 0;
+    }
+}
+
+DiagramCatalog Amaunet::DIAGRAM_CATALOG;
@@ -7,6 +7,9 @@
 
 #include <vector>
 #include <map>
+#include <string>
+#include <mutex>
+#include <boost/serialization/map.hpp>
 #include "PathIntegration.h"
 
 class Vertex {
@@ -62,8 +65,130 @@ private:
 
 };
 
+/**
+ * Catalog of canonical diagram topologies. Each distinct topology is assigned a stable integer ID in order of
+ * registration, such that a term of an evaluated expression may be identified by its order in A, its flavor label
+ * order, and the ID of its diagram alone. Registered diagrams are bucketed by fingerprint, such that a contraction
+ * vector is compared exactly only against diagrams with an equal fingerprint. Every raw contraction vector which has
+ * been registered is also memoized with its ID, and both tables are serialized, so that a catalog saved at the end of a
+ * run and loaded at the start of the next resolves known diagrams without canonicalization. Access is serialized so
+ * that a single instance may be shared by all threads.
+ */
+class DiagramCatalog {
+
+    friend class boost::serialization::access;
+
+public:
+
+    DiagramCatalog();
+
+    /**
+     * Brings a vector of contractions to canonical form and returns the ID of its topology, registering the topology
+     * if it has not been encountered before. The empty vector, corresponding to a term without a FourierSum, is a
+     * valid diagram.
+     * @param contractions The contraction vector of a FourierSum.
+     * @return The ID of the diagram.
+     */
+    int registerDiagram( std::vector<IndexContraction> contractions );
+
+    /**
+     * Gets the canonical contraction vector of a registered diagram (see getCanonicalDiagramForm()).
+     * @param id The ID of the diagram.
+     * @return The canonical contraction vector.
+     */
+    std::vector<IndexContraction> getCanonicalForm( int id );
+
+    int getNumberOfDiagrams();
+
+    /**
+     * Number of registrations resolved from the table of raw contraction vectors.
+     */
+    unsigned long getNumberOfHits();
+
+    /**
+     * Number of registrations which required canonicalization.
+     */
+    unsigned long getNumberOfMisses();
+
+    void clear();
+
+private:
+
+    /**
+     * Maps the string representation of a canonical contraction vector to its diagram ID.
+     */
+    std::map<std::string, int> diagramIDs;
+
+    /**
+     * Maps the string representation of every raw contraction vector which has been registered to its diagram ID.
+     */
+    std::map<std::string, int> rawDiagramIDs;
+
+    /**
+     * Maps a diagram fingerprint (see getDiagramFingerprint()) to the IDs of the registered diagrams which share it.
+     */
+    std::map<unsigned long long, std::vector<int> > fingerprintIDs;
+
+    /**
+     * The canonical contraction vector of each diagram, indexed by diagram ID.
+     */
+    std::vector< std::vector<IndexContraction> > canonicalForms;
+
+    unsigned long hits;
+
+    unsigned long misses;
+
+    std::mutex mutex;
+
+    /**
+     * Serialization method compatible with the Boost library.
+     * @tparam Archive Serialization stream type provided by the Boost library implementation.
+     * @param ar Serialization stream provided by the Boost library implementation.
+     * @param version Version of this serialization (unused by this code).
+     */
+    template <class Archive> void serialize( Archive &ar, const unsigned int version ) {
+        ar & diagramIDs;
+        ar & rawDiagramIDs;
+        ar & fingerprintIDs;
+        ar & canonicalForms;
+    }
+
+};
+
+namespace Amaunet {
+    extern DiagramCatalog DIAGRAM_CATALOG;
+}
+
 FeynmanDiagram constructDiagram( DeltaContractionSet indexSet );
 
+/**
+ * Relabels the vertices of a diagram such that any two contraction vectors which are similar in the sense of
+ * FeynmanDiagram::isSimilarTo() are mapped to an identical vector. Infinity loops are written first as (0, 0), followed
+ * by each remaining contraction (i, j) with i < j, in sorted order; vertices are labeled from 0. Only permutations
+ * within classes of vertices of equal degree and equal neighbor degrees are searched.
+ * @param contractions The contraction vector of a FourierSum.
+ * @return The canonical contraction vector.
+ */
+std::vector<IndexContraction> getCanonicalDiagramForm( std::vector<IndexContraction> contractions );
+
+/**
+ * Computes an isomorphism-invariant fingerprint of a diagram. The diagram is evaluated modulo the prime 2^31 - 1 as a
+ * sum over every assignment of its vertices to the sites of a small lattice of a product of random symmetric propagator
+ * values, with a random factor for each infinity loop. Evaluations for two fixed seeds are packed into the result.
+ * Diagrams which are similar in the sense of FeynmanDiagram::isSimilarTo() always have equal fingerprints; distinct
+ * diagrams have equal fingerprints with small probability, so an exact comparison is still required on a match.
+ * @param contractions The contraction vector of a FourierSum.
+ * @return The fingerprint of the diagram.
+ */
+unsigned long long getDiagramFingerprint( std::vector<IndexContraction> contractions );
+
+unsigned long long getDiagramFingerprint( DeltaContractionSet contractions );
+
+/**
+ * Gets a string which uniquely represents a contraction vector, element by element.
+ */
+std::string getContractionVectorKey( const std::vector<IndexContraction> &contractions );
+
 bool compareContractionSetsViaDiagrams( DeltaContractionSet setA, DeltaContractionSet setB );
         
 #endif //AMAUNETC_FEYNMANDIAGRAM_H
@@ -0,0 +1,622 @@
+/* ***********************************************************************
+ * Amaunet: High-order Lattice Perturbation Theory
+ *          for Non-Relativistic Quantum Matter
+ *
+ * High-order Perturbation Theory Analytics
+ * Weak-coupling Expansion for Fermionic Contact Interactions
+ *
+ * Export of Expressions to the Numerical Evaluator Interchange Format
+ * Source Implementation
+ *
+ * Andrew C. Loheac, Joaquin E. Drut
+ * Department of Physics and Astronomy
+ * University of North Carolina at Chapel Hill
+ * ***********************************************************************
+ */
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include "omp.h"
+#include "PathIntegration.h"
+#include "BinarySerialization.h"
+#include "ExpressionArchive.h"
+#include "InterchangeFormat.h"
+
+using namespace std;
+
+const unsigned int Amaunet::INTERCHANGE_FORMAT_VERSION = 1;
+
+static const char INTERCHANGE_FORMAT_MAGIC[4] = { 'A', 'M', 'N', 'I' };
+
+/*
+ * Size of the buffer of encoded terms at which it is flushed to the output stream.
+ */
+static const size_t INTERCHANGE_FLUSH_SIZE = 1 << 20;
+
+/*
+ * ***********************************************************************
+ * TERM ENCODING
+ * ***********************************************************************
+ */
+
+static void appendInteger( string &buffer, long long value ) {
+    char digits[ 24 ];
+    int length = snprintf( digits, sizeof( digits ), "%lld", value );
+    buffer.append( digits, length );
+}
+
+static void appendReal( string &buffer, double value ) {
+    char digits[ 32 ];
+    int length = snprintf( digits, sizeof( digits ), "%.17g", value );
+    buffer.append( digits, length );
+}
+
+static void appendIndexPair( string &buffer, int* indices, bool binary ) {
+    if ( binary ) {
+        appendSignedVarint( buffer, indices[ 0 ] );
+        appendSignedVarint( buffer, indices[ 1 ] );
+    } else {
+        appendInteger( buffer, indices[ 0 ] );
+        buffer.push_back( ',' );
+        appendInteger( buffer, indices[ 1 ] );
+    }
+}
+
+static void appendFactor( SymbolicTermPtr factor, string &buffer, bool binary ) {
+    switch ( factor->getTermID() ) {
+        case TermTypes::MATRIX_K: {
+            string flavorLabel = factor->getFlavorLabel();
+
+            buffer.push_back( 'D' );
+            if ( binary ) {
+                appendVarint( buffer, flavorLabel.size() );
+                buffer.append( flavorLabel );
+            } else {
+                buffer.push_back( ',' );
+                buffer.append( flavorLabel );
+                buffer.push_back( ',' );
+            }
+            appendIndexPair( buffer, factor->getIndices(), binary );
+            break;
+        }
+
+        case TermTypes::FOURIER_SUM: {
+            vector<IndexContraction> contractions = static_cast<FourierSum*>( factor.get() )->getContractionVector();
+
+            buffer.push_back( 'F' );
+            if ( binary ) appendVarint( buffer, 2 * contractions.size() );
+            for ( vector<IndexContraction>::iterator it = contractions.begin(); it != contractions.end(); ++it ) {
+                int indices[ 2 ] = { it->i, it->j };
+                if ( not binary ) buffer.push_back( ',' );
+                appendIndexPair( buffer, indices, binary );
+            }
+            break;
+        }
+
+        case TermTypes::DELTA:
+            buffer.push_back( 'B' );
+            if ( not binary ) buffer.push_back( ',' );
+            appendIndexPair( buffer, factor->getIndices(), binary );
+            break;
+
+        default:
+            return;
+    }
+
+    if ( not binary ) buffer.push_back( '/' );
+}
+
+bool appendInterchangeTerm( SymbolicTermPtr term, string &buffer, bool binary ) {
+    if ( term->getTermID() != TermTypes::PRODUCT ) term = Product( term ).copy();
+
+    Product* product = static_cast<Product*>( term.get() );
+    int orderInA = 0;
+    bool hasCoefficient = false;
+    double coefficient = 1;
+
+    // The order in A and the coefficient precede or follow all other factors, so they are gathered first.
+    for ( vector<SymbolicTermPtr>::iterator factor = product->getIteratorBegin(); factor != product->getIteratorEnd(); ++factor ) {
+        TermTypes id = (*factor)->getTermID();
+
+        if ( id == TermTypes::TERM_A ) {
+            orderInA++;
+        } else if ( id == TermTypes::COEFFICIENT_FLOAT || id == TermTypes::COEFFICIENT_FRACTION ) {
+            coefficient *= ( id == TermTypes::COEFFICIENT_FLOAT ) ? static_cast<CoefficientFloat*>( factor->get() )->eval()
+                                                                 : static_cast<CoefficientFraction*>( factor->get() )->eval();
+            hasCoefficient = true;
+        } else if ( id == TermTypes::DELTA && not static_cast<Delta*>( factor->get() )->isDeltaBar() ) {
+            cout << "***ERROR: A Delta which is not a Delta bar cannot be written in the interchange format." << endl;
+            return false;
+        } else if ( id != TermTypes::MATRIX_K && id != TermTypes::FOURIER_SUM && id != TermTypes::DELTA ) {
+            cout << "***ERROR: A term of type '" << (char)id << "' cannot be written in the interchange format." << endl;
+            return false;
+        }
+    }
+
+    buffer.push_back( 'A' );
+    if ( binary ) {
+        appendVarint( buffer, orderInA );
+    } else {
+        buffer.push_back( ',' );
+        appendInteger( buffer, orderInA );
+        buffer.push_back( '/' );
+    }
+
+    for ( vector<SymbolicTermPtr>::iterator factor = product->getIteratorBegin(); factor != product->getIteratorEnd(); ++factor ) {
+        appendFactor( *factor, buffer, binary );
+    }
+
+    if ( hasCoefficient ) {
+        buffer.push_back( 'C' );
+        if ( binary ) {
+            appendDouble( buffer, coefficient );
+        } else {
+            buffer.push_back( ',' );
+            appendReal( buffer, coefficient );
+            buffer.push_back( '/' );
+        }
+    }
+
+    buffer.push_back( ';' );
+    if ( not binary ) buffer.push_back( '\n' );
+
+    return true;
+}
+
+void appendInterchangeHeader( string &buffer ) {
+    buffer.append( INTERCHANGE_FORMAT_MAGIC, 4 );
+    appendVarint( buffer, Amaunet::INTERCHANGE_FORMAT_VERSION );
+}
+
+/*
+ * ***********************************************************************
+ * STREAMING EXPORT
+ * ***********************************************************************
+ */
+
+long long exportSumToInterchangeFormat( Sum &expr, ostream &os, bool binary ) {
+    string buffer;
+    long long numTerms = 0;
+
+    buffer.reserve( INTERCHANGE_FLUSH_SIZE + 4096 );
+    for ( vector<SymbolicTermPtr>::iterator term = expr.getIteratorBegin(); term != expr.getIteratorEnd(); ++term ) {
+        if ( not appendInterchangeTerm( *term, buffer, binary ) ) return -1;
+        numTerms++;
+
+        if ( buffer.size() >= INTERCHANGE_FLUSH_SIZE ) {
+            os.write( buffer.data(), buffer.size() );
+            buffer.clear();
+        }
+    }
+
+    os.write( buffer.data(), buffer.size() );
+    return os.good() ? numTerms : -1;
+}
+
+long long exportSumToInterchangeFile( Sum &expr, string filename, bool binary ) {
+    ofstream ofs;
+    ofs.open( filename.c_str(), ios::out | ios::binary );
+
+    if ( not ofs.is_open() ) {
+        cout << "***ERROR: Failed to open file '" << filename << "' for writing." << endl;
+        return -1;
+    }
+
+    if ( binary ) {
+        string header;
+        appendInterchangeHeader( header );
+        ofs.write( header.data(), header.size() );
+    }
+
+    long long numTerms = exportSumToInterchangeFormat( expr, ofs, binary );
+    ofs.close();
+
+    if ( numTerms < 0 ) {
+        cout << "***ERROR: Failed to export expression to file '" << filename << "'." << endl;
+        return -1;
+    }
+
+    cout << "Expression exported to file '" << filename << "' (" << numTerms << " terms)." << endl;
+    return numTerms;
+}
+
+long long convertBinaryFileToInterchangeFile( string binaryFilename, string filename, bool binary ) {
+    MappedExpressionReader reader( binaryFilename );
+    if ( reader.hasError() ) return -1;
+
+    ofstream ofs;
+    ofs.open( filename.c_str(), ios::out | ios::binary );
+
+    if ( not ofs.is_open() ) {
+        cout << "***ERROR: Failed to open file '" << filename << "' for writing." << endl;
+        return -1;
+    }
+
+    string buffer;
+    long long numTerms = 0;
+    bool failed = false;
+
+    if ( binary ) appendInterchangeHeader( buffer );
+    while ( reader.next() ) {
+        if ( not appendInterchangeTerm( reader.getTerm().materialize(), buffer, binary ) ) {
+            failed = true;
+            break;
+        }
+        numTerms++;
+
+        if ( buffer.size() >= INTERCHANGE_FLUSH_SIZE ) {
+            ofs.write( buffer.data(), buffer.size() );
+            buffer.clear();
+        }
+    }
+
+    ofs.write( buffer.data(), buffer.size() );
+    ofs.close();
+
+    if ( failed || reader.hasError() || not ofs.good() ) {
+        cout << "***ERROR: Failed to convert file '" << binaryFilename << "' to the interchange format." << endl;
+        return -1;
+    }
+
+    return numTerms;
+}
+
+long long convertArchiveToInterchangeFile( string archiveFilename, string filename, bool binary ) {
+    ExpressionArchiveReader archive( archiveFilename );
+    if ( not archive.isOpen() ) return -1;
+
+    ofstream ofs;
+    ofs.open( filename.c_str(), ios::out | ios::binary );
+
+    if ( not ofs.is_open() ) {
+        cout << "***ERROR: Failed to open file '" << filename << "' for writing." << endl;
+        return -1;
+    }
+
+    string header;
+    long long numTerms = 0;
+    bool failed = false;
+
+    if ( binary ) appendInterchangeHeader( header );
+    ofs.write( header.data(), header.size() );
+
+    for ( int block = 0; block < archive.getNumberOfBlocks() && not failed; block++ ) {
+        Sum terms;
+        long long numTermsInBlock = -1;
+
+        if ( archive.readBlock( block, terms ) == 0 ) numTermsInBlock = exportSumToInterchangeFormat( terms, ofs, binary );
+        if ( numTermsInBlock < 0 ) failed = true;
+        else numTerms += numTermsInBlock;
+    }
+
+    ofs.close();
+
+    if ( failed || not ofs.good() ) {
+        cout << "***ERROR: Failed to convert archive '" << archiveFilename << "' to the interchange format." << endl;
+        return -1;
+    }
+
+    cout << "Expression exported to file '" << filename << "' (" << numTerms << " terms)." << endl;
+    return numTerms;
+}
+
+/*
+ * ***********************************************************************
+ * PARSING
+ * ***********************************************************************
+ */
+
+void InterchangeExpression::append( const InterchangeExpression &other ) {
+    unsigned int factorOffset = (unsigned int)factors.size();
+    unsigned int indexOffset = (unsigned int)indices.size();
+    vector<int> flavorMap;
+
+    for ( vector<string>::const_iterator flavor = other.flavors.begin(); flavor != other.flavors.end(); ++flavor ) {
+        flavorMap.push_back( getFlavorIndex( flavor->data(), flavor->size() ) );
+    }
+
+    for ( vector<InterchangeTerm>::const_iterator term = other.terms.begin(); term != other.terms.end(); ++term ) {
+        terms.push_back( *term );
+        terms.back().firstFactor += factorOffset;
+    }
+
+    for ( vector<InterchangeFactor>::const_iterator factor = other.factors.begin(); factor != other.factors.end(); ++factor ) {
+        factors.push_back( *factor );
+        factors.back().firstIndex += indexOffset;
+        if ( factor->flavor >= 0 ) factors.back().flavor = flavorMap[ factor->flavor ];
+    }
+
+    indices.insert( indices.end(), other.indices.begin(), other.indices.end() );
+}
+
+int InterchangeExpression::getFlavorIndex( const char* label, size_t length ) {
+    for ( size_t n = 0; n < flavors.size(); n++ ) {
+        if ( flavors[ n ].size() == length && memcmp( flavors[ n ].data(), label, length ) == 0 ) return (int)n;
+    }
+
+    flavors.push_back( string( label, length ) );
+    return (int)flavors.size() - 1;
+}
+
+static void skipWhitespace( const char* &position, const char* end ) {
+    while ( position < end && ( *position == ' ' || *position == '\n' || *position == '\r' || *position == '\t' ) ) position++;
+}
+
+static bool expectCharacter( const char* &position, const char* end, char c ) {
+    skipWhitespace( position, end );
+    if ( position >= end || *position != c ) return false;
+
+    position++;
+    return true;
+}
+
+static bool parseInteger( const char* &position, const char* end, int &value ) {
+    skipWhitespace( position, end );
+
+    bool negative = ( position < end && *position == '-' );
+    if ( negative ) position++;
+
+    const char* digits = position;
+    long long magnitude = 0;
+    while ( position < end && *position >= '0' && *position <= '9' && magnitude < 0x80000000LL ) {
+        magnitude = 10 * magnitude + ( *position++ - '0' );
+    }
+    if ( position == digits || magnitude >= 0x80000000LL ) return false;
+
+    value = (int)( negative ? -magnitude : magnitude );
+    return true;
+}
+
+static bool parseReal( const char* &position, const char* end, double &value ) {
+    skipWhitespace( position, end );
+
+    // The mapped file is not null-terminated, so the number is copied before it is handed to strtod().
+    char digits[ 64 ];
+    size_t length = 0;
+    while ( position + length < end && length < sizeof( digits ) - 1 && strchr( "0123456789+-.eE", position[ length ] ) != NULL ) {
+        digits[ length ] = position[ length ];
+        length++;
+    }
+    digits[ length ] = '\0';
+
+    char* parsed;
+    value = strtod( digits, &parsed );
+    if ( length == 0 || parsed != digits + length ) return false;
+
+    position += length;
+    return true;
+}
+
+bool parseInterchangeTerms( const char* begin, const char* end, InterchangeExpression &expr, const char* &errorPosition ) {
+    const char* position = begin;
+
+    while ( true ) {
+        skipWhitespace( position, end );
+        if ( position >= end ) return true;
+
+        InterchangeTerm term = { 0, 1, (unsigned int)expr.factors.size(), 0 };
+        errorPosition = position;
+
+        while ( true ) {
+            skipWhitespace( position, end );
+            if ( position >= end ) return false;
+            if ( *position == ';' ) {
+                position++;
+                break;
+            }
+
+            errorPosition = position;
+            char type = *position++;
+            InterchangeFactor factor = { type, -1, (unsigned int)expr.indices.size(), 0 };
+            int i, j;
+
+            // Every factor has arguments following a comma, except an F with no contractions.
+            bool hasArguments = expectCharacter( position, end, ',' );
+            if ( not hasArguments && type != 'F' ) return false;
+
+            switch ( type ) {
+                case 'A':
+                    if ( not parseInteger( position, end, i ) ) return false;
+                    term.orderInA += i;
+                    break;
+
+                case 'C': {
+                    double value;
+                    if ( not parseReal( position, end, value ) ) return false;
+                    term.coefficient *= value;
+                    break;
+                }
+
+                case 'D': {
+                    skipWhitespace( position, end );
+                    const char* label = position;
+                    while ( position < end && *position != ',' && *position != '/' && *position != ';' ) position++;
+                    if ( position == label ) return false;
+
+                    factor.flavor = expr.getFlavorIndex( label, position - label );
+                    if ( not expectCharacter( position, end, ',' ) ) return false;
+                }
+                // fall through
+                case 'B':
+                    if ( not parseInteger( position, end, i ) || not expectCharacter( position, end, ',' ) ) return false;
+                    if ( not parseInteger( position, end, j ) ) return false;
+                    expr.indices.push_back( i );
+                    expr.indices.push_back( j );
+                    factor.numIndices = 2;
+                    break;
+
+                case 'F':
+                    if ( hasArguments ) {
+                        do {
+                            if ( not parseInteger( position, end, i ) ) return false;
+                            expr.indices.push_back( i );
+                            factor.numIndices++;
+                        } while ( expectCharacter( position, end, ',' ) );
+                    }
+                    if ( factor.numIndices % 2 != 0 ) return false;
+                    break;
+
+                default:
+                    return false;
+            }
+
+            if ( type == 'D' || type == 'B' || type == 'F' ) {
+                expr.factors.push_back( factor );
+                term.numFactors++;
+            }
+
+            // Factors are separated by '/', which the last factor of a term need not have.
+            skipWhitespace( position, end );
+            if ( position < end && *position == '/' ) {
+                position++;
+            } else if ( position >= end || *position != ';' ) {
+                return false;
+            }
+        }
+
+        expr.terms.push_back( term );
+    }
+}
+
+bool parseBinaryInterchangeTerms( const char* begin, const char* end, InterchangeExpression &expr, const char* &errorPosition ) {
+    const char* position = begin;
+
+    while ( position < end ) {
+        InterchangeTerm term = { 0, 1, (unsigned int)expr.factors.size(), 0 };
+        errorPosition = position;
+
+        while ( true ) {
+            if ( position >= end ) return false;
+
+            errorPosition = position;
+            char type = *position++;
+            if ( type == ';' ) break;
+
+            InterchangeFactor factor = { type, -1, (unsigned int)expr.indices.size(), 0 };
+            unsigned long long value;
+            long long i, j;
+
+            switch ( type ) {
+                case 'A':
+                    if ( not readVarint( position, end, value ) ) return false;
+                    term.orderInA += (int)value;
+                    continue;
+
+                case 'C': {
+                    double coefficient;
+                    if ( not readDouble( position, end, coefficient ) ) return false;
+                    term.coefficient *= coefficient;
+                    continue;
+                }
+
+                case 'D':
+                    if ( not readVarint( position, end, value ) || value > (unsigned long long)( end - position ) ) return false;
+                    factor.flavor = expr.getFlavorIndex( position, value );
+                    position += value;
+                    // fall through
+                case 'B':
+                    if ( not readSignedVarint( position, end, i ) || not readSignedVarint( position, end, j ) ) return false;
+                    expr.indices.push_back( (int)i );
+                    expr.indices.push_back( (int)j );
+                    factor.numIndices = 2;
+                    break;
+
+                case 'F':
+                    if ( not readVarint( position, end, value ) || value % 2 != 0 || value > (unsigned long long)( end - position ) ) return false;
+                    for ( unsigned long long n = 0; n < value; n++ ) {
+                        if ( not readSignedVarint( position, end, i ) ) return false;
+                        expr.indices.push_back( (int)i );
+                    }
+                    factor.numIndices = (unsigned int)value;
+                    break;
+
+                default:
+                    return false;
+            }
+
+            expr.factors.push_back( factor );
+            term.numFactors++;
+        }
+
+        expr.terms.push_back( term );
+    }
+
+    return true;
+}
+
+long long parseInterchangeFile( string filename, InterchangeExpression &expr, int numThreads ) {
+    expr = InterchangeExpression();
+
+    // Empty files cannot be mapped, but hold an empty expression.
+    struct stat st;
+    if ( stat( filename.c_str(), &st ) == 0 && st.st_size == 0 ) return 0;
+
+    MappedFile file( filename );
+
+    if ( not file.isOpen() ) {
+        cout << "***ERROR: Failed to map file '" << filename << "' for reading." << endl;
+        return -1;
+    }
+
+    const char* begin = file.begin();
+    const char* end = file.end();
+    const char* errorPosition = begin;
+
+    if ( end - begin >= 4 && memcmp( begin, INTERCHANGE_FORMAT_MAGIC, 4 ) == 0 ) {
+        const char* position = begin + 4;
+        unsigned long long version;
+
+        if ( not readVarint( position, end, version ) || version != Amaunet::INTERCHANGE_FORMAT_VERSION ) {
+            cout << "***ERROR: File '" << filename << "' is not a supported binary interchange file." << endl;
+            return -1;
+        }
+
+        if ( not parseBinaryInterchangeTerms( position, end, expr, errorPosition ) ) {
+            cout << "***ERROR: Malformed term at byte " << ( errorPosition - begin ) << " of file '" << filename << "'." << endl;
+            expr = InterchangeExpression();
+            return -1;
+        }
+
+        return (long long)expr.terms.size();
+    }
+
+    // Split the file into ranges of roughly equal size, each extended to the end of the term in which it would end.
+    if ( numThreads < 1 ) numThreads = 1;
+    vector<const char*> bounds( 1, begin );
+    for ( int n = 1; n < numThreads; n++ ) {
+        const char* bound = max( bounds.back(), begin + ( end - begin ) * n / numThreads );
+        const char* separator = (const char*)memchr( bound, ';', end - bound );
+        bounds.push_back( separator == nullptr ? end : separator + 1 );
+    }
+    bounds.push_back( end );
+
+    vector<InterchangeExpression> parts( numThreads );
+    vector<const char*> errors( numThreads, nullptr );
+
+#pragma omp parallel for num_threads( numThreads ) schedule( static, 1 )
+    for ( int n = 0; n < numThreads; n++ ) {
+        const char* partError = bounds[ n ];
+        if ( not parseInterchangeTerms( bounds[ n ], bounds[ n + 1 ], parts[ n ], partError ) ) errors[ n ] = partError;
+    }
+
+    for ( int n = 0; n < numThreads; n++ ) {
+        if ( errors[ n ] != nullptr ) {
+            cout << "***ERROR: Malformed term at byte " << ( errors[ n ] - begin ) << " of file '" << filename << "'." << endl;
+            expr = InterchangeExpression();
+            return -1;
+        }
+
+        if ( n == 0 ) {
+            expr = move( parts[ 0 ] );
+        } else {
+            expr.append( parts[ n ] );
+            parts[ n ] = InterchangeExpression();
+        }
+    }
+
+    return (long long)expr.terms.size();
+}
@@ -0,0 +1,188 @@
+/* ***********************************************************************
+ * Amaunet: High-order Lattice Perturbation Theory
+ *          for Non-Relativistic Quantum Matter
+ *
+ * High-order Perturbation Theory Analytics
+ * Weak-coupling Expansion for Fermionic Contact Interactions
+ *
+ * Export of Expressions to the Numerical Evaluator Interchange Format
+ * Header
+ *
+ * Andrew C. Loheac, Joaquin E. Drut
+ * Department of Physics and Astronomy
+ * University of North Carolina at Chapel Hill
+ * ***********************************************************************
+ */
+
+#ifndef AMAUNETC_INTERCHANGEFORMAT_H
+#define AMAUNETC_INTERCHANGEFORMAT_H
+
+#include <string>
+#include <ostream>
+#include <vector>
+#include "PTSymbolicObjects.h"
+
+/*
+ * The interchange format is the flat text format read by the numerical evaluator, as formerly written by the Python
+ * outputExprToInterpreterFormat(). Each term of a fully-distributed Sum is written as a sequence of factors separated
+ * by '/' and terminated by ';':
+ *
+ *     A,n/D,flavor,i,j/F,i1,j1,i2,j2,.../C,value/B,i,j/;
+ *
+ * where n is the order in A of the term, D is a (Fourier transformed) MatrixK, F is the FourierSum with its contraction
+ * pairs flattened, C is the overall numerical coefficient, and B is a Delta bar. The order in A is always written
+ * first, and all CoefficientFloat and CoefficientFraction factors of a term are combined into a single C factor, which
+ * is omitted if the term has none. Each term is followed by a newline, which the evaluator ignores.
+ *
+ * The binary sibling of the format begins with the four byte magic string "AMNI" and the format version as a varint,
+ * followed by the terms with the same sequence of factors, each introduced by the same one byte tag:
+ *
+ *     'A' varint n | 'D' varint length flavor zigzag i zigzag j | 'F' varint count zigzag indices...
+ *     | 'C' 8 byte double | 'B' zigzag i zigzag j | ';'
+ *
+ * with integers encoded as in BinarySerialization.h.
+ */
+
+namespace Amaunet {
+    extern const unsigned int INTERCHANGE_FORMAT_VERSION;
+}
+
+/**
+ * Appends a single term in the interchange format.
+ * @param term The term, which must be a Product of TermA, MatrixK, FourierSum, CoefficientFloat, CoefficientFraction,
+ * and Delta bar factors, or a single such factor.
+ * @param buffer The buffer to which the term is appended.
+ * @param binary If true, the term is written in the binary sibling of the format.
+ * @return True on success, false if the term contains a factor which cannot be written, in which case buffer is
+ * unmodified.
+ */
+bool appendInterchangeTerm( SymbolicTermPtr term, std::string &buffer, bool binary );
+
+/**
+ * Writes the header of a binary interchange file.
+ */
+void appendInterchangeHeader( std::string &buffer );
+
+/**
+ * Streams a Sum to an output stream in the interchange format, one term at a time. Only a bounded buffer of encoded
+ * terms is held in memory. No header is written; use exportSumToInterchangeFile() for a complete binary file.
+ * @return The number of terms written, or -1 if a term cannot be written or the stream fails.
+ */
+long long exportSumToInterchangeFormat( Sum &expr, std::ostream &os, bool binary );
+
+/**
+ * Writes a Sum to a file in the interchange format.
+ * @param binary If true, the file is written in the binary sibling of the format.
+ * @return The number of terms written, or -1 on failure.
+ */
+long long exportSumToInterchangeFile( Sum &expr, std::string filename, bool binary );
+
+/**
+ * Converts a file written by saveSumToBinaryFile() to the interchange format, materializing one term at a time so that
+ * the expression is never held in memory.
+ * @return The number of terms written, or -1 on failure.
+ */
+long long convertBinaryFileToInterchangeFile( std::string binaryFilename, std::string filename, bool binary );
+
+/**
+ * Converts an expression archive (see ExpressionArchiveWriter) to the interchange format, reading one archive block at
+ * a time so that the expression is never held in memory.
+ * @return The number of terms written, or -1 on failure.
+ */
+long long convertArchiveToInterchangeFile( std::string archiveFilename, std::string filename, bool binary );
+
+/**
+ * A single factor D, F, or B of a parsed interchange term. The indices of the factor are held in the shared index pool
+ * of the InterchangeExpression: two for D and B, and two for each contraction pair of F.
+ */
+struct InterchangeFactor {
+
+    /**
+     * One of 'D', 'F', or 'B'.
+     */
+    char type;
+
+    /**
+     * Position of the flavor label of a D factor in the flavor table, or -1.
+     */
+    int flavor;
+
+    unsigned int firstIndex;
+
+    unsigned int numIndices;
+
+};
+
+/**
+ * A single parsed interchange term. The factors of the term other than its order in A and coefficient are the range
+ * [ firstFactor, firstFactor + numFactors ) of the factors of the InterchangeExpression.
+ */
+struct InterchangeTerm {
+
+    int orderInA;
+
+    /**
+     * Product of all C factors of the term, or 1 if it has none.
+     */
+    double coefficient;
+
+    unsigned int firstFactor;
+
+    unsigned int numFactors;
+
+};
+
+/**
+ * Flat representation of a parsed interchange file: plain records of terms and factors in contiguous arrays, with the
+ * indices of all factors in a single pool and each distinct flavor label stored once.
+ */
+struct InterchangeExpression {
+
+    std::vector<InterchangeTerm> terms;
+
+    std::vector<InterchangeFactor> factors;
+
+    std::vector<int> indices;
+
+    std::vector<std::string> flavors;
+
+    /**
+     * Appends all terms of another expression, translating its factor, index, and flavor positions.
+     */
+    void append( const InterchangeExpression &other );
+
+    /**
+     * Gets the position of a flavor label in the flavor table, adding it if it is not present.
+     */
+    int getFlavorIndex( const char* label, size_t length );
+
+};
+
+/**
+ * Parses the terms of the text interchange format in a range of memory and appends them to an expression. The range
+ * is tokenized in place; whitespace between tokens is ignored, and a range need not end with a newline.
+ * @param begin Start of the range, which must be the start of a term.
+ * @param end End of the range, which must be the end of a term.
+ * @param expr The expression to which the parsed terms are appended.
+ * @param errorPosition Set to the position of the first malformed token on failure.
+ * @return True on success, false if a malformed term is found.
+ */
+bool parseInterchangeTerms( const char* begin, const char* end, InterchangeExpression &expr, const char* &errorPosition );
+
+/**
+ * Parses the terms of the binary interchange format, following the header, and appends them to an expression.
+ * @return True on success, false if a malformed term is found.
+ */
+bool parseBinaryInterchangeTerms( const char* begin, const char* end, InterchangeExpression &expr, const char* &errorPosition );
+
+/**
+ * Parses an interchange file, in either the text or the binary format, over a memory mapping of the file. A text file
+ * is split into numThreads ranges at term boundaries, which are parsed concurrently and joined in order.
+ * @param filename The file to parse.
+ * @param expr Set to the parsed expression.
+ * @param numThreads Number of threads used to parse a text file.
+ * @return The number of terms parsed, which is 0 for an empty file, or -1 if the file cannot be read or is malformed.
+ */
+long long parseInterchangeFile( std::string filename, InterchangeExpression &expr, int numThreads );
+
+#endif //AMAUNETC_INTERCHANGEFORMAT_H
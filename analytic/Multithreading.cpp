@@ -18,12 +18,178 @@
 
 #include <iostream>
 #include <thread>
+#include <functional>
+#include <algorithm>
 #include "omp.h"
 #include "PTSymbolicObjects.h"
 #include "PathIntegration.h"
+#include "FeynmanDiagram.h"
+#include "Multithreading.h"
 
 using namespace std;
 
+/*
+ * Index of the worker of the WorkStealingPool running on the current thread, or -1 on any other thread.
+ */
+static thread_local int currentPoolWorker = -1;
+
+/*
+ * The pool of which the current thread is a worker, if any. A task submitted by a worker to any other pool is dealt to
+ * the queues of that pool like a task submitted from outside of it.
+ */
+static thread_local WorkStealingPool* currentPool = nullptr;
+
+WorkStealingPool::WorkStealingPool( int numWorkers ) : queuedTasks( 0 ), pendingTasks( 0 ), nextQueue( 0 ), stopping( false ) {
+    numWorkers = max( 1, numWorkers );
+
+    for ( int i = 0; i < numWorkers; i++ ) queues.push_back( unique_ptr<WorkerQueue>( new WorkerQueue() ) );
+    for ( int i = 0; i < numWorkers; i++ ) workers.push_back( thread( &WorkStealingPool::workerLoop, this, i ) );
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    wait();
+
+    {
+        lock_guard<std::mutex> guard( mutex );
+        stopping = true;
+    }
+    taskQueued.notify_all();
+
+    for ( vector<thread>::iterator worker = workers.begin(); worker != workers.end(); ++worker ) worker->join();
+}
+
+void WorkStealingPool::submit( function<void()> task ) {
+    int queue;
+
+    {
+        lock_guard<std::mutex> guard( mutex );
+        queuedTasks++;
+        pendingTasks++;
+        queue = ( currentPool == this ) ? currentPoolWorker : (int)( nextQueue++ % queues.size() );
+    }
+
+    {
+        lock_guard<std::mutex> guard( queues[ queue ]->mutex );
+        queues[ queue ]->tasks.push_back( task );
+    }
+    taskQueued.notify_one();
+}
+
+void WorkStealingPool::wait() {
+    unique_lock<std::mutex> guard( mutex );
+    tasksCompleted.wait( guard, [ this ] { return pendingTasks == 0; } );
+}
+
+bool WorkStealingPool::takeTask( int worker, function<void()> &task ) {
+    {
+        lock_guard<std::mutex> guard( queues[ worker ]->mutex );
+        if ( not queues[ worker ]->tasks.empty() ) {
+            task = move( queues[ worker ]->tasks.front() );
+            queues[ worker ]->tasks.pop_front();
+            return true;
+        }
+    }
+
+    for ( size_t offset = 1; offset < queues.size(); offset++ ) {
+        WorkerQueue &victim = *queues[ ( worker + offset ) % queues.size() ];
+
+        lock_guard<std::mutex> guard( victim.mutex );
+        if ( not victim.tasks.empty() ) {
+            // Steal the oldest task, which the submission order makes the most expensive one left in the queue.
+            task = move( victim.tasks.front() );
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void WorkStealingPool::workerLoop( int worker ) {
+    currentPoolWorker = worker;
+    currentPool = this;
+
+    while ( true ) {
+        function<void()> task;
+
+        if ( takeTask( worker, task ) ) {
+            {
+                lock_guard<std::mutex> guard( mutex );
+                queuedTasks--;
+            }
+
+            task();
+
+            lock_guard<std::mutex> guard( mutex );
+            if ( --pendingTasks == 0 ) tasksCompleted.notify_all();
+            continue;
+        }
+
+        // A task counted as queued may not yet be visible in its queue, in which case the worker simply looks again.
+        unique_lock<std::mutex> guard( mutex );
+        taskQueued.wait( guard, [ this ] { return stopping || queuedTasks > 0; } );
+        if ( stopping && queuedTasks == 0 ) return;
+    }
+}
+
+ExpansionProfile getExpansionProfile( SymbolicTermPtr term ) {
+    ExpansionProfile profile;
+
+    if ( term->getTermID() == TermTypes::SUM ) {
+        SumPtr castTerm = static_pointer_cast<Sum>( term );
+        for ( vector<SymbolicTermPtr>::iterator iter = castTerm->getIteratorBegin(); iter != castTerm->getIteratorEnd(); ++iter ) {
+            ExpansionProfile termProfile = getExpansionProfile( *iter );
+            for ( ExpansionProfile::iterator entry = termProfile.begin(); entry != termProfile.end(); ++entry ) {
+                profile[ entry->first ] += entry->second;
+            }
+        }
+    } else if ( term->getTermID() == TermTypes::PRODUCT ) {
+        ProductPtr castTerm = static_pointer_cast<Product>( term );
+        profile[ make_pair( 0, 0 ) ] = 1.0;
+        for ( vector<SymbolicTermPtr>::iterator iter = castTerm->getIteratorBegin(); iter != castTerm->getIteratorEnd(); ++iter ) {
+            ExpansionProfile factorProfile = getExpansionProfile( *iter );
+            ExpansionProfile convolution;
+            for ( ExpansionProfile::iterator left = profile.begin(); left != profile.end(); ++left ) {
+                for ( ExpansionProfile::iterator right = factorProfile.begin(); right != factorProfile.end(); ++right ) {
+                    convolution[ make_pair( left->first.first + right->first.first, left->first.second + right->first.second ) ]
+                            += left->second * right->second;
+                }
+            }
+            profile.swap( convolution );
+        }
+    } else if ( term->getTermID() == TermTypes::TERM_A ) {
+        profile[ make_pair( 1, 0 ) ] = 1.0;
+    } else if ( term->getTermID() == TermTypes::TRACE ) {
+        profile[ make_pair( 0, static_pointer_cast<Trace>( term )->getArgumentLength() ) ] = 1.0;
+    } else {
+        profile[ make_pair( 0, 0 ) ] = 1.0;
+    }
+
+    return profile;
+}
+
+double estimateExpansionCost( const ExpansionProfile &profileA, const ExpansionProfile &profileB, int EXPANSION_ORDER_IN_A ) {
+    double cost = 0.0;
+
+    for ( ExpansionProfile::const_iterator a = profileA.begin(); a != profileA.end(); ++a ) {
+        for ( ExpansionProfile::const_iterator b = profileB.begin(); b != profileB.end(); ++b ) {
+            int orderInA = a->first.first + b->first.first;
+            double productCost = 1.0;
+
+            if ( orderInA <= EXPANSION_ORDER_IN_A and orderInA % 2 == 0 ) {
+                // Complete pairings of n MatrixS factors: (n - 1)!!
+                double pairings = 1.0;
+                for ( int n = ( a->first.second + b->first.second ) / 2 - 1; n > 1; n -= 2 ) pairings *= n;
+                productCost += pairings;
+            }
+
+            cost += a->second * b->second * productCost;
+        }
+    }
+
+    return cost;
+}
+
 Sum getDualExpansionByParts( SumPtr exprA, SumPtr exprB ) {
     exprA->reduceTree();
     exprB->reduceTree();
@@ -66,32 +232,14 @@ SymbolicTermPtr fullyEvaluatePartialExpression( SumPtr expr, int EXPANSION_ORDER
     if ( not SILENT ) cout << ">> >> Truncating odd orders in A of expansion..." << endl;
     expr = static_pointer_cast<Sum>( truncateOddOrders( expr ).copy() );
 
-    if ( not SILENT ) cout << ">> >> Indexing terms in expansion..." << endl;
-    indexExpression( expr );
-
-    if ( not SILENT ) cout << ">> >> Reducing expression tree..." << endl;
-    expr->reduceTree();
-
-    if ( not SILENT ) cout << ">> >> Computing path integral of expression..." << endl;
-    Sum pathIntegral = pathIntegrateExpression( expr );
-
-    if ( not SILENT ) cout << ">> >> Reducing expression tree..." << endl;
-    pathIntegral.reduceTree();
-
-    if ( not SILENT ) cout << ">> >> Performing trivial mathematical simplification..." << endl;
-    pathIntegral.simplify();
+    if ( not SILENT ) cout << ">> >> Bringing traces to canonical form..." << endl;
+    expr = static_pointer_cast<Sum>( canonicalizeTraces( *expr ).copy() );
 
-    if ( not SILENT ) cout << ">> >> Expanding integrated expression..." << endl;
-    pathIntegral = pathIntegral.getExpandedExpr();
+    if ( not SILENT ) cout << ">> >> Combining terms with like trace structures..." << endl;
+    expr = static_pointer_cast<Sum>( combineLikeTraceStructures( *expr ).copy() );
 
-    if ( not SILENT ) cout << ">> >> Reducing expression tree..." << endl;
-    pathIntegral.reduceTree();
-
-    if ( not SILENT ) cout << ">> >> Computing analytic Fourier transform of expression..." << endl;
-    pathIntegral = fourierTransformExpression( pathIntegral.copy() );
-
-    if ( not SILENT ) cout << ">> >> Reducing dummy indices of Fourier transformation..." << endl;
-    pathIntegral.reduceFourierSumIndices();
+    if ( not SILENT ) cout << ">> >> Path integrating and Fourier transforming trace structures..." << endl;
+    Sum pathIntegral = integrateTraceStructures( *expr );
 
     if ( not SILENT ) cout << ">> >> Combining like terms..." << endl;
     pathIntegral = combineLikeTerms( pathIntegral, POOL_SIZE );
@@ -207,89 +355,226 @@ SumPtr expandAndEvaluateExpressionByParts( SumPtr exprA, SumPtr exprB, int EXPAN
     return static_pointer_cast<Sum>( expandedExpression.copy() );
 }
 
-SumPtr multithreaded_expandAndEvaluateExpressionByParts( SumPtr exprA, SumPtr exprB, int EXPANSION_ORDER_IN_A, int POOL_SIZE, int NUM_THREADS ) {
+vector<SumPtr> splitSumIntoTiles( SumPtr expr, int tileSize ) {
+    vector<SumPtr> tiles;
+    int numTerms = expr->getNumberOfTerms();
+    if ( tileSize <= 0 or tileSize >= numTerms ) {
+        tiles.push_back( expr );
+        return tiles;
+    }
+
+    for ( int first = 0; first < numTerms; first += tileSize ) {
+        vector<SymbolicTermPtr>::iterator begin = expr->getIteratorBegin() + first;
+        tiles.push_back( SumPtr( new Sum( vector<SymbolicTermPtr>( begin, begin + min( tileSize, numTerms - first ) ) ) ) );
+    }
+
+    return tiles;
+}
+
+SumPtr multithreaded_expandAndEvaluateExpressionByParts( SumPtr exprA, SumPtr exprB, int EXPANSION_ORDER_IN_A, int POOL_SIZE, int NUM_THREADS, int TILE_SIZE ) {
     exprA->reduceTree();
     exprB->reduceTree();
 
     SymbolicTermPtr exprBCopy = exprB->copy();
+    vector<SumPtr> tilesB = splitSumIntoTiles( static_pointer_cast<Sum>( exprBCopy ), TILE_SIZE );
+    const int numTiles = exprA->getNumberOfTerms() * (int)tilesB.size();
 
-    SumPtr parallelParts[ exprA->getNumberOfTerms() ];
+    vector<SumPtr> parallelParts( numTiles );
 
     omp_set_num_threads( NUM_THREADS );
 
-    int numTermsComplete = 0;
+    int numTilesComplete = 0;
 
-#pragma omp parallel for shared( exprA, exprBCopy, parallelParts )
+    // Expand the tiles in order of decreasing estimated cost, so that the most expensive are started first.
+    vector<ExpansionProfile> tileProfiles;
+    for ( vector<SumPtr>::iterator tile = tilesB.begin(); tile != tilesB.end(); ++tile ) {
+        tileProfiles.push_back( getExpansionProfile( *tile ) );
+    }
+    vector< pair<double, int> > tilesByCost;
     for ( int term = 0; term < exprA->getNumberOfTerms(); term++ ) {
-        #pragma omp critical(printcout)
+        ExpansionProfile termProfile = getExpansionProfile( exprA->getTerm( term ) );
+        for ( int tile = 0; tile < (int)tilesB.size(); tile++ ) {
+            tilesByCost.push_back( make_pair( -estimateExpansionCost( termProfile, tileProfiles[ tile ], EXPANSION_ORDER_IN_A ),
+                                              term * (int)tilesB.size() + tile ) );
+        }
+    }
+    sort( tilesByCost.begin(), tilesByCost.end() );
+
+#pragma omp parallel for schedule( dynamic, 1 ) shared( exprA, tilesB, parallelParts, tilesByCost )
+    for ( int i = 0; i < numTiles; i++ ) {
+        int term = tilesByCost[ i ].second / (int)tilesB.size();
+        int tile = tilesByCost[ i ].second % (int)tilesB.size();
         {
+            lock_guard<std::mutex> guard( Amaunet::CONSOLE_MUTEX );
             cout << ">> Performing expression expansion and evaluation for term " << term << " of "
-                 << exprB->getNumberOfTerms() << " (" << numTermsComplete << " terms complete)..." << endl;
-            numTermsComplete++;
+                 << exprA->getNumberOfTerms() << ", tile " << tile + 1 << " of " << tilesB.size() << " ("
+                 << numTilesComplete << " of " << numTiles << " tiles complete)..." << endl;
+            numTilesComplete++;
         }
 
         Product nextExpansion;
         nextExpansion.addTerm( exprA->getTerm( term )->copy() );
-        nextExpansion.addTerm( exprBCopy );
+        nextExpansion.addTerm( tilesB[ tile ] );
 
         SumPtr expanded = static_pointer_cast<Sum>( nextExpansion.getExpandedExpr().copy() );
         expanded->reduceTree();
 
-        parallelParts[ term ] = fullyEvaluateExpressionByParts( expanded, EXPANSION_ORDER_IN_A, POOL_SIZE );
+        parallelParts[ tilesByCost[ i ].second ] = fullyEvaluateExpressionByParts( expanded, EXPANSION_ORDER_IN_A, POOL_SIZE );
         nextExpansion.clear();
     }
 
     cout << ">> Dual expansion complete. Performing reduction on parallel results..." << endl;
     Sum expandedExpression;
-    for ( int term = 0; term < exprA->getNumberOfTerms(); term++ ) {
-        expandedExpression.addTerm( parallelParts[ term ] );
+    for ( int part = 0; part < numTiles; part++ ) {
+        expandedExpression.addTerm( parallelParts[ part ] );
     }
 
     cout << ">> Reducing expression tree and combining like terms..." << endl;
     expandedExpression.reduceTree();
-    expandedExpression = combineLikeTerms( expandedExpression, POOL_SIZE );
+    expandedExpression = multithreaded_combineLikeTermsByDiagramID( expandedExpression, Amaunet::DIAGRAM_CATALOG, NUM_THREADS );
     return static_pointer_cast<Sum>( expandedExpression.copy() );
 }
 
-SumPtr multithreaded_getDualExpansionByParts( SumPtr exprA, SumPtr exprB, int NUM_THREADS ) {
+SumPtr multithreaded_getDualExpansionByParts( SumPtr exprA, SumPtr exprB, int NUM_THREADS, int TILE_SIZE ) {
     exprA->reduceTree();
     exprB->reduceTree();
 
     SymbolicTermPtr exprBCopy = exprB->copy();
+    vector<SumPtr> tilesB = splitSumIntoTiles( static_pointer_cast<Sum>( exprBCopy ), TILE_SIZE );
+    const int numTiles = exprA->getNumberOfTerms() * (int)tilesB.size();
 
-    SumPtr parallelParts[ exprA->getNumberOfTerms() ];
+    vector<SumPtr> parallelParts( numTiles );
 
     omp_set_num_threads( NUM_THREADS );
 
-    int numTermsComplete = 0;
+    int numTilesComplete = 0;
 
-#pragma omp parallel for shared( exprA, exprBCopy, parallelParts )
-    for ( int term = 0; term < exprA->getNumberOfTerms(); term++ ) {
-#pragma omp critical(printcout)
+#pragma omp parallel for schedule( dynamic ) shared( exprA, tilesB, parallelParts )
+    for ( int part = 0; part < numTiles; part++ ) {
+        int term = part / (int)tilesB.size();
         {
-            cout << ">> Performing expression expansion for term " << term << " of "
-                 << exprB->getNumberOfTerms() << " (" << numTermsComplete << " terms complete)..." << endl;
-            numTermsComplete++;
+            lock_guard<std::mutex> guard( Amaunet::CONSOLE_MUTEX );
+            cout << ">> Performing expression expansion for term " << term << " of " << exprA->getNumberOfTerms()
+                 << ", tile " << part % tilesB.size() + 1 << " of " << tilesB.size() << " (" << numTilesComplete
+                 << " of " << numTiles << " tiles complete)..." << endl;
+            numTilesComplete++;
         }
 
         Product nextExpansion;
         nextExpansion.addTerm( exprA->getTerm( term )->copy() );
-        nextExpansion.addTerm( exprBCopy );
+        nextExpansion.addTerm( tilesB[ part % tilesB.size() ] );
 
         SumPtr expanded = static_pointer_cast<Sum>( nextExpansion.getExpandedExpr().copy() );
         expanded->reduceTree();
 
-        parallelParts[ term ] = expanded;
+        parallelParts[ part ] = expanded;
         nextExpansion.clear();
     }
 
     cout << ">> Dual expansion complete. Performing reduction on parallel results..." << endl;
     Sum expandedExpression;
-    for ( int term = 0; term < exprA->getNumberOfTerms(); term++ ) {
-        expandedExpression.addTerm( parallelParts[ term ] );
+    for ( int part = 0; part < numTiles; part++ ) {
+        expandedExpression.addTerm( parallelParts[ part ] );
     }
 
     cout << ">> Reducing expression tree..." << endl;
     expandedExpression.reduceTree();
     return static_pointer_cast<Sum>( expandedExpression.copy() );
 }
+
+bool cmp_combined_term_key( const pair< pair<string, int>, CoefficientFraction > &a, const pair< pair<string, int>, CoefficientFraction > &b ) {
+    return a.first.first < b.first.first;
+}
+
+Sum multithreaded_combineLikeTermsByDiagramID( Sum &expr, DiagramCatalog &catalog, int NUM_THREADS ) {
+    expr.simplify();
+
+    int numTerms = expr.getNumberOfTerms();
+    vector<string> termKeys( numTerms );
+    vector<CoefficientFraction> termCoefficients( numTerms );
+    vector<Product> termFactors( numTerms );
+    vector<int> termDiagramIDs( numTerms );
+
+    omp_set_num_threads( NUM_THREADS );
+
+    // Decompose every term and register its diagram. Canonicalization is performed outside of the critical section of
+    // the catalog, so this is the bulk of the parallel work.
+#pragma omp parallel for shared( expr, catalog, termKeys, termCoefficients, termFactors, termDiagramIDs )
+    for ( int term = 0; term < numTerms; term++ ) {
+        SymbolicTermPtr nextTerm = expr.getTerm( term );
+        if ( nextTerm->getTermID() != TermTypes::PRODUCT ) {
+            // See combineLikeTerms(); the expression was mathematically simplified before entering the loop.
+            if ( nextTerm->to_string() != "0" and nextTerm->to_string() != "1"  and nextTerm->to_string() != "1 / 0 "  and nextTerm->to_string() != "1 / 1" ) {
+                {
+                    lock_guard<std::mutex> guard( Amaunet::CONSOLE_MUTEX );
+                    cout << "***WARNING: (WA4) A term other then a product, zero, or one was encountered when combining like terms. The solution may still be correct, but should be inspected." << endl;
+                }
+            }
+
+            nextTerm = Product( nextTerm ).copy();
+        }
+
+        vector<IndexContraction> contractions;
+        decomposeEvaluatedTerm( nextTerm, termKeys[ term ], termCoefficients[ term ], contractions, termFactors[ term ] );
+        termDiagramIDs[ term ] = catalog.registerDiagram( contractions );
+        termKeys[ term ] += "|" + getContractionVectorKey( catalog.getCanonicalForm( termDiagramIDs[ term ] ) );
+    }
+
+    // Partition terms into shards by key; each shard preserves the original order of its terms.
+    vector< vector<int> > shards( NUM_THREADS );
+    hash<string> keyHash;
+    for ( int term = 0; term < numTerms; term++ ) {
+        shards[ keyHash( termKeys[ term ] ) % NUM_THREADS ].push_back( term );
+    }
+
+    // Combine each shard; the first term with a given key is the representative of its combined term.
+    vector< vector< pair<string, int> > > shardRepresentatives( NUM_THREADS );
+    vector< vector<CoefficientFraction> > shardCoefficients( NUM_THREADS );
+
+#pragma omp parallel for shared( shards, shardRepresentatives, shardCoefficients, termKeys, termCoefficients )
+    for ( int shard = 0; shard < NUM_THREADS; shard++ ) {
+        map<string, int> keyIndices;
+
+        for ( vector<int>::iterator term = shards[ shard ].begin(); term != shards[ shard ].end(); ++term ) {
+            map<string, int>::iterator entry = keyIndices.find( termKeys[ *term ] );
+            if ( entry != keyIndices.end() ) {
+                shardCoefficients[ shard ][ entry->second ] += termCoefficients[ *term ];
+            } else {
+                keyIndices[ termKeys[ *term ] ] = (int)shardRepresentatives[ shard ].size();
+                shardRepresentatives[ shard ].push_back( pair<string, int>( termKeys[ *term ], *term ) );
+                shardCoefficients[ shard ].push_back( termCoefficients[ *term ] );
+            }
+        }
+    }
+
+    // Concatenate the shards and order the combined terms by key.
+    vector< pair< pair<string, int>, CoefficientFraction > > combinedTerms;
+    for ( int shard = 0; shard < NUM_THREADS; shard++ ) {
+        for ( int i = 0; i < shardRepresentatives[ shard ].size(); i++ ) {
+            if ( shardCoefficients[ shard ][ i ].eval() == 0 ) continue;
+            combinedTerms.push_back( pair< pair<string, int>, CoefficientFraction >( shardRepresentatives[ shard ][ i ], shardCoefficients[ shard ][ i ] ) );
+        }
+    }
+
+    sort( combinedTerms.begin(), combinedTerms.end(), cmp_combined_term_key );
+
+    Sum reducedSum;
+    for ( int i = 0; i < combinedTerms.size(); i++ ) {
+        int term = combinedTerms[ i ].first.second;
+
+        Product combinedTerm;
+        for ( vector<SymbolicTermPtr>::iterator factor = termFactors[ term ].getIteratorBegin(); factor != termFactors[ term ].getIteratorEnd(); ++factor ) {
+            combinedTerm.addTerm( (*factor)->copy() );
+        }
+
+        vector<IndexContraction> canonicalForm = catalog.getCanonicalForm( termDiagramIDs[ term ] );
+        if ( canonicalForm.size() > 0 ) {
+            combinedTerm.addTerm( FourierSumPtr( new FourierSum( canonicalForm, (int)canonicalForm.size() ) ) );
+        }
+
+        combinedTerm.addTerm( combinedTerms[ i ].second.copy() );
+        reducedSum.addTerm( combinedTerm.copy() );
+    }
+
+    return reducedSum;
+}
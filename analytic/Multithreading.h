@@ -19,8 +19,117 @@
 #ifndef AMAUNETC_MULTITHREADING_H
 #define AMAUNETC_MULTITHREADING_H
 
+#include <deque>
+#include <map>
+#include <utility>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "PTSymbolicObjects.h"
 
+/**
+ * Fixed pool of worker threads which run tasks of widely varying cost without any barrier between them. Each worker
+ * owns a double-ended queue of tasks: it runs the tasks of its own queue in the order they were queued, and when its
+ * queue is empty it steals the oldest queued task from the queue of another worker, so that callers which submit tasks
+ * in order of decreasing cost have the most expensive remaining task stolen first. Tasks submitted from outside
+ * of the pool are dealt to the queues in turn, so they are started roughly in the order of submission; a task submitted
+ * by a running task is queued by the worker running it. Workers are std::threads rather than OpenMP threads, so shared
+ * state reached from tasks must be guarded by a std::mutex, not by an OpenMP critical section or lock.
+ */
+class WorkStealingPool {
+
+public:
+
+    /**
+     * Constructor. The worker threads are started immediately.
+     * @param numWorkers The number of worker threads.
+     */
+    WorkStealingPool( int numWorkers );
+
+    /**
+     * Destructor. Waits for all tasks to complete and stops the workers.
+     */
+    ~WorkStealingPool();
+
+    /**
+     * Queues a task. Thread-safe.
+     */
+    void submit( std::function<void()> task );
+
+    /**
+     * Waits until every submitted task, including any task submitted by another task, has completed.
+     */
+    void wait();
+
+private:
+
+    WorkStealingPool( const WorkStealingPool &other );
+
+    WorkStealingPool& operator=( const WorkStealingPool &rhs );
+
+    struct WorkerQueue {
+
+        std::mutex mutex;
+
+        std::deque< std::function<void()> > tasks;
+
+    };
+
+    void workerLoop( int worker );
+
+    /**
+     * Takes the oldest task of the queue of a worker, or else the newest task of any other queue.
+     * @return True if a task was taken.
+     */
+    bool takeTask( int worker, std::function<void()> &task );
+
+    std::vector< std::unique_ptr<WorkerQueue> > queues;
+
+    std::vector<std::thread> workers;
+
+    /**
+     * Number of tasks queued but not yet taken, and number of tasks submitted but not yet completed.
+     */
+    unsigned long long queuedTasks;
+
+    unsigned long long pendingTasks;
+
+    unsigned int nextQueue;
+
+    bool stopping;
+
+    std::mutex mutex;
+
+    std::condition_variable taskQueued;
+
+    std::condition_variable tasksCompleted;
+
+};
+
+/*
+ * Number of products of a term, once all of its Sums are distributed, by order in A and total length of the arguments
+ * of their traces.
+ */
+typedef std::map< std::pair<int, int>, double > ExpansionProfile;
+
+/**
+ * Gets the expansion profile of a term without expanding it. The counts of the factors of a Product are convolved and
+ * the counts of the terms of a Sum are added; each TermA adds one to the order in A, and each Trace adds the length of
+ * its argument.
+ */
+ExpansionProfile getExpansionProfile( SymbolicTermPtr term );
+
+/**
+ * Estimates the relative cost of expanding the Product of two expressions and evaluating the expansion with
+ * fullyEvaluateExpressionByParts(), from their expansion profiles. Every expanded product costs one unit. A product of
+ * an even order in A no greater than EXPANSION_ORDER_IN_A, which survives truncation and is path integrated, also
+ * costs the number of complete pairings of its MatrixS factors, one for every second factor of its traces.
+ */
+double estimateExpansionCost( const ExpansionProfile &profileA, const ExpansionProfile &profileB, int EXPANSION_ORDER_IN_A );
+
 Sum getDualExpansionByParts( SumPtr exprA, SumPtr exprB );
 
 SymbolicTermPtr fullyEvaluatePartialExpression( SumPtr expr, int EXPANSION_ORDER_IN_A, int POOL_SIZE );
@@ -31,8 +140,34 @@ Sum makeMultipleProducts( Product &inputProduct );
 
 SumPtr expandAndEvaluateExpressionByParts( SumPtr exprA, SumPtr exprB, int EXPANSION_ORDER_IN_A, int POOL_SIZE );
 
-SumPtr multithreaded_expandAndEvaluateExpressionByParts( SumPtr exprA, SumPtr exprB, int EXPANSION_ORDER_IN_A, int POOL_SIZE, int NUM_THREADS );
+/**
+ * Splits the terms of a Sum into consecutive tiles of tileSize terms, the last of which may be shorter. Each tile is a
+ * Sum which shares the terms of expr. A tileSize of zero or less gives a single tile of all terms.
+ */
+std::vector<SumPtr> splitSumIntoTiles( SumPtr expr, int tileSize );
 
-SumPtr multithreaded_getDualExpansionByParts( SumPtr exprA, SumPtr exprB, int NUM_THREADS );
+/**
+ * Expands and evaluates the product of two expressions in parallel over tiles of the product space: each task is the
+ * product of one term of exprA with a tile of TILE_SIZE terms of exprB, and tasks are run in order of decreasing
+ * estimated cost.
+ */
+SumPtr multithreaded_expandAndEvaluateExpressionByParts( SumPtr exprA, SumPtr exprB, int EXPANSION_ORDER_IN_A, int POOL_SIZE, int NUM_THREADS, int TILE_SIZE );
+
+/**
+ * Expands the product of two expressions in parallel over tiles of one term of exprA and TILE_SIZE terms of exprB.
+ */
+SumPtr multithreaded_getDualExpansionByParts( SumPtr exprA, SumPtr exprB, int NUM_THREADS, int TILE_SIZE );
+
+/**
+ * Parallel equivalent of combineLikeTermsByDiagramID(). Terms are decomposed and their diagrams registered with the
+ * catalog concurrently, then partitioned into one shard per thread by a hash of their (order in A, flavor label order,
+ * canonical diagram) key, such that all like terms fall in the same shard. Shards are combined concurrently, and the
+ * combined terms are concatenated in order of their keys, so the result does not depend on the number of threads.
+ * @param expr A Sum of Products which has been Fourier transformed and whose dummy indices have been reduced.
+ * @param catalog The catalog with which diagrams are registered.
+ * @param NUM_THREADS The number of shards and threads.
+ * @return The Sum of Products with like terms combined.
+ */
+Sum multithreaded_combineLikeTermsByDiagramID( Sum &expr, DiagramCatalog &catalog, int NUM_THREADS );
 
 #endif //AMAUNETC_MULTITHREADING_H
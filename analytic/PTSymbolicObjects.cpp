@@ -43,18 +43,18 @@ class FourierSum;
 class IndexContraction;
 class DeltaContractionSet;
 
-BOOST_CLASS_EXPORT( Sum );
-BOOST_CLASS_EXPORT( Product );
-BOOST_CLASS_EXPORT( Trace );
-BOOST_CLASS_EXPORT( SymbolicTerm );
-BOOST_CLASS_EXPORT( MatrixK );
-BOOST_CLASS_EXPORT( MatrixS );
-BOOST_CLASS_EXPORT( TermA );
-BOOST_CLASS_EXPORT( TermE );
-BOOST_CLASS_EXPORT( CoefficientFloat );
-BOOST_CLASS_EXPORT( CoefficientFraction );
-BOOST_CLASS_EXPORT( Delta );
-BOOST_CLASS_EXPORT( FourierSum );
+BOOST_CLASS_EXPORT_IMPLEMENT( Sum );
+BOOST_CLASS_EXPORT_IMPLEMENT( Product );
+BOOST_CLASS_EXPORT_IMPLEMENT( Trace );
+BOOST_CLASS_EXPORT_IMPLEMENT( SymbolicTerm );
+BOOST_CLASS_EXPORT_IMPLEMENT( MatrixK );
+BOOST_CLASS_EXPORT_IMPLEMENT( MatrixS );
+BOOST_CLASS_EXPORT_IMPLEMENT( TermA );
+BOOST_CLASS_EXPORT_IMPLEMENT( TermE );
+BOOST_CLASS_EXPORT_IMPLEMENT( CoefficientFloat );
+BOOST_CLASS_EXPORT_IMPLEMENT( CoefficientFraction );
+BOOST_CLASS_EXPORT_IMPLEMENT( Delta );
+BOOST_CLASS_EXPORT_IMPLEMENT( FourierSum );
 BOOST_CLASS_EXPORT( IndexContraction );
 
 
@@ -96,9 +96,7 @@ bool SymbolicTerm::operator==( const SymbolicTerm &other ) const {
 }
 
 ostream& operator<<( ostream& os, const SymbolicTerm &st ) {
-	stringstream ss;
-	ss << st.to_string();
-	os << ss.str();
+	st.print( os );
 	return os;
 }
 
@@ -108,6 +106,10 @@ const string SymbolicTerm::to_string() const {
 	return "<invalid_term>";
 }
 
+void SymbolicTerm::print( ostream &os ) const {
+	os << to_string();
+}
+
 string SymbolicTerm::getFlavorLabel() {
 	return flavorLabel;
 }
@@ -201,6 +203,10 @@ void MatrixK::fourierTransform() {
 	isFourierTransformed = true;
 }
 
+bool MatrixK::isTransformed() const {
+	return isFourierTransformed;
+}
+
 /*
  * MatrixS
  */
@@ -254,9 +260,12 @@ TermE::TermE() : order( 1 ) {
 	termID = TermTypes::TERM_E;
 }
 
-TermE::TermE( int thisOrder ) : order( thisOrder ) { }
+TermE::TermE( int thisOrder ) : order( thisOrder ) {
+	termID = TermTypes::TERM_E;
+}
 
 TermE::TermE( int thisOrder, string thisFlavorLabel ) : order( thisOrder ) {
+	termID = TermTypes::TERM_E;
 	flavorLabel = thisFlavorLabel;
 }
 
@@ -430,6 +439,14 @@ double CoefficientFraction::eval() const {
 	return num / den;
 }
 
+double CoefficientFraction::getNumerator() const {
+	return num;
+}
+
+double CoefficientFraction::getDenominator() const {
+	return den;
+}
+
 
 void CoefficientFraction::reduce() {
 	if ( abs( floor( num ) - num ) == 0 and abs( floor( den ) - den ) == 0 ) {
@@ -491,18 +508,24 @@ Sum& Sum::operator=( const Sum &rhs ) {
 
 const std::string Sum::to_string() const {
 	stringstream ss;
-	bool SPLIT_SUMS_BY_LINE = false;
-	unsigned int counter = 0;
-	for ( vector<SymbolicTermPtr>::const_iterator iter = terms.begin(); iter != terms.end(); ++iter ) {
-		ss << (*iter)->to_string();
-		if ( counter != (terms.size() - 1) ) {
-			if ( SPLIT_SUMS_BY_LINE ) ss << "\n\n";
-			ss << " + ";
-		}
-		counter++;
+	print( ss );
+	return ss.str();
+}
+
+void Sum::print( ostream &os ) const {
+	printTerms( os, 0, terms.size() );
+}
+
+size_t Sum::printTerms( ostream &os, size_t first, size_t count ) const {
+	if ( first >= terms.size() ) return terms.size();
+
+	size_t last = first + min( count, terms.size() - first );
+	for ( size_t n = first; n < last; n++ ) {
+		if ( n > 0 ) os << " + ";
+		terms[ n ]->print( os );
 	}
 
-	return ss.str();
+	return last;
 }
 
 SymbolicTermPtr Sum::copy() {
@@ -669,16 +692,17 @@ Product& Product::operator=( const Product &rhs ) {
 
 const string Product::to_string() const {
 	stringstream ss;
+	print( ss );
+	return ss.str();
+}
 
-	ss << " ";
+void Product::print( ostream &os ) const {
+	os << " ";
 	for ( vector<SymbolicTermPtr>::const_iterator iter = terms.begin(); iter != terms.end(); ++iter ) {
-		ss << "{" << (*iter)->to_string() << "}";
-		if ( iter != terms.end()-- ) {
-			ss << " ";
-		}
+		os << "{";
+		(*iter)->print( os );
+		os << "} ";
 	}
-
-	return ss.str();
 }
 
 SymbolicTermPtr Product::copy() {
@@ -957,10 +981,16 @@ Trace::~Trace() {
 
 const string Trace::to_string() const {
 	stringstream ss;
-	ss << "Trace[ " << expr->to_string() << " ]";
+	print( ss );
 	return ss.str();
 }
 
+void Trace::print( ostream &os ) const {
+	os << "Trace[ ";
+	expr->print( os );
+	os << " ]";
+}
+
 SymbolicTermPtr Trace::copy() {
 	return SymbolicTermPtr( new Trace( expr->copy() ) );
 }
@@ -1025,6 +1055,76 @@ bool Trace::operator>( const Trace &other ) const {
 	return thisNumTerms > otherNumTerms;
 }
 
+/**
+ * Gets the structure key of a single factor of the argument of a trace. See Trace::getStructureKey().
+ */
+string getFactorStructureKey( const SymbolicTermPtr &factor ) {
+	stringstream ss;
+	if ( factor->getTermID() == TermTypes::MATRIX_K or factor->getTermID() == TermTypes::MATRIX_S ) {
+		ss << factor->getTermID() << factor->getFlavorLabel() << ".";
+	} else {
+		// Factors other than matrices are not expected in a trace, but describe them fully so that they are never
+		// mistakenly identified with one another.
+		ss << factor->getTermID() << "{" << factor->to_string() << "}.";
+	}
+
+	return ss.str();
+}
+
+const string Trace::getStructureKey() const {
+	if ( expr->getTermID() != TermTypes::PRODUCT ) return "";
+
+	ProductPtr castProduct = static_pointer_cast<Product>( expr );
+	stringstream ss;
+	for ( vector<SymbolicTermPtr>::iterator factor = castProduct->getIteratorBegin(); factor != castProduct->getIteratorEnd(); ++factor ) {
+		ss << getFactorStructureKey( *factor );
+	}
+
+	return ss.str();
+}
+
+void Trace::rotateToCanonicalForm() {
+	if ( expr->getTermID() != TermTypes::PRODUCT ) return;
+
+	ProductPtr castProduct = static_pointer_cast<Product>( expr );
+	int n = castProduct->getNumberOfTerms();
+	if ( n < 2 ) return;
+
+	vector<string> factorKeys;
+	for ( vector<SymbolicTermPtr>::iterator factor = castProduct->getIteratorBegin(); factor != castProduct->getIteratorEnd(); ++factor ) {
+		factorKeys.push_back( getFactorStructureKey( *factor ) );
+	}
+
+	// Find the rotation whose sequence of factor keys is lexicographically minimal. Arguments are short, so each
+	// rotation is simply compared against the best found so far.
+	int minimalRotation = 0;
+	for ( int r = 1; r < n; r++ ) {
+		for ( int i = 0; i < n; i++ ) {
+			const string &candidateKey = factorKeys[ ( r + i ) % n ];
+			const string &minimalKey = factorKeys[ ( minimalRotation + i ) % n ];
+			if ( candidateKey != minimalKey ) {
+				if ( candidateKey < minimalKey ) minimalRotation = r;
+				break;
+			}
+		}
+	}
+
+	if ( minimalRotation == 0 ) return;
+
+	Product rotatedProduct;
+	for ( int i = 0; i < n; i++ ) {
+		rotatedProduct.addTerm( *( castProduct->getIteratorBegin() + ( minimalRotation + i ) % n ) );
+	}
+
+	expr = rotatedProduct.copy();
+}
+
+int Trace::getArgumentLength() const {
+	if ( expr->getTermID() != TermTypes::PRODUCT ) return 0;
+
+	return static_pointer_cast<Product>( expr )->getNumberOfTerms();
+}
+
 /*
  * Delta
  */
@@ -1059,7 +1159,7 @@ const std::string Delta::to_string() const {
 }
 
 SymbolicTermPtr Delta::copy() {
-	return SymbolicTermPtr( new Delta( indices[0], indices[1] ) );
+	return SymbolicTermPtr( new Delta( indices[0], indices[1], isBar ) );
 }
 
 bool Delta::operator==( const Delta &other ) const {
@@ -1363,13 +1463,13 @@ bool areTermsCommon( SymbolicTermPtr termA, SymbolicTermPtr termB ) {
 	FourierSumPtr castTermAFourierSum = static_pointer_cast<FourierSum>( termAFourierSum );
 	FourierSumPtr castTermBFourierSum = static_pointer_cast<FourierSum>( termBFourierSum );
 
-	if ( not( *castTermAFourierSum == *castTermBFourierSum  or areDiagramsSimilar( castTermAFourierSum->getContractionVector(), castTermBFourierSum->getContractionVector() ) ) ) {
-        // Explicitly wait to verify diagrams using Feynman diagram data structures until we've exhausted simpler methods,
-        // since that is more expensive. The conditional would short-circuit if we included this above, but this is to
-        // be clear here.
-        if ( not compareContractionSetsViaDiagrams( DeltaContractionSet( castTermAFourierSum->getContractionVector() ),
-		                                          DeltaContractionSet( castTermBFourierSum->getContractionVector() ) ) ) return false;
-    }
+	if ( not( *castTermAFourierSum == *castTermBFourierSum ) ) {
+		// Diagrams are compared through their IDs in the shared diagram catalog, which memoizes the canonical form of
+		// every contraction vector it has seen; this is equivalent to compareContractionSetsViaDiagrams(), but the
+		// expensive comparison is performed at most once per distinct contraction vector.
+		if ( Amaunet::DIAGRAM_CATALOG.registerDiagram( castTermAFourierSum->getContractionVector() ) !=
+		     Amaunet::DIAGRAM_CATALOG.registerDiagram( castTermBFourierSum->getContractionVector() ) ) return false;
+	}
 
 	return true;
 }
@@ -1683,6 +1783,96 @@ Sum combineLikeTerms( Sum &expr, int groupSize ) {
 	}
 }
 
+void decomposeEvaluatedTerm( SymbolicTermPtr term, string &groupKey, CoefficientFraction &coefficient, vector<IndexContraction> &contractions, Product &otherFactors ) {
+	ProductPtr castTerm = static_pointer_cast<Product>( term );
+	coefficient = CoefficientFraction( 1, 1 );
+	contractions.clear();
+	otherFactors.clear();
+
+	for ( vector<SymbolicTermPtr>::iterator factor = castTerm->getIteratorBegin(); factor != castTerm->getIteratorEnd(); ++factor ) {
+		if ( (*factor)->getTermID() == TermTypes::COEFFICIENT_FLOAT ) {
+			CoefficientFloatPtr castFactor = static_pointer_cast<CoefficientFloat>( *factor );
+			coefficient *= CoefficientFraction( castFactor->eval(), 1 );
+		} else if ( (*factor)->getTermID() == TermTypes::COEFFICIENT_FRACTION ) {
+			CoefficientFractionPtr castFactor = static_pointer_cast<CoefficientFraction>( *factor );
+			coefficient *= (*castFactor);
+		} else if ( (*factor)->getTermID() == TermTypes::FOURIER_SUM ) {
+			contractions = static_pointer_cast<FourierSum>( *factor )->getContractionVector();
+		} else {
+			otherFactors.addTerm( (*factor)->copy() );
+		}
+	}
+
+	stringstream ss;
+	ss << "A" << getProductAOrder( term ) << "|" << getFlavorLabelOrder( term );
+	groupKey = ss.str();
+}
+
+Sum combineLikeTermsByDiagramID( Sum &expr, DiagramCatalog &catalog ) {
+	Sum reducedSum;
+
+	expr.simplify();
+
+	// Each (order in A, flavor label order) group is stored once, in order of first appearance, along with a dense
+	// vector of its running coefficients indexed by diagram ID.
+	map<string, int> groupIndices;
+	vector<Product> groupRepresentatives;
+	vector< vector<CoefficientFraction> > groupCoefficients;
+
+	for ( vector<SymbolicTermPtr>::iterator term = expr.getIteratorBegin(); term != expr.getIteratorEnd(); ++term ) {
+		if ( (*term)->getTermID() != TermTypes::PRODUCT ) {
+			// See combineLikeTerms(); the expression was mathematically simplified before entering the loop.
+			if ( (*term)->to_string() != "0" and (*term)->to_string() != "1"  and (*term)->to_string() != "1 / 0 "  and (*term)->to_string() != "1 / 1" ) {
+				cout << "***WARNING: (WA3) A term other then a product, zero, or one was encountered when combining like terms. The solution may still be correct, but should be inspected." << endl;
+			}
+
+			(*term) = Product( *term ).copy();
+		}
+
+		string groupKey;
+		CoefficientFraction termCoefficient;
+		vector<IndexContraction> contractions;
+		Product otherFactors;
+		decomposeEvaluatedTerm( *term, groupKey, termCoefficient, contractions, otherFactors );
+
+		int diagramID = catalog.registerDiagram( contractions );
+
+		if ( groupIndices.count( groupKey ) == 0 ) {
+			groupIndices[ groupKey ] = (int)groupRepresentatives.size();
+			groupRepresentatives.push_back( otherFactors );
+			groupCoefficients.push_back( vector<CoefficientFraction>() );
+		}
+
+		vector<CoefficientFraction> &coefficients = groupCoefficients[ groupIndices[ groupKey ] ];
+		if ( diagramID >= coefficients.size() ) {
+			coefficients.resize( diagramID + 1, CoefficientFraction( 0, 1 ) );
+		}
+
+		coefficients[ diagramID ] += termCoefficient;
+	}
+
+	for ( int i = 0; i < groupRepresentatives.size(); i++ ) {
+		for ( int diagramID = 0; diagramID < groupCoefficients[ i ].size(); diagramID++ ) {
+			if ( groupCoefficients[ i ][ diagramID ].eval() == 0 ) continue;
+
+			Product combinedTerm;
+			for ( vector<SymbolicTermPtr>::iterator factor = groupRepresentatives[ i ].getIteratorBegin(); factor != groupRepresentatives[ i ].getIteratorEnd(); ++factor ) {
+				combinedTerm.addTerm( (*factor)->copy() );
+			}
+
+			vector<IndexContraction> canonicalForm = catalog.getCanonicalForm( diagramID );
+			if ( canonicalForm.size() > 0 ) {
+				combinedTerm.addTerm( FourierSumPtr( new FourierSum( canonicalForm, (int)canonicalForm.size() ) ) );
+			}
+
+			combinedTerm.addTerm( groupCoefficients[ i ][ diagramID ].copy() );
+			reducedSum.addTerm( combinedTerm.copy() );
+		}
+	}
+
+	return reducedSum;
+}
+
 Sum generateExponentialSeries( int order, Product x ) {
 	Sum series;
 
@@ -1780,6 +1970,145 @@ Sum sortTracesByOrder( Sum &expr ) {
 	return sortedExpression;
 }
 
+bool cmp_trace_structure( const TracePtr &a, const TracePtr &b ) {
+	if ( a->getArgumentLength() != b->getArgumentLength() ) return a->getArgumentLength() < b->getArgumentLength();
+
+	return a->getStructureKey() < b->getStructureKey();
+}
+
+bool decomposeTraceProduct( SymbolicTermPtr prod, int &orderInA, CoefficientFraction &coefficient, vector<TracePtr> &traces ) {
+	orderInA = 0;
+	coefficient = CoefficientFraction( 1, 1 );
+	traces.clear();
+
+	if ( prod->getTermID() != TermTypes::PRODUCT ) return false;
+
+	ProductPtr castTerm = static_pointer_cast<Product>( prod );
+	for ( vector<SymbolicTermPtr>::iterator factor = castTerm->getIteratorBegin(); factor != castTerm->getIteratorEnd(); ++factor ) {
+		if ( (*factor)->getTermID() == TermTypes::TERM_A ) {
+			orderInA++;
+		} else if ( (*factor)->getTermID() == TermTypes::COEFFICIENT_FRACTION ) {
+			coefficient *= *( static_pointer_cast<CoefficientFraction>( *factor ) );
+		} else if ( (*factor)->getTermID() == TermTypes::COEFFICIENT_FLOAT ) {
+			coefficient = coefficient * ( *( static_pointer_cast<CoefficientFloat>( *factor ) ) );
+		} else if ( (*factor)->getTermID() == TermTypes::TRACE and static_pointer_cast<Trace>( *factor )->getArgumentLength() > 0 ) {
+			traces.push_back( static_pointer_cast<Trace>( *factor ) );
+		} else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+string getTraceStructureKey( vector<TracePtr> &traces ) {
+	sort( traces.begin(), traces.end(), cmp_trace_structure );
+
+	stringstream structureKey;
+	for ( vector<TracePtr>::iterator tr = traces.begin(); tr != traces.end(); ++tr ) {
+		structureKey << (*tr)->getStructureKey() << "|";
+	}
+
+	return structureKey.str();
+}
+
+Sum canonicalizeTraces( Sum &expr ) {
+	Sum canonicalExpression;
+
+	for ( vector<SymbolicTermPtr>::iterator term = expr.getIteratorBegin(); term != expr.getIteratorEnd(); ++term ) {
+		if ( (*term)->getTermID() == TermTypes::PRODUCT ) {
+			ProductPtr castProduct = static_pointer_cast<Product>( *term );
+
+			vector<TracePtr> traces;
+			Product canonicalProduct;
+			for ( vector<SymbolicTermPtr>::iterator factor = castProduct->getIteratorBegin(); factor != castProduct->getIteratorEnd(); ++factor ) {
+				if ( (*factor)->getTermID() == TermTypes::TRACE ) {
+					TracePtr castTrace = static_pointer_cast<Trace>( (*factor)->copy() );
+					castTrace->rotateToCanonicalForm();
+					traces.push_back( castTrace );
+				} else {
+					canonicalProduct.addTerm( (*factor)->copy() );
+				}
+			}
+
+			stable_sort( traces.begin(), traces.end(), cmp_trace_structure );
+
+			for ( vector<TracePtr>::iterator tr = traces.begin(); tr != traces.end(); ++tr ) {
+				canonicalProduct.addTerm( *tr );
+			}
+
+			canonicalExpression.addTerm( canonicalProduct.copy() );
+
+		} else {
+			canonicalExpression.addTerm( (*term)->copy() );
+		}
+	}
+
+	return canonicalExpression;
+}
+
+Sum combineLikeTraceStructures( Sum &expr ) {
+	Sum combinedExpression;
+
+	// Each distinct structure is stored once, in order of first appearance, along with its running coefficient.
+	map<string, int> structureIndices;
+	vector<Product> structureRepresentatives;
+	vector<CoefficientFraction> structureCoefficients;
+
+	for ( vector<SymbolicTermPtr>::iterator term = expr.getIteratorBegin(); term != expr.getIteratorEnd(); ++term ) {
+		CoefficientFraction termCoefficient;
+		vector<TracePtr> traces;
+		int orderInA;
+
+		// Terms which are not of the expected form are left untouched.
+		if ( not decomposeTraceProduct( *term, orderInA, termCoefficient, traces ) ) {
+			combinedExpression.addTerm( (*term)->copy() );
+			continue;
+		}
+
+		stringstream structureKey;
+		structureKey << "A" << orderInA << "|" << getTraceStructureKey( traces );
+
+		if ( structureIndices.count( structureKey.str() ) == 1 ) {
+			structureCoefficients[ structureIndices[ structureKey.str() ] ] += termCoefficient;
+		} else {
+			Product representative;
+			for ( int i = 0; i < orderInA; i++ ) {
+				representative.addTerm( TermAPtr( new TermA() ) );
+			}
+
+			for ( vector<TracePtr>::iterator tr = traces.begin(); tr != traces.end(); ++tr ) {
+				representative.addTerm( (*tr)->copy() );
+			}
+
+			structureIndices[ structureKey.str() ] = (int)structureRepresentatives.size();
+			structureRepresentatives.push_back( representative );
+			structureCoefficients.push_back( termCoefficient );
+		}
+	}
+
+	for ( int i = 0; i < structureRepresentatives.size(); i++ ) {
+		// Drop structures whose contributions have cancelled entirely.
+		if ( structureCoefficients[ i ].eval() == 0 ) continue;
+
+		Product combinedTerm;
+		vector<SymbolicTermPtr>::iterator factor = structureRepresentatives[ i ].getIteratorBegin();
+		for ( ; factor != structureRepresentatives[ i ].getIteratorEnd() and (*factor)->getTermID() == TermTypes::TERM_A; ++factor ) {
+			combinedTerm.addTerm( (*factor)->copy() );
+		}
+
+		combinedTerm.addTerm( structureCoefficients[ i ].copy() );
+
+		for ( ; factor != structureRepresentatives[ i ].getIteratorEnd(); ++factor ) {
+			combinedTerm.addTerm( (*factor)->copy() );
+		}
+
+		combinedExpression.addTerm( combinedTerm.copy() );
+	}
+
+	return combinedExpression;
+}
+
 /*
  * ***********************************************************************
  * INPUT REDIRECTION OPERATOR OVERLOADS
@@ -28,6 +28,7 @@
 #include <boost/serialization/string.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/shared_ptr.hpp>
+#include <boost/serialization/export.hpp>
 
 /*
  * ***********************************************************************
@@ -50,6 +51,7 @@ class Delta;
 class FourierSum;
 class IndexContraction;
 class DeltaContractionSet;
+class DiagramCatalog;
 
 bool unpackTrivialExpression( std::shared_ptr<SymbolicTerm> & );
 
@@ -178,6 +180,14 @@ public:
 	 */
 	virtual const std::string to_string() const;
 
+	/**
+	 * Writes the pretty-printed representation of the expression, as returned by to_string(), directly to a stream.
+	 * Composite expressions override this method to write each of their subexpressions in turn, so that printing an
+	 * expression never holds more than the representation of a single leaf term in memory.
+	 * @param os The stream to write to.
+	 */
+	virtual void print( std::ostream &os ) const;
+
 	/**
 	 * Gets the particle flavor label assigned to this expression. Flavor labels are not appropriate for all types of
 	 * expressions, and is only used in cases where matrices are dependent on the particle species it refers to.
@@ -353,6 +363,12 @@ public:
 	 */
 	void fourierTransform();
 
+	/**
+	 * Determines if this instance of MatrixK has been marked as Fourier transformed by fourierTransform().
+	 * @return True if this instance is Fourier transformed, false otherwise.
+	 */
+	bool isTransformed() const;
+
 private:
 
 	/**
@@ -654,6 +670,16 @@ public:
 	 */
 	double eval() const;
 
+	/**
+	 * Gets the numerator of this fraction.
+	 */
+	double getNumerator() const;
+
+	/**
+	 * Gets the denominator of this fraction.
+	 */
+	double getDenominator() const;
+
 	/**
 	 * Reduces this fraction to lowest terms by the greatest common divisor.
 	 */
@@ -849,6 +875,23 @@ public:
 	 */
 	const std::string to_string() const;
 
+	/**
+	 * Writes the pretty-printed representation of this Sum to a stream, one term at a time.
+	 * @param os The stream to write to.
+	 */
+	void print( std::ostream &os ) const;
+
+	/**
+	 * Writes a page of consecutive terms of this Sum to a stream, so that very large Sums may be output in chunks.
+	 * Printing all pages in order writes exactly the output of print().
+	 * @param os The stream to write to.
+	 * @param first Index of the first term of the page.
+	 * @param count Maximum number of terms of the page.
+	 * @return The index of the first term following the page, which is the number of terms once the last page has been
+	 * written.
+	 */
+	size_t printTerms( std::ostream &os, size_t first, size_t count ) const;
+
 	/**
 	 * Generates a deep copy of this instance on the heap and returns a smart shared pointer to the copy.
 	 * @return A smart shared pointer to the generated copy.
@@ -998,6 +1041,12 @@ public:
 	 */
 	const std::string to_string() const;
 
+	/**
+	 * Writes the pretty-printed representation of this Product to a stream, one factor at a time.
+	 * @param os The stream to write to.
+	 */
+	void print( std::ostream &os ) const;
+
 	/**
 	 * Generates a deep copy of this instance on the heap and returns a smart shared pointer to the copy.
 	 * @return A smart shared pointer to the generated copy.
@@ -1150,6 +1199,12 @@ public:
 	 */
 	const std::string to_string() const;
 
+	/**
+	 * Writes the pretty-printed representation of this Trace to a stream.
+	 * @param os The stream to write to.
+	 */
+	void print( std::ostream &os ) const;
+
 	/**
 	 * Generates a deep copy of this instance on the heap and returns a smart shared pointer to the copy.
 	 * @return A smart shared pointer to the generated copy.
@@ -1195,6 +1250,29 @@ public:
 	 */
 	bool operator>( const Trace &other ) const;
 
+	/**
+	 * Gets a string key which describes the structure of the argument of this trace. The key lists the term type and
+	 * flavor label of each factor of the argument in order, such that two traces with equal keys are symbolically
+	 * identical prior to indexing. The argument must be a Product; an empty string is returned otherwise.
+	 * @return The structure key of this trace, or an empty string if the argument is not a Product.
+	 */
+	const std::string getStructureKey() const;
+
+	/**
+	 * Gets the number of factors in the argument of this trace. The argument must be a Product, otherwise zero is
+	 * returned.
+	 * @return The number of factors in the argument of this trace.
+	 */
+	int getArgumentLength() const;
+
+	/**
+	 * Cyclically permutes the argument of this trace such that the sequence of structure keys of its factors is
+	 * lexicographically minimal. By the cyclic property of the trace, the value of the trace is unchanged, but any two
+	 * traces which are identical up to rotation will have the same structure key afterwards. The argument must be a
+	 * Product; otherwise, this trace is left unmodified.
+	 */
+	void rotateToCanonicalForm();
+
 private:
 
 	/**
@@ -1370,6 +1448,23 @@ private:
 
 };
 
+/*
+ * The export keys must be visible to every translation unit which serializes these classes, otherwise units which
+ * instantiate a serializer of their own do so without the class GUID. The implementations are in PTSymbolicObjects.cpp.
+ */
+BOOST_CLASS_EXPORT_KEY( Sum );
+BOOST_CLASS_EXPORT_KEY( Product );
+BOOST_CLASS_EXPORT_KEY( Trace );
+BOOST_CLASS_EXPORT_KEY( SymbolicTerm );
+BOOST_CLASS_EXPORT_KEY( MatrixK );
+BOOST_CLASS_EXPORT_KEY( MatrixS );
+BOOST_CLASS_EXPORT_KEY( TermA );
+BOOST_CLASS_EXPORT_KEY( TermE );
+BOOST_CLASS_EXPORT_KEY( CoefficientFloat );
+BOOST_CLASS_EXPORT_KEY( CoefficientFraction );
+BOOST_CLASS_EXPORT_KEY( Delta );
+BOOST_CLASS_EXPORT_KEY( FourierSum );
+
 /*
  * ***********************************************************************
  * GENERIC HELPER FUNCTIONS
@@ -1415,6 +1510,36 @@ std::map<int,int> constructContractionDictionary( DeltaContractionSet contractio
 
 bool areTermsCommon( SymbolicTermPtr termA, SymbolicTermPtr termB );
 
+/**
+ * Decomposes a Product of TermA objects, coefficients, and Traces over Products into its order in A, its total
+ * coefficient, and its traces. This is the form of each term of an expanded expression prior to indexing.
+ * @param prod A pointer to the Product to decompose.
+ * @param orderInA Set to the order n for A^n of the expression.
+ * @param coefficient Set to the product of all CoefficientFloat and CoefficientFraction factors.
+ * @param traces Set to pointers to the Trace factors of the expression, in their original order.
+ * @return True if the expression is of the expected form, false otherwise.
+ */
+bool decomposeTraceProduct( SymbolicTermPtr prod, int &orderInA, CoefficientFraction &coefficient, std::vector<TracePtr> &traces );
+
+/**
+ * Decomposes a Product of an evaluated expression into the key of its (order in A, flavor label order) group, its total
+ * coefficient, the contraction vector of its FourierSum, and its remaining factors.
+ * @param term A pointer to the Product to decompose.
+ * @param groupKey Set to a string which uniquely describes the order in A and flavor label order of the expression.
+ * @param coefficient Set to the product of all CoefficientFloat and CoefficientFraction factors.
+ * @param contractions Set to the contraction vector of the FourierSum factor, or an empty vector if there is none.
+ * @param otherFactors Set to copies of all other factors, in their original order.
+ */
+void decomposeEvaluatedTerm( SymbolicTermPtr term, std::string &groupKey, CoefficientFraction &coefficient, std::vector<IndexContraction> &contractions, Product &otherFactors );
+
+/**
+ * Sorts a vector of traces by their length and structure key, and returns a key which uniquely describes the trace
+ * structure of the product of the traces.
+ * @param traces The vector of traces, which is sorted in place.
+ * @return The trace structure key of the product of traces.
+ */
+std::string getTraceStructureKey( std::vector<TracePtr> &traces );
+
 unsigned long gcd( unsigned long a, unsigned long b );
 
 int factorial( int n );
@@ -1439,12 +1564,45 @@ Sum combineLikeTerms( Sum &expr );
 
 Sum combineLikeTerms( Sum &expr, int groupSize );
 
+/**
+ * Combines like terms of an evaluated expression in a single pass. Each term is identified by its order in A, its
+ * flavor label order, and the ID of its diagram in a DiagramCatalog; the coefficients of each (order in A, flavor
+ * label order) group are accumulated in a dense vector indexed by diagram ID. Combined terms are written with the
+ * non-coefficient factors of the first term of their group, their canonical FourierSum, and a single coefficient.
+ * Terms whose coefficients cancel entirely are dropped.
+ * @param expr A Sum of Products which has been Fourier transformed and whose dummy indices have been reduced.
+ * @param catalog The catalog with which diagrams are registered.
+ * @return The Sum of Products with like terms combined.
+ */
+Sum combineLikeTermsByDiagramID( Sum &expr, DiagramCatalog &catalog );
+
 Sum generateExponentialSeries( int order, Product x );
 
 Sum generateDeterminantExpansion( int order, const char* flavorLabel, bool insertFullE );
 
 Sum sortTracesByOrder( Sum &expr );
 
+/**
+ * Brings the traces of each term of an expression to a canonical form prior to indexing. The argument of every trace is
+ * rotated to its lexicographically minimal cyclic permutation (see Trace::rotateToCanonicalForm()), and the traces of
+ * each Product are then ordered by length and structure key, after all other factors. Terms which differ only by a
+ * rotation within a trace or by the order of their traces are therefore written identically.
+ * @param expr A Sum of Products which has not yet been indexed.
+ * @return The Sum of Products with canonical traces.
+ */
+Sum canonicalizeTraces( Sum &expr );
+
+/**
+ * Combines terms of an expression which share the same order in A and the same trace structure, prior to indexing and
+ * path integration. Each term must be a Product of TermA objects, coefficients, and Traces over Products; terms of any
+ * other form are passed through unchanged. Terms which are combined are written with their TermA factors first, a
+ * single CoefficientFraction, and then their traces ordered by length and structure key, such that indexing and path
+ * integration is performed only once per distinct trace structure.
+ * @param expr A Sum of Products which has not yet been indexed.
+ * @return The Sum of Products with like trace structures combined.
+ */
+Sum combineLikeTraceStructures( Sum &expr );
+
 /*
  * ***********************************************************************
  * INPUT REDIRECTION OPERATOR OVERLOADS
@@ -209,8 +209,80 @@ string DeltaSignature::to_string() const {
     return ss.str();
 }
 
+/*
+ * TraceStructureCache
+ */
+
+TraceStructureCache::TraceStructureCache() {
+    hits = 0;
+    misses = 0;
+}
+
+bool TraceStructureCache::lookup( const string &key, Sum &result ) {
+    bool isFound = false;
+
+    {
+        lock_guard<std::mutex> guard( mutex );
+        map<string, Sum>::iterator entry = entries.find( key );
+        if ( entry != entries.end() ) {
+            result = entry->second;
+            isFound = true;
+            hits++;
+        } else {
+            misses++;
+        }
+    }
+
+    return isFound;
+}
+
+void TraceStructureCache::insert( const string &key, const Sum &result ) {
+    {
+        lock_guard<std::mutex> guard( mutex );
+        if ( entries.count( key ) == 0 ) {
+            entries[ key ] = result;
+        }
+    }
+}
+
+unsigned long TraceStructureCache::getNumberOfEntries() {
+    unsigned long numEntries;
+
+    {
+        lock_guard<std::mutex> guard( mutex );
+        numEntries = entries.size();
+    }
+
+    return numEntries;
+}
+
+unsigned long TraceStructureCache::getNumberOfHits() {
+    lock_guard<std::mutex> guard( mutex );
+    return hits;
+}
+
+unsigned long TraceStructureCache::getNumberOfMisses() {
+    lock_guard<std::mutex> guard( mutex );
+    return misses;
+}
+
+void TraceStructureCache::clear() {
+    {
+        lock_guard<std::mutex> guard( mutex );
+        entries.clear();
+        hits = 0;
+        misses = 0;
+    }
+}
+
 map<int, CoefficientFraction> Amaunet::SINE_PATH_INTEGRALS;  // Initialized by initializeStaticReferences().
 
+TraceStructureCache Amaunet::TRACE_STRUCTURE_CACHE;
+
+bool Amaunet::LINKED_CLUSTER_EXPANSION = false;
+
+std::mutex Amaunet::CONSOLE_MUTEX;
+
 void initializeStaticReferences() {
     using namespace Amaunet;
 
@@ -496,7 +568,7 @@ Sum generateCoordinateSpacePathIntegral( int n ) {
     return pathIntegral;
 }
 
-Sum pathIntegrateExpression( SymbolicTermPtr expr ) {
+Sum pathIntegrateExpression( SymbolicTermPtr expr, bool connectedOnly ) {
     Sum integratedExpression;
 
     if ( expr->getTermID() != TermTypes::SUM ) {
@@ -506,8 +578,8 @@ Sum pathIntegrateExpression( SymbolicTermPtr expr ) {
 
     SumPtr castExpr = static_pointer_cast<Sum>( expr );
 
-    #pragma omp critical(printcout)
     {
+        lock_guard<std::mutex> guard( Amaunet::CONSOLE_MUTEX );
         cout << ">> Number of terms: " << castExpr->getNumberOfTerms() << endl;
     }
 
@@ -524,8 +596,14 @@ Sum pathIntegrateExpression( SymbolicTermPtr expr ) {
         Product integratedProduct;
         int orderInSigma = 0;
         vector<int> secondMatrixSIndices;
+        bool canTestConnectivity = connectedOnly;
 
         for ( vector<SymbolicTermPtr>::iterator factor = castTerm->getIteratorBegin(); factor != castTerm->getIteratorEnd(); ++factor ) {
+            // Nested factors may hold further indices, so connectivity is only tested on a flat product.
+            if ( (*factor)->getTermID() == TermTypes::SUM or (*factor)->getTermID() == TermTypes::PRODUCT or (*factor)->getTermID() == TermTypes::TRACE ) {
+                canTestConnectivity = false;
+            }
+
             if ( (*factor)->getTermID() == TermTypes::MATRIX_S ) {
                 orderInSigma++;
                 integratedProduct.addTerm( SymbolicTermPtr( new Delta( (*factor)->getIndices()[0], (*factor)->getIndices()[1] ) ) );
@@ -545,6 +623,7 @@ Sum pathIntegrateExpression( SymbolicTermPtr expr ) {
                 Sum spatialPathIntegral = generateCoordinateSpacePathIntegral( orderInSigma );
                 spatialPathIntegral = spatialPathIntegral.getExpandedExpr();
                 spatialPathIntegral.reduceTree();
+                Sum connectedPathIntegral;
 
                 for ( vector<SymbolicTermPtr>::iterator pathIntegralTerm = spatialPathIntegral.getIteratorBegin(); pathIntegralTerm != spatialPathIntegral.getIteratorEnd(); ++pathIntegralTerm ) {
                     if ( (*pathIntegralTerm)->getTermID() != TermTypes::PRODUCT ) {
@@ -562,6 +641,23 @@ Sum pathIntegrateExpression( SymbolicTermPtr expr ) {
                             indices[1] = expressionToSignatureIndexMapping[ indices[1] ];
                         }
                     }
+
+                    // Every index of a delta function of the path integral is also an index of a MatrixK, so a pairing
+                    // which leaves the term disconnected here gives only disconnected terms once it is expanded.
+                    if ( canTestConnectivity ) {
+                        ProductPtr pairedTerm( new Product( integratedProduct ) );
+                        for ( vector<SymbolicTermPtr>::iterator pathIntegralFactor = castPathIntegralTerm->getIteratorBegin(); pathIntegralFactor != castPathIntegralTerm->getIteratorEnd(); ++pathIntegralFactor ) {
+                            pairedTerm->addTerm( *pathIntegralFactor );
+                        }
+                        if ( isConnectedTerm( pairedTerm ) ) connectedPathIntegral.addTerm( *pathIntegralTerm );
+                    }
+                }
+
+                if ( canTestConnectivity ) {
+                    if ( connectedPathIntegral.getNumberOfTerms() == 0 ) {
+                        connectedPathIntegral.addTerm( SymbolicTermPtr( new CoefficientFloat( 0.0 ) ) );
+                    }
+                    spatialPathIntegral = connectedPathIntegral;
                 }
 
                 integratedProduct.addTerm( spatialPathIntegral.copy() );
@@ -576,6 +672,190 @@ Sum pathIntegrateExpression( SymbolicTermPtr expr ) {
     return integratedExpression;
 }
 
+/**
+ * Finds the representative of an index in a disjoint-set forest, compressing the path along the way.
+ */
+int findIndexRepresentative( map<int, int> &parents, int index ) {
+    int root = index;
+    while ( parents[ root ] != root ) {
+        root = parents[ root ];
+    }
+
+    while ( parents[ index ] != root ) {
+        int next = parents[ index ];
+        parents[ index ] = root;
+        index = next;
+    }
+
+    return root;
+}
+
+bool isConnectedTerm( SymbolicTermPtr term ) {
+    vector<SymbolicTermPtr> factors;
+    if ( term->getTermID() == TermTypes::PRODUCT ) {
+        ProductPtr castTerm = static_pointer_cast<Product>( term );
+        factors.assign( castTerm->getIteratorBegin(), castTerm->getIteratorEnd() );
+    } else {
+        factors.push_back( term );
+    }
+
+    // Join the two indices of each matrix element and delta function; the term is connected when a single set remains.
+    map<int, int> parents;
+    for ( vector<SymbolicTermPtr>::iterator factor = factors.begin(); factor != factors.end(); ++factor ) {
+        if ( (*factor)->getTermID() != TermTypes::MATRIX_K and (*factor)->getTermID() != TermTypes::DELTA ) continue;
+
+        int* indices = (*factor)->getIndices();
+        if ( parents.count( indices[0] ) == 0 ) parents[ indices[0] ] = indices[0];
+        if ( parents.count( indices[1] ) == 0 ) parents[ indices[1] ] = indices[1];
+
+        parents[ findIndexRepresentative( parents, indices[0] ) ] = findIndexRepresentative( parents, indices[1] );
+    }
+
+    if ( parents.empty() ) return false;
+
+    int root = findIndexRepresentative( parents, parents.begin()->first );
+    for ( map<int, int>::iterator index = parents.begin(); index != parents.end(); ++index ) {
+        if ( findIndexRepresentative( parents, index->first ) != root ) return false;
+    }
+
+    return true;
+}
+
+Sum truncateDisconnectedTerms( Sum &expr ) {
+    Sum connectedExpression;
+
+    for ( vector<SymbolicTermPtr>::iterator term = expr.getIteratorBegin(); term != expr.getIteratorEnd(); ++term ) {
+        if ( isConnectedTerm( *term ) ) {
+            connectedExpression.addTerm( (*term)->copy() );
+        }
+    }
+
+    return connectedExpression;
+}
+
+/**
+ * Indexes, path integrates, expands, Fourier transforms, and reduces the dummy indices of each term of an expression
+ * separately. The result of the i-th term of the expression is the i-th element of the returned vector.
+ */
+vector<Sum> integrateTermsSeparately( SumPtr expr ) {
+    vector<Sum> evaluatedTerms;
+
+    indexExpression( expr );
+    expr->reduceTree();
+
+    Sum pathIntegral = pathIntegrateExpression( expr, Amaunet::LINKED_CLUSTER_EXPANSION );
+    if ( pathIntegral.getNumberOfTerms() != expr->getNumberOfTerms() ) {
+        cout << "***ERROR: integrateTermsSeparately() expected one integrated product for each term of the expression." << endl;
+        exit( -1 );  // Critical failure -- must terminate calculation.
+    }
+
+    for ( vector<SymbolicTermPtr>::iterator term = pathIntegral.getIteratorBegin(); term != pathIntegral.getIteratorEnd(); ++term ) {
+        Sum evaluatedTerm;
+        evaluatedTerm.addTerm( *term );
+        evaluatedTerm.reduceTree();
+        evaluatedTerm.simplify();
+        evaluatedTerm = evaluatedTerm.getExpandedExpr();
+        evaluatedTerm.reduceTree();
+        if ( Amaunet::LINKED_CLUSTER_EXPANSION ) {
+            evaluatedTerm = truncateDisconnectedTerms( evaluatedTerm );
+        }
+        evaluatedTerm = fourierTransformExpression( evaluatedTerm.copy() );
+        evaluatedTerm.reduceFourierSumIndices();
+
+        evaluatedTerms.push_back( evaluatedTerm );
+    }
+
+    return evaluatedTerms;
+}
+
+Sum integrateTraceStructures( Sum &expr ) {
+    Sum evaluatedExpression;
+    SumPtr uncachedStructures( new Sum() );
+    SumPtr unstructuredTerms( new Sum() );
+    vector<string> uncachedKeys;
+
+    // Decompose each term into its order in A, coefficient, and trace structure. Structures which have not yet been
+    // evaluated are collected so that they may be integrated together with unit coefficient and no factors of A.
+    vector<string> termKeys;
+    vector<int> termOrdersInA;
+    vector<CoefficientFraction> termCoefficients;
+
+    for ( vector<SymbolicTermPtr>::iterator term = expr.getIteratorBegin(); term != expr.getIteratorEnd(); ++term ) {
+        CoefficientFraction termCoefficient;
+        vector<TracePtr> traces;
+        int orderInA;
+
+        if ( not decomposeTraceProduct( *term, orderInA, termCoefficient, traces ) ) {
+            unstructuredTerms->addTerm( (*term)->copy() );
+            continue;
+        }
+
+        // Results with and without the removal of disconnected terms are kept apart.
+        string key = ( Amaunet::LINKED_CLUSTER_EXPANSION ? "C|" : "" ) + getTraceStructureKey( traces );
+        termKeys.push_back( key );
+        termOrdersInA.push_back( orderInA );
+        termCoefficients.push_back( termCoefficient );
+
+        Sum cachedResult;
+        if ( find( uncachedKeys.begin(), uncachedKeys.end(), key ) == uncachedKeys.end() and not Amaunet::TRACE_STRUCTURE_CACHE.lookup( key, cachedResult ) ) {
+            Product unitStructure;
+            unitStructure.addTerm( CoefficientFractionPtr( new CoefficientFraction( 1, 1 ) ) );
+            for ( vector<TracePtr>::iterator tr = traces.begin(); tr != traces.end(); ++tr ) {
+                unitStructure.addTerm( (*tr)->copy() );
+            }
+
+            uncachedStructures->addTerm( unitStructure.copy() );
+            uncachedKeys.push_back( key );
+        }
+    }
+
+    if ( uncachedStructures->getNumberOfTerms() > 0 ) {
+        vector<Sum> unitResults = integrateTermsSeparately( uncachedStructures );
+        for ( int i = 0; i < unitResults.size(); i++ ) {
+            Amaunet::TRACE_STRUCTURE_CACHE.insert( uncachedKeys[ i ], unitResults[ i ] );
+        }
+    }
+
+    // Reassemble each term from the cached result of its structure, scaled by its own coefficient and order in A.
+    for ( int i = 0; i < termKeys.size(); i++ ) {
+        Sum unitResult;
+        if ( not Amaunet::TRACE_STRUCTURE_CACHE.lookup( termKeys[ i ], unitResult ) ) {
+            cout << "***ERROR: integrateTraceStructures() could not find an evaluated trace structure in the cache." << endl;
+            exit( -1 );  // Critical failure -- must terminate calculation.
+        }
+
+        for ( vector<SymbolicTermPtr>::iterator monomial = unitResult.getIteratorBegin(); monomial != unitResult.getIteratorEnd(); ++monomial ) {
+            Product scaledMonomial;
+            for ( int j = 0; j < termOrdersInA[ i ]; j++ ) {
+                scaledMonomial.addTerm( TermAPtr( new TermA() ) );
+            }
+            scaledMonomial.addTerm( termCoefficients[ i ].copy() );
+
+            if ( (*monomial)->getTermID() == TermTypes::PRODUCT ) {
+                ProductPtr castMonomial = static_pointer_cast<Product>( *monomial );
+                for ( vector<SymbolicTermPtr>::iterator factor = castMonomial->getIteratorBegin(); factor != castMonomial->getIteratorEnd(); ++factor ) {
+                    scaledMonomial.addTerm( (*factor)->copy() );
+                }
+            } else {
+                scaledMonomial.addTerm( (*monomial)->copy() );
+            }
+
+            evaluatedExpression.addTerm( scaledMonomial.copy() );
+        }
+    }
+
+    if ( unstructuredTerms->getNumberOfTerms() > 0 ) {
+        vector<Sum> unstructuredResults = integrateTermsSeparately( unstructuredTerms );
+        for ( vector<Sum>::iterator result = unstructuredResults.begin(); result != unstructuredResults.end(); ++result ) {
+            for ( vector<SymbolicTermPtr>::iterator term = result->getIteratorBegin(); term != result->getIteratorEnd(); ++term ) {
+                evaluatedExpression.addTerm( (*term)->copy() );
+            }
+        }
+    }
+
+    return evaluatedExpression;
+}
+
 /*
  * ***********************************************************************
  * INPUT REDIRECTION OPERATOR OVERLOADS
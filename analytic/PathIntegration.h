@@ -20,7 +20,9 @@
 #define AMAUNETC_PATHINTEGRATION_H
 
 #include <map>
+#include <string>
 #include <vector>
+#include <mutex>
 #include "PTSymbolicObjects.h"
 
 /*
@@ -130,6 +132,52 @@ private:
 
 };
 
+/**
+ * Memo table which maps the trace structure key of a product of traces (see getTraceStructureKey()) to the result
+ * of indexing, path integrating, expanding, Fourier transforming, and reducing the dummy indices of that product with
+ * unit coefficient and no factors of A. Access is serialized so that a single instance may be shared by all threads.
+ */
+class TraceStructureCache {
+
+public:
+
+    TraceStructureCache();
+
+    /**
+     * Retrieves a cached result.
+     * @param key The trace structure key of the product.
+     * @param result Set to a copy of the cached result if the key is present; unmodified otherwise.
+     * @return True if the key is present in the cache, false otherwise.
+     */
+    bool lookup( const std::string &key, Sum &result );
+
+    /**
+     * Stores a result in the cache. If the key is already present, the existing result is kept.
+     * @param key The trace structure key of the product.
+     * @param result The evaluated product with unit coefficient and no factors of A.
+     */
+    void insert( const std::string &key, const Sum &result );
+
+    unsigned long getNumberOfEntries();
+
+    unsigned long getNumberOfHits();
+
+    unsigned long getNumberOfMisses();
+
+    void clear();
+
+private:
+
+    std::map<std::string, Sum> entries;
+
+    unsigned long hits;
+
+    unsigned long misses;
+
+    std::mutex mutex;
+
+};
+
 /*
  * ***********************************************************************
  * STATIC VARIABLES
@@ -138,6 +186,21 @@ private:
 
 namespace Amaunet {
     extern std::map<int, CoefficientFraction> SINE_PATH_INTEGRALS;
+
+    extern TraceStructureCache TRACE_STRUCTURE_CACHE;
+
+    /**
+     * If true, only connected terms are retained, such that the evaluated expression is the expansion of ln Z rather
+     * than of Z. Disconnected contractions are dropped during path integration, before the costly expansion and Fourier
+     * transform. See pathIntegrateExpression() and truncateDisconnectedTerms().
+     */
+    extern bool LINKED_CLUSTER_EXPANSION;
+
+    /**
+     * Serializes console output of concurrent threads. A mutex rather than a named OpenMP critical section, since
+     * output is also written from the threads of a WorkStealingPool, which are not OpenMP threads.
+     */
+    extern std::mutex CONSOLE_MUTEX;
 }
 
 /*
@@ -160,7 +223,47 @@ std::vector< std::vector<int> > calculateAllContractions( int n );
 
 Sum generateCoordinateSpacePathIntegral( int n );
 
-Sum pathIntegrateExpression( SymbolicTermPtr expr );
+/**
+ * Path integrates each term of an indexed expression over the auxiliary field, replacing its MatrixS factors by delta
+ * functions and a Sum over the contractions of their indices.
+ * @param expr The Sum to integrate.
+ * @param connectedOnly If true, contractions which leave a term disconnected (see isConnectedTerm()) are dropped before
+ * the result is expanded, so that disconnected terms are never carried through the remaining evaluation. The
+ * expansion must still be passed through truncateDisconnectedTerms(), which also removes the constant term.
+ * @return The integrated expression, with one Product for each term of expr.
+ */
+Sum pathIntegrateExpression( SymbolicTermPtr expr, bool connectedOnly = false );
+
+/**
+ * Determines whether a term of a path integrated and expanded expression is connected, that is, whether every index of
+ * its MatrixK and Delta factors is joined to every other through a chain of such factors. Terms without any indexed
+ * factors are considered disconnected.
+ * @param term The term to inspect; any term other than a Product, MatrixK, or Delta is considered disconnected.
+ * @return True if the term is connected, false otherwise.
+ */
+bool isConnectedTerm( SymbolicTermPtr term );
+
+/**
+ * Removes all disconnected terms from a path integrated and fully expanded expression. Once each deltaBar has been
+ * expanded as 1 - delta, every term is a sum over unrestricted lattice indices whose vertex weights are cumulants of
+ * the auxiliary field, and so by the linked cluster theorem the connected terms alone are the expansion of ln Z. The
+ * constant term, ln Z_0 = 0, is removed as well.
+ * @param expr A fully expanded Sum of Products which has been path integrated but not yet Fourier transformed.
+ * @return The Sum of connected terms of expr.
+ */
+Sum truncateDisconnectedTerms( Sum &expr );
+
+/**
+ * Indexes, path integrates, expands, Fourier transforms, and reduces the dummy indices of an expression of Products of
+ * A's, coefficients, and Traces. Each product of traces is evaluated once with unit coefficient and no factors of A,
+ * and the result is stored in Amaunet::TRACE_STRUCTURE_CACHE; every term with the same trace structure, in this or any
+ * later call, is then served from the cache and only scaled by its own coefficient and order in A. Terms which are not
+ * of this form are evaluated directly. If Amaunet::LINKED_CLUSTER_EXPANSION is set, disconnected terms are removed
+ * prior to the Fourier transform.
+ * @param expr The expression to evaluate, typically the output of combineLikeTraceStructures().
+ * @return The evaluated expression, prior to combining like terms.
+ */
+Sum integrateTraceStructures( Sum &expr );
 
 std::vector< std::vector<int> > combinations( std::vector<int> list, int k );
 
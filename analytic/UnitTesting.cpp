@@ -19,6 +19,11 @@
 #include <sstream>
 #include <string>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
 #include "PTSymbolicObjects.h"
@@ -27,6 +32,9 @@
 #include "FeynmanDiagram.h"
 #include "ExpressionSerialization.h"
 #include "Multithreading.h"
+#include "BinarySerialization.h"
+#include "ExpressionArchive.h"
+#include "InterchangeFormat.h"
 
 using namespace std;
 
@@ -3709,6 +3717,1211 @@ string AX02() {
 	return ss.str();
 }
 
+string AY01() {
+	stringstream ss;
+	Product upArgument;
+	upArgument.addTerm( MatrixKPtr( new MatrixK( "up" ) ) );
+	upArgument.addTerm( MatrixSPtr( new MatrixS() ) );
+	Trace upTrace( upArgument.copy() );
+
+	Product dnArgument;
+	dnArgument.addTerm( MatrixKPtr( new MatrixK( "dn" ) ) );
+	dnArgument.addTerm( MatrixSPtr( new MatrixS() ) );
+	Trace dnTrace( dnArgument.copy() );
+
+	Product B;
+	B.addTerm( TermA().copy() );
+	B.addTerm( upTrace.copy() );
+	B.addTerm( TermA().copy() );
+	B.addTerm( dnTrace.copy() );
+
+	Product C;
+	C.addTerm( TermA().copy() );
+	C.addTerm( TermA().copy() );
+	C.addTerm( CoefficientFraction( 1, 2 ).copy() );
+	C.addTerm( dnTrace.copy() );
+	C.addTerm( upTrace.copy() );
+
+	Product D;
+	D.addTerm( TermA().copy() );
+	D.addTerm( TermA().copy() );
+	D.addTerm( upTrace.copy() );
+
+	Sum A;
+	A.addTerm( B.copy() );
+	A.addTerm( C.copy() );
+	A.addTerm( D.copy() );
+
+	ss << combineLikeTraceStructures( A );
+	return ss.str();
+}
+
+string AY02() {
+	stringstream ss;
+	Product argument;
+	argument.addTerm( MatrixKPtr( new MatrixK( "up" ) ) );
+	argument.addTerm( MatrixSPtr( new MatrixS() ) );
+
+	Product B;
+	B.addTerm( TermA().copy() );
+	B.addTerm( CoefficientFraction( 1, 2 ).copy() );
+	B.addTerm( Trace( argument.copy() ).copy() );
+
+	Product C;
+	C.addTerm( CoefficientFloat( -0.5 ).copy() );
+	C.addTerm( TermA().copy() );
+	C.addTerm( Trace( argument.copy() ).copy() );
+
+	Sum A;
+	A.addTerm( B.copy() );
+	A.addTerm( C.copy() );
+
+	ss << combineLikeTraceStructures( A ).getNumberOfTerms();
+	return ss.str();
+}
+
+string AY03() {
+	stringstream ss;
+	Product B;
+	B.addTerm( TermA().copy() );
+	B.addTerm( GenericTestTerm( 1 ).copy() );
+
+	Sum A;
+	A.addTerm( B.copy() );
+	A.addTerm( B.copy() );
+	A.addTerm( CoefficientFloat( 1 ).copy() );
+
+	ss << combineLikeTraceStructures( A );
+	return ss.str();
+}
+
+string AZ01() {
+	stringstream ss;
+	Product argument;
+	argument.addTerm( MatrixKPtr( new MatrixK( "up" ) ) );
+	argument.addTerm( MatrixSPtr( new MatrixS() ) );
+	argument.addTerm( MatrixKPtr( new MatrixK( "up" ) ) );
+	argument.addTerm( MatrixSPtr( new MatrixS() ) );
+
+	Product B;
+	B.addTerm( TermA().copy() );
+	B.addTerm( TermA().copy() );
+	B.addTerm( CoefficientFraction( 1, 2 ).copy() );
+	B.addTerm( Trace( argument.copy() ).copy() );
+
+	Product C;
+	C.addTerm( TermA().copy() );
+	C.addTerm( TermA().copy() );
+	C.addTerm( TermA().copy() );
+	C.addTerm( TermA().copy() );
+	C.addTerm( CoefficientFraction( 3, 1 ).copy() );
+	C.addTerm( Trace( argument.copy() ).copy() );
+
+	Sum A;
+	A.addTerm( B.copy() );
+	Sum D;
+	D.addTerm( C.copy() );
+
+	Amaunet::TRACE_STRUCTURE_CACHE.clear();
+	integrateTraceStructures( A );
+	integrateTraceStructures( D );
+
+	ss << Amaunet::TRACE_STRUCTURE_CACHE.getNumberOfEntries() << " " << Amaunet::TRACE_STRUCTURE_CACHE.getNumberOfMisses();
+	Amaunet::TRACE_STRUCTURE_CACHE.clear();
+	return ss.str();
+}
+
+string AZ02() {
+	stringstream ss;
+	Product argument;
+	argument.addTerm( MatrixKPtr( new MatrixK( "up" ) ) );
+	argument.addTerm( MatrixSPtr( new MatrixS() ) );
+	argument.addTerm( MatrixKPtr( new MatrixK( "up" ) ) );
+	argument.addTerm( MatrixSPtr( new MatrixS() ) );
+
+	Product B;
+	B.addTerm( TermA().copy() );
+	B.addTerm( TermA().copy() );
+	B.addTerm( CoefficientFraction( 1, 2 ).copy() );
+	B.addTerm( Trace( argument.copy() ).copy() );
+
+	Product C;
+	C.addTerm( TermA().copy() );
+	C.addTerm( TermA().copy() );
+	C.addTerm( CoefficientFraction( 3, 1 ).copy() );
+	C.addTerm( Trace( argument.copy() ).copy() );
+
+	Sum A;
+	A.addTerm( B.copy() );
+	A.addTerm( C.copy() );
+
+	Amaunet::TRACE_STRUCTURE_CACHE.clear();
+	Sum integrated = integrateTraceStructures( A );
+	integrated.simplify();
+	Amaunet::TRACE_STRUCTURE_CACHE.clear();
+
+	ss << integrated;
+	return ss.str();
+}
+
+string BA01() {
+	stringstream ss;
+	Product argument;
+	argument.addTerm( MatrixSPtr( new MatrixS() ) );
+	argument.addTerm( MatrixKPtr( new MatrixK( "up" ) ) );
+	argument.addTerm( MatrixSPtr( new MatrixS() ) );
+	argument.addTerm( MatrixKPtr( new MatrixK( "dn" ) ) );
+
+	Trace A( argument.copy() );
+	A.rotateToCanonicalForm();
+
+	ss << A;
+	return ss.str();
+}
+
+string BA02() {
+	stringstream ss;
+	Product upFirst;
+	upFirst.addTerm( MatrixKPtr( new MatrixK( "up" ) ) );
+	upFirst.addTerm( MatrixSPtr( new MatrixS() ) );
+	upFirst.addTerm( MatrixKPtr( new MatrixK( "dn" ) ) );
+	upFirst.addTerm( MatrixSPtr( new MatrixS() ) );
+
+	Product dnFirst;
+	dnFirst.addTerm( MatrixKPtr( new MatrixK( "dn" ) ) );
+	dnFirst.addTerm( MatrixSPtr( new MatrixS() ) );
+	dnFirst.addTerm( MatrixKPtr( new MatrixK( "up" ) ) );
+	dnFirst.addTerm( MatrixSPtr( new MatrixS() ) );
+
+	Product shortArgument;
+	shortArgument.addTerm( MatrixKPtr( new MatrixK( "up" ) ) );
+	shortArgument.addTerm( MatrixSPtr( new MatrixS() ) );
+
+	Product B;
+	B.addTerm( TermA().copy() );
+	B.addTerm( Trace( upFirst.copy() ).copy() );
+	B.addTerm( TermA().copy() );
+	B.addTerm( Trace( shortArgument.copy() ).copy() );
+
+	Product C;
+	C.addTerm( TermA().copy() );
+	C.addTerm( TermA().copy() );
+	C.addTerm( Trace( shortArgument.copy() ).copy() );
+	C.addTerm( Trace( dnFirst.copy() ).copy() );
+
+	Sum A;
+	A.addTerm( B.copy() );
+	A.addTerm( C.copy() );
+
+	Sum canonicalExpression = canonicalizeTraces( A );
+	ss << canonicalExpression << "    " << combineLikeTraceStructures( canonicalExpression ).getNumberOfTerms();
+	return ss.str();
+}
+
+string BB01() {
+	stringstream ss;
+	MatrixK K;
+
+	Product connected;
+	K.setIndices( 0, 1 );
+	connected.addTerm( K.copy() );
+	K.setIndices( 2, 3 );
+	connected.addTerm( K.copy() );
+	connected.addTerm( DeltaPtr( new Delta( 1, 2 ) ) );
+	connected.addTerm( DeltaPtr( new Delta( 3, 0 ) ) );
+
+	Product disconnected;
+	K.setIndices( 0, 1 );
+	disconnected.addTerm( K.copy() );
+	disconnected.addTerm( DeltaPtr( new Delta( 1, 0 ) ) );
+	K.setIndices( 2, 3 );
+	disconnected.addTerm( K.copy() );
+	disconnected.addTerm( DeltaPtr( new Delta( 3, 2 ) ) );
+
+	ss << isConnectedTerm( connected.copy() ) << isConnectedTerm( disconnected.copy() ) << isConnectedTerm( CoefficientFloat( 1.0 ).copy() );
+	return ss.str();
+}
+
+string BB02() {
+	stringstream ss;
+	MatrixK K;
+
+	Product connected;
+	connected.addTerm( CoefficientFraction( 1, 2 ).copy() );
+	K.setIndices( 0, 1 );
+	connected.addTerm( K.copy() );
+	connected.addTerm( DeltaPtr( new Delta( 1, 0 ) ) );
+
+	Product disconnected;
+	K.setIndices( 0, 1 );
+	disconnected.addTerm( K.copy() );
+	K.setIndices( 2, 3 );
+	disconnected.addTerm( K.copy() );
+
+	Sum A;
+	A.addTerm( CoefficientFloat( 1.0 ).copy() );
+	A.addTerm( connected.copy() );
+	A.addTerm( disconnected.copy() );
+
+	ss << truncateDisconnectedTerms( A );
+	return ss.str();
+}
+
+string BB03() {
+	stringstream ss;
+	Sum A;
+	Product B;
+	MatrixK C;
+	MatrixS D;
+	for ( int i = 0; i < 8; i += 2 ) {
+		C.setIndices( i, i + 1 );
+		D.setIndices( i + 1, i );
+		B.addTerm( C.copy() );
+		B.addTerm( D.copy() );
+	}
+	A.addTerm( B.copy() );
+
+	// Dropping disconnected contractions during integration gives the same connected terms as dropping them afterwards.
+	Sum all = pathIntegrateExpression( A.copy() ).getExpandedExpr();
+	Sum connected = pathIntegrateExpression( A.copy(), true ).getExpandedExpr();
+	all.reduceTree();
+	connected.reduceTree();
+	ss << all.getNumberOfTerms() << " " << connected.getNumberOfTerms() << " ";
+	all = truncateDisconnectedTerms( all );
+	connected = truncateDisconnectedTerms( connected );
+	ss << ( all.to_string() == connected.to_string() ) << " " << connected.getNumberOfTerms();
+	return ss.str();
+}
+
+string BC01() {
+	stringstream ss;
+	vector<IndexContraction> A;
+	A.push_back( IndexContraction( 0, 0 ) );
+	A.push_back( IndexContraction( 1, 0 ) );
+	A.push_back( IndexContraction( 0, 1 ) );
+	A.push_back( IndexContraction( 1, 2 ) );
+
+	vector<IndexContraction> B;
+	B.push_back( IndexContraction( 5, 3 ) );
+	B.push_back( IndexContraction( 3, 4 ) );
+	B.push_back( IndexContraction( 0, 0 ) );
+	B.push_back( IndexContraction( 4, 3 ) );
+
+	DiagramCatalog catalog;
+	ss << FourierSum( getCanonicalDiagramForm( A ), 4 ) << "    " << catalog.registerDiagram( A ) << catalog.registerDiagram( B ) << catalog.registerDiagram( vector<IndexContraction>() ) << catalog.getNumberOfDiagrams();
+	return ss.str();
+}
+
+string BC02() {
+	stringstream ss;
+	Product A;
+	vector<IndexContraction> B;
+	B.push_back( IndexContraction( 0, 1 ) );
+	B.push_back( IndexContraction( 1, 0 ) );
+	A.addTerm( TermAPtr( new TermA() ) );
+	A.addTerm( TermAPtr( new TermA() ) );
+	A.addTerm( CoefficientFraction( 1, 2 ).copy() );
+	A.addTerm( FourierSumPtr( new FourierSum( B, 2 ) ) );
+
+	Product C;
+	vector<IndexContraction> D;
+	D.push_back( IndexContraction( 2, 1 ) );
+	D.push_back( IndexContraction( 2, 1 ) );
+	C.addTerm( TermAPtr( new TermA() ) );
+	C.addTerm( TermAPtr( new TermA() ) );
+	C.addTerm( CoefficientFraction( 3, 2 ).copy() );
+	C.addTerm( FourierSumPtr( new FourierSum( D, 2 ) ) );
+
+	Product F;
+	vector<IndexContraction> G;
+	G.push_back( IndexContraction( 0, 0 ) );
+	G.push_back( IndexContraction( 0, 0 ) );
+	F.addTerm( TermAPtr( new TermA() ) );
+	F.addTerm( TermAPtr( new TermA() ) );
+	F.addTerm( FourierSumPtr( new FourierSum( G, 2 ) ) );
+
+	Sum E;
+	E.addTerm( A.copy() );
+	E.addTerm( C.copy() );
+	E.addTerm( F.copy() );
+
+	DiagramCatalog catalog;
+	ss << combineLikeTermsByDiagramID( E, catalog );
+	return ss.str();
+}
+
+string BC03() {
+	stringstream ss;
+	vector<IndexContraction> A;
+	A.push_back( IndexContraction( 0, 1 ) );
+	A.push_back( IndexContraction( 1, 2 ) );
+	A.push_back( IndexContraction( 2, 0 ) );
+
+	vector<IndexContraction> B;
+	B.push_back( IndexContraction( 0, 0 ) );
+	B.push_back( IndexContraction( 0, 0 ) );
+
+	DiagramCatalog catalog;
+	ss << catalog.registerDiagram( A ) << catalog.registerDiagram( B ) << catalog.registerDiagram( A ) << " " << catalog.getNumberOfHits() << catalog.getNumberOfMisses() << "    ";
+
+	stringstream ser;
+	boost::archive::text_oarchive oa{ser};
+	oa << catalog;
+
+	boost::archive::text_iarchive ia{ser};
+	DiagramCatalog loadedCatalog;
+	ia >> loadedCatalog;
+
+	ss << loadedCatalog.registerDiagram( B ) << loadedCatalog.registerDiagram( A ) << " " << loadedCatalog.getNumberOfHits() << loadedCatalog.getNumberOfMisses();
+	return ss.str();
+}
+
+string BC04() {
+	stringstream ss;
+	vector<IndexContraction> A;
+	A.push_back( IndexContraction( 0, 1 ) );
+	A.push_back( IndexContraction( 1, 0 ) );
+
+	DiagramCatalog catalog;
+	catalog.registerDiagram( A );
+	saveDiagramCatalogToFile( catalog, "/tmp/BC04.out" );
+
+	DiagramCatalog loadedCatalog;
+	ss << loadDiagramCatalogFromFile( loadedCatalog, "/tmp/BC04.out" ) << loadedCatalog.getNumberOfDiagrams() << " ";
+
+	// A truncated or unrelated file leaves the catalog empty instead of aborting.
+	truncate( "/tmp/BC04.out", 40 );
+	ss << loadDiagramCatalogFromFile( loadedCatalog, "/tmp/BC04.out" ) << loadedCatalog.getNumberOfDiagrams() << " ";
+
+	ofstream garbage( "/tmp/BC04.out" );
+	garbage << "not a catalog" << endl;
+	garbage.close();
+	ss << loadDiagramCatalogFromFile( loadedCatalog, "/tmp/BC04.out" ) << loadedCatalog.getNumberOfDiagrams();
+
+	remove( "/tmp/BC04.out" );
+	return ss.str();
+}
+
+string BD01() {
+	stringstream ss;
+	vector<IndexContraction> A;
+	A.push_back( IndexContraction( 0, 0 ) );
+	A.push_back( IndexContraction( 1, 0 ) );
+	A.push_back( IndexContraction( 0, 1 ) );
+	A.push_back( IndexContraction( 1, 2 ) );
+
+	DeltaContractionSet B;
+	B.addContraction( IndexContraction( 5, 3 ) );
+	B.addContraction( IndexContraction( 3, 4 ) );
+	B.addContraction( IndexContraction( 0, 0 ) );
+	B.addContraction( IndexContraction( 4, 3 ) );
+
+	vector<IndexContraction> C;
+	C.push_back( IndexContraction( 0, 0 ) );
+	C.push_back( IndexContraction( 0, 1 ) );
+	C.push_back( IndexContraction( 1, 2 ) );
+	C.push_back( IndexContraction( 2, 0 ) );
+
+	ss << ( getDiagramFingerprint( A ) == getDiagramFingerprint( B ) ) << ( getDiagramFingerprint( A ) == getDiagramFingerprint( C ) );
+	return ss.str();
+}
+
+string BE01() {
+	stringstream ss;
+	Product A;
+	vector<IndexContraction> B;
+	B.push_back( IndexContraction( 0, 1 ) );
+	B.push_back( IndexContraction( 1, 0 ) );
+	A.addTerm( TermAPtr( new TermA() ) );
+	A.addTerm( TermAPtr( new TermA() ) );
+	A.addTerm( CoefficientFraction( 1, 2 ).copy() );
+	A.addTerm( FourierSumPtr( new FourierSum( B, 2 ) ) );
+
+	Product C;
+	vector<IndexContraction> D;
+	D.push_back( IndexContraction( 2, 1 ) );
+	D.push_back( IndexContraction( 2, 1 ) );
+	C.addTerm( TermAPtr( new TermA() ) );
+	C.addTerm( TermAPtr( new TermA() ) );
+	C.addTerm( CoefficientFraction( 3, 2 ).copy() );
+	C.addTerm( FourierSumPtr( new FourierSum( D, 2 ) ) );
+
+	Product F;
+	vector<IndexContraction> G;
+	G.push_back( IndexContraction( 0, 0 ) );
+	G.push_back( IndexContraction( 0, 0 ) );
+	F.addTerm( TermAPtr( new TermA() ) );
+	F.addTerm( TermAPtr( new TermA() ) );
+	F.addTerm( FourierSumPtr( new FourierSum( G, 2 ) ) );
+
+	Sum E;
+	E.addTerm( A.copy() );
+	E.addTerm( C.copy() );
+	E.addTerm( F.copy() );
+
+	Sum F1( E );
+	DiagramCatalog catalog;
+	ss << multithreaded_combineLikeTermsByDiagramID( E, catalog, 3 ) << "   " << ( multithreaded_combineLikeTermsByDiagramID( F1, catalog, 1 ).to_string() == multithreaded_combineLikeTermsByDiagramID( E, catalog, 3 ).to_string() );
+	return ss.str();
+}
+
+string BF01() {
+	stringstream ss;
+	vector<IndexContraction> B;
+	B.push_back( IndexContraction( 0, 1 ) );
+	B.push_back( IndexContraction( 1, 0 ) );
+	vector<IndexContraction> D;
+	D.push_back( IndexContraction( 2, 1 ) );
+	D.push_back( IndexContraction( 2, 1 ) );
+	vector<IndexContraction> G;
+	G.push_back( IndexContraction( 0, 0 ) );
+	G.push_back( IndexContraction( 0, 0 ) );
+
+	Product A;
+	A.addTerm( TermAPtr( new TermA() ) );
+	A.addTerm( TermAPtr( new TermA() ) );
+	A.addTerm( CoefficientFraction( 1, 2 ).copy() );
+	A.addTerm( FourierSumPtr( new FourierSum( B, 2 ) ) );
+
+	Product C;
+	C.addTerm( TermAPtr( new TermA() ) );
+	C.addTerm( TermAPtr( new TermA() ) );
+	C.addTerm( CoefficientFraction( 3, 2 ).copy() );
+	C.addTerm( FourierSumPtr( new FourierSum( D, 2 ) ) );
+
+	Product F;
+	F.addTerm( TermAPtr( new TermA() ) );
+	F.addTerm( TermAPtr( new TermA() ) );
+	F.addTerm( CoefficientFraction( -1, 1 ).copy() );
+	F.addTerm( FourierSumPtr( new FourierSum( G, 2 ) ) );
+
+	Product H;
+	H.addTerm( TermAPtr( new TermA() ) );
+	H.addTerm( TermAPtr( new TermA() ) );
+	H.addTerm( FourierSumPtr( new FourierSum( G, 2 ) ) );
+
+	Sum firstFile;
+	firstFile.addTerm( A.copy() );
+	firstFile.addTerm( F.copy() );
+	Sum secondFile;
+	secondFile.addTerm( C.copy() );
+	secondFile.addTerm( H.copy() );
+
+	// Two archive blocks of one partition are combined as separate sorted runs, and merged across runs.
+	remove( "/tmp/BF01.amc" );
+	ExpressionArchiveWriter archive( "/tmp/BF01.amc" );
+	archive.appendBlock( firstFile, 0, "A2" );
+	archive.appendBlock( secondFile, 1, "A2" );
+	archive.close();
+
+	ss << mergeCombinePartitionsFromArchive( "/tmp/BF01.amc", "/tmp/BF01_COMBINED.amc", 2, 2 ) << " ";
+	ExpressionArchiveReader combined( "/tmp/BF01_COMBINED.amc" );
+	ss << combined.getNumberOfBlocks() << ":" << combined.getBlockInfo( 0 ).label << " ";
+	ss << loadSumFromArchive( "/tmp/BF01_COMBINED.amc" ) << " ";
+	ss << convertArchiveToInterchangeFile( "/tmp/BF01_COMBINED.amc", "/tmp/BF01.txt", false );
+
+	remove( "/tmp/BF01.amc" );
+	remove( "/tmp/BF01_COMBINED.amc" );
+	remove( "/tmp/BF01.txt" );
+	return ss.str();
+}
+
+string BV01() {
+	stringstream ss;
+	Amaunet::TRACE_STRUCTURE_CACHE.clear();
+	Sum Zup = generateDeterminantExpansion( 2, "", true );
+	Zup = Zup.getExpandedExpr();
+	Zup.reduceTree();
+	Zup.simplify();
+
+	// The evaluated blocks are routed by the order in A and flavor of each term, not filed whole under A0.
+	mkdir( "/tmp/BV01", 0755 );
+	int numArchiveBlocks = multithreaded_splitExpandAndEvaluateByPartsToFiles( static_pointer_cast<Sum>( Zup.copy() ), static_pointer_cast<Sum>( Zup.copy() ), 2, 100, 2, "/tmp/BV01", 2, false, 0, true );
+
+	// Each block of the run holds one archive block per partition.
+	ExpressionArchiveReader archive( "/tmp/BV01/EX.amc" );
+	map<string, int> partitions;
+	for ( int block = 0; block < archive.getNumberOfBlocks(); block++ ) {
+		partitions[ archive.getBlockInfo( block ).label ] = archive.getBlockInfo( block ).minOrderInA;
+	}
+	for ( map<string, int>::iterator partition = partitions.begin(); partition != partitions.end(); ++partition ) {
+		ss << partition->second << ":" << partition->first << " ";
+	}
+	ss << numArchiveBlocks << "   ";
+
+	// Blocks are appended as they complete, so the order of the archive blocks is not fixed.
+	vector<string> entries;
+	for ( int block = 0; block < archive.getNumberOfBlocks(); block++ ) {
+		stringstream entry;
+		entry << archive.getBlockInfo( block ).group << ":" << archive.getBlockInfo( block ).label;
+		entries.push_back( entry.str() );
+	}
+	sort( entries.begin(), entries.end() );
+	for ( vector<string>::iterator entry = entries.begin(); entry != entries.end(); ++entry ) ss << *entry << " ";
+
+	remove( "/tmp/BV01/EX.amc" );
+	remove( "/tmp/BV01/RUN_MANIFEST.out" );
+	rmdir( "/tmp/BV01" );
+
+	return ss.str();
+}
+
+string BG01() {
+	stringstream ss;
+	vector<IndexContraction> B;
+	B.push_back( IndexContraction( 0, 1 ) );
+	B.push_back( IndexContraction( 1, 0 ) );
+	vector<IndexContraction> D;
+	D.push_back( IndexContraction( 2, 1 ) );
+	D.push_back( IndexContraction( 2, 1 ) );
+
+	Product A;
+	A.addTerm( TermAPtr( new TermA() ) );
+	A.addTerm( TermAPtr( new TermA() ) );
+	A.addTerm( CoefficientFraction( 1, 2 ).copy() );
+	A.addTerm( FourierSumPtr( new FourierSum( B, 2 ) ) );
+
+	Product C;
+	C.addTerm( TermAPtr( new TermA() ) );
+	C.addTerm( TermAPtr( new TermA() ) );
+	C.addTerm( CoefficientFraction( 3, 2 ).copy() );
+	C.addTerm( FourierSumPtr( new FourierSum( D, 2 ) ) );
+
+	Product F;
+	for ( int i = 0; i < 4; i++ ) F.addTerm( TermAPtr( new TermA() ) );
+	F.addTerm( FourierSumPtr( new FourierSum( D, 2 ) ) );
+
+	Sum firstBlock;
+	firstBlock.addTerm( A.copy() );
+	firstBlock.addTerm( F.copy() );
+	Sum secondBlock;
+	secondBlock.addTerm( C.copy() );
+
+	int orderInA;
+	Product G( A );
+	G.addTerm( MatrixK( "up" ).copy() );
+	G.addTerm( MatrixK( "dn" ).copy() );
+	G.addTerm( MatrixK( "up" ).copy() );
+	ss << getPartitionLabel( G.copy(), orderInA ) << " " << orderInA << "    ";
+	remove( "/tmp/BG01.amc" );
+	ExpressionArchiveWriter archive( "/tmp/BG01.amc" );
+	savePartitionedSumToArchive( firstBlock, archive, 0 );
+	savePartitionedSumToArchive( secondBlock, archive, 1 );
+	ss << archive.close() << "   ";
+	mergeCombinePartitionsFromArchive( "/tmp/BG01.amc", "/tmp/BG01_COMBINED.amc", 2, 2 );
+	ss << loadSumFromArchive( "/tmp/BG01_COMBINED.amc" );
+	remove( "/tmp/BG01.amc" );
+	remove( "/tmp/BG01_COMBINED.amc" );
+	return ss.str();
+}
+
+string BH01() {
+	stringstream ss;
+	vector<IndexContraction> B;
+	B.push_back( IndexContraction( 0, 1 ) );
+	B.push_back( IndexContraction( -1, 2 ) );
+
+	MatrixK K( "up" );
+	K.setIndices( 1, 2 );
+	K.fourierTransform();
+	MatrixS S;
+	S.setIndices( 2, 3 );
+
+	Product A;
+	A.addTerm( TermAPtr( new TermA() ) );
+	A.addTerm( CoefficientFraction( -1, 3 ).copy() );
+	A.addTerm( K.copy() );
+	A.addTerm( S.copy() );
+	A.addTerm( Delta( 1, 2, true ).copy() );
+
+	Product C;
+	C.addTerm( CoefficientFloat( -1.5 ).copy() );
+	C.addTerm( CoefficientFraction( 0.5, 4 ).copy() );
+	C.addTerm( TermEPtr( new TermE( 3, "dn" ) ) );
+	C.addTerm( FourierSumPtr( new FourierSum( B, 2 ) ) );
+
+	Sum original;
+	original.addTerm( A.copy() );
+	original.addTerm( C.copy() );
+	original.addTerm( MatrixK( "dn" ).copy() );
+
+	saveSumToBinaryFile( original, "/tmp/BH01.bin", 2 );
+	Sum loaded = loadSumFromBinaryFile( "/tmp/BH01.bin" );
+	ss << loaded.getNumberOfTerms() << " " << loaded << "    ";
+
+	// Corrupt a single byte of the last block; the checksum must reject the file.
+	fstream fs( "/tmp/BH01.bin", ios::in | ios::out | ios::binary );
+	fs.seekp( -6, ios::end );
+	fs.put( 'X' );
+	fs.close();
+	ss << loadSumFromBinaryFile( "/tmp/BH01.bin" ).getNumberOfTerms();
+	remove( "/tmp/BH01.bin" );
+	return ss.str();
+}
+
+string BH02() {
+	stringstream ss;
+	vector<IndexContraction> B;
+	B.push_back( IndexContraction( 0, 1 ) );
+	B.push_back( IndexContraction( 2, 1 ) );
+
+	Product A;
+	A.addTerm( TermAPtr( new TermA() ) );
+	A.addTerm( TermAPtr( new TermA() ) );
+	A.addTerm( CoefficientFraction( 3, 4 ).copy() );
+	A.addTerm( CoefficientFloat( -2 ).copy() );
+	A.addTerm( FourierSumPtr( new FourierSum( B, 2 ) ) );
+
+	Product C;
+	C.addTerm( TermAPtr( new TermA() ) );
+	C.addTerm( MatrixK( "up" ).copy() );
+
+	Sum original;
+	original.addTerm( A.copy() );
+	original.addTerm( C.copy() );
+	original.addTerm( A.copy() );
+	saveSumToBinaryFile( original, "/tmp/BH02.bin", 2 );
+
+	MappedExpressionReader reader( "/tmp/BH02.bin" );
+	vector<IndexContraction> pairs;
+	while ( reader.next() ) {
+		const TermView &term = reader.getTerm();
+		term.getContractions( pairs );
+		ss << term.getOrderInA() << " " << term.getCoefficient() << " " << term.getNumberOfContractions();
+		for ( vector<IndexContraction>::iterator it = pairs.begin(); it != pairs.end(); ++it ) {
+			ss << " (" << it->i << "," << it->j << ")";
+		}
+		ss << "; ";
+	}
+	ss << reader.hasError() << " ";
+
+	MappedExpressionReader second( "/tmp/BH02.bin" );
+	second.next();
+	second.next();
+	ss << second.getTerm().materialize()->to_string();
+	remove( "/tmp/BH02.bin" );
+	return ss.str();
+}
+
+string BI01() {
+	stringstream ss;
+	Sum batch;
+	for ( int i = 1; i <= 3; i++ ) batch.addTerm( CoefficientFraction( i, 7 ).copy() );
+
+	ExpressionFileWriter writer( "/tmp", 2 );
+	writer.addTerm( CoefficientFraction( 1, 5 ).copy() );
+	writer.addTerms( batch );
+	writer.addTerm( TermAPtr( new TermA() ) );
+	int numberOfFiles = writer.close();
+	ss << numberOfFiles << "   ";
+
+	for ( int i = 0; i < numberOfFiles; i++ ) {
+		stringstream ssfilename;
+		ssfilename << "/tmp/EX" << i << ".out";
+		ss << loadSumFromFile( ssfilename.str() ) << "   ";
+		remove( ssfilename.str().c_str() );
+	}
+
+	return ss.str();
+}
+
+string BJ01() {
+	stringstream ss;
+	Sum block;
+	block.addTerm( CoefficientFraction( 1, 3 ).copy() );
+	remove( "/tmp/BJ01.amc" );
+	ExpressionArchiveWriter archive( "/tmp/BJ01.amc" );
+	savePartitionedSumToArchive( block, archive, 0 );
+
+	RunManifest manifest;
+	manifest.inputHash = computeExpressionHash( block );
+	manifest.expansionOrderInA = 4;
+	manifest.poolSize = 10;
+	manifest.blockSize = 1;
+	manifest.numOfBlocks = 2;
+	recordRunManifestBlock( manifest, 0, archive );
+	archive.close();
+	saveRunManifest( manifest, "/tmp" );
+
+	RunManifest loaded;
+	ss << loadRunManifest( loaded, "/tmp" ) << " " << loaded.matches( manifest ) << " " << loaded.blockPartitions.size() << " ";
+	{
+		ExpressionArchiveReader reader( "/tmp/BJ01.amc" );
+		ss << verifyRunManifestBlock( loaded, 0, reader ) << " " << verifyRunManifestBlock( loaded, 1, reader ) << " ";
+	}
+
+	// Rewrite the partition of the block with another term; the block must now fail verification and its record be
+	// removed.
+	remove( "/tmp/BJ01.amc" );
+	ExpressionArchiveWriter rewriter( "/tmp/BJ01.amc" );
+	Sum modified;
+	modified.addTerm( CoefficientFraction( 2, 3 ).copy() );
+	rewriter.appendBlock( modified, 0, "A0" );
+	rewriter.close();
+	ExpressionArchiveReader reader( "/tmp/BJ01.amc" );
+	ss << verifyRunManifestBlock( loaded, 0, reader ) << " " << loaded.blockPartitions.size();
+
+	remove( "/tmp/BJ01.amc" );
+	remove( "/tmp/RUN_MANIFEST.out" );
+	return ss.str();
+}
+
+string BK01() {
+	stringstream ss;
+	remove( "/tmp/BK01.amc" );
+
+	ExpressionArchiveWriter writer( "/tmp/BK01.amc" );
+#pragma omp parallel for num_threads( 4 )
+	for ( int i = 0; i < 8; i++ ) {
+		Sum block;
+		Product term;
+		for ( int j = 0; j < i % 3; j++ ) term.addTerm( TermAPtr( new TermA() ) );
+		term.addTerm( CoefficientFraction( i, 8 ).copy() );
+		block.addTerm( term.copy() );
+		block.addTerm( CoefficientFloat( i ).copy() );
+		writer.appendBlock( block );
+	}
+	ss << writer.close() << " ";
+
+	// Reopen the archive and append one more block.
+	ExpressionArchiveWriter appender( "/tmp/BK01.amc" );
+	Sum last;
+	last.addTerm( TermAPtr( new TermA() ) );
+	appender.appendBlock( last );
+	ss << appender.close() << " ";
+
+	ExpressionArchiveReader reader( "/tmp/BK01.amc" );
+	const ArchiveBlockInfo &info = reader.getBlockInfo( 8 );
+	ss << reader.getNumberOfBlocks() << " " << info.numTerms << " " << info.minOrderInA << " " << info.maxOrderInA << " ";
+
+	Sum lastBlock;
+	ss << reader.readBlock( 8, lastBlock ) << " " << lastBlock << " ";
+	ss << loadSumFromArchive( "/tmp/BK01.amc" ).getNumberOfTerms();
+	remove( "/tmp/BK01.amc" );
+	return ss.str();
+}
+
+string BK02() {
+	stringstream ss;
+	remove( "/tmp/BK02.amc" );
+
+	ExpressionArchiveWriter writer( "/tmp/BK02.amc" );
+	for ( int i = 0; i < 3; i++ ) {
+		Sum block;
+		block.addTerm( CoefficientFraction( i + 1, 2 ).copy() );
+		stringstream label;
+		label << "P" << i;
+		writer.appendBlock( block, i, label.str() );
+	}
+	writer.close();
+
+	// Cut the archive in the middle of its last block, as if its writer had stopped while appending it.
+	unsigned long long cut;
+	{
+		ExpressionArchiveReader reader( "/tmp/BK02.amc" );
+		cut = reader.getBlockInfo( 2 ).offset + reader.getBlockInfo( 2 ).length / 2;
+	}
+	truncate( "/tmp/BK02.amc", (off_t)cut );
+
+	{
+		ExpressionArchiveReader recovered( "/tmp/BK02.amc" );
+		ss << recovered.isOpen() << " " << recovered.getNumberOfBlocks() << " ";
+		for ( int block = 0; block < recovered.getNumberOfBlocks(); block++ ) {
+			ss << recovered.getBlockInfo( block ).group << ":" << recovered.getBlockInfo( block ).label << " ";
+		}
+	}
+
+	// Reopening the archive recovers its index, and the next block follows the intact ones.
+	ExpressionArchiveWriter appender( "/tmp/BK02.amc" );
+	Sum last;
+	last.addTerm( TermAPtr( new TermA() ) );
+	appender.appendBlock( last, 7, "A1" );
+	ss << appender.close() << " ";
+
+	ExpressionArchiveReader reader( "/tmp/BK02.amc" );
+	ss << reader.getBlockInfo( 2 ).group << ":" << reader.getBlockInfo( 2 ).label << " " << loadSumFromArchive( "/tmp/BK02.amc" );
+
+	remove( "/tmp/BK02.amc" );
+	return ss.str();
+}
+
+string BL01() {
+	stringstream ss;
+	vector<IndexContraction> B;
+	B.push_back( IndexContraction( 0, 1 ) );
+	B.push_back( IndexContraction( 1, 2 ) );
+
+	Sum expr;
+	for ( int order = 0; order <= 4; order += 2 ) {
+		Product term;
+		for ( int i = 0; i < order; i++ ) term.addTerm( TermAPtr( new TermA() ) );
+		term.addTerm( CoefficientFraction( order + 1, 2 ).copy() );
+		term.addTerm( MatrixK( "up" ).copy() );
+		if ( order == 2 ) term.addTerm( MatrixK( "dn" ).copy() );
+		if ( order == 4 ) term.addTerm( FourierSumPtr( new FourierSum( B, 2 ) ) );
+		expr.addTerm( term.copy() );
+	}
+
+	saveSumToBinaryFile( expr, "/tmp/BL01.bin", 2 );
+	splitSumToArchive( expr, 1, "/tmp/BL01.amc" );
+
+	TermFilter byOrder;
+	byOrder.minOrderInA = 2;
+	byOrder.maxOrderInA = 2;
+	ss << loadFilteredSumFromBinaryFile( "/tmp/BL01.bin", byOrder ) << "   ";
+
+	TermFilter byFlavor;
+	byFlavor.flavorCounts[ "up" ] = 1;
+	ss << loadFilteredSumFromArchive( "/tmp/BL01.amc", byFlavor ).getNumberOfTerms() << " ";
+
+	TermFilter byVertices;
+	byVertices.minVertices = 3;
+	ExpressionArchiveReader reader( "/tmp/BL01.amc" );
+	for ( int block = 0; block < reader.getNumberOfBlocks(); block++ ) {
+		ss << blockMayMatch( reader.getBlockInfo( block ), byVertices );
+	}
+	ss << " " << loadFilteredSumFromArchive( "/tmp/BL01.amc", byVertices ).getNumberOfTerms();
+
+	remove( "/tmp/BL01.bin" );
+	remove( "/tmp/BL01.amc" );
+	return ss.str();
+}
+
+string BM01() {
+	stringstream ss;
+	PrefetchingLoader loader( 6, []( int item ) {
+		Sum partialSum;
+		for ( int i = 0; i <= item; i++ ) partialSum.addTerm( CoefficientFraction( item, 1 ).copy() );
+		return partialSum;
+	}, 3, 2 );
+
+	SumPtr partialSum;
+	int item;
+	while ( loader.next( partialSum, item ) ) ss << item << ":" << partialSum->getNumberOfTerms() << " ";
+
+	// Destroying a loader before all partial sums are delivered must stop its readers.
+	{
+		PrefetchingLoader abandoned( 100, []( int item ) { return Sum(); }, 2, 1 );
+		abandoned.next( partialSum, item );
+	}
+	ss << item;
+
+	return ss.str();
+}
+
+string BN01() {
+	stringstream ss;
+	vector<int> written;
+
+	AsyncBlockWriter writer( 3 );
+	for ( int block = 0; block < 5; block++ ) {
+		writer.submit( [ block, &written ]() {
+			written.push_back( block );
+			return 0;
+		}, 2 );
+	}
+	ss << writer.close() << " ";
+	for ( vector<int>::iterator it = written.begin(); it != written.end(); ++it ) ss << *it;
+
+	AsyncBlockWriter failing( 10 );
+	failing.submit( []() { return -1; }, 1 );
+	failing.submit( []() { return 0; }, 100 );
+	ss << " " << failing.close();
+
+	return ss.str();
+}
+
+string BS01() {
+	stringstream ss;
+	atomic<long long> total( 0 );
+	atomic<int> spawned( 0 );
+
+	// Tasks of uneven cost, some of which spawn further tasks on the pool.
+	WorkStealingPool pool( 4 );
+	for ( int task = 0; task < 100; task++ ) {
+		pool.submit( [ task, &pool, &total, &spawned ]() {
+			this_thread::sleep_for( chrono::microseconds( ( task % 10 ) * 100 ) );
+			total += task;
+			if ( task % 10 == 0 ) {
+				pool.submit( [ &total, &spawned ]() {
+					total += 1000;
+					spawned++;
+				} );
+			}
+		} );
+	}
+	pool.wait();
+	ss << total << " " << spawned;
+
+	// The pool is reusable after wait().
+	pool.submit( [ &total ]() { total = -1; } );
+	pool.wait();
+	ss << " " << total;
+
+	return ss.str();
+}
+
+string BT01() {
+	stringstream ss;
+
+	// A A Trace[ K S K S ]
+	Product traceArgument;
+	for ( int i = 0; i < 2; i++ ) {
+		traceArgument.addTerm( MatrixKPtr( new MatrixK() ) );
+		traceArgument.addTerm( MatrixSPtr( new MatrixS() ) );
+	}
+	Product secondOrder;
+	secondOrder.addTerm( TermAPtr( new TermA() ) );
+	secondOrder.addTerm( TermAPtr( new TermA() ) );
+	secondOrder.addTerm( SymbolicTermPtr( new Trace( traceArgument.copy() ) ) );
+
+	// 1 + A A Trace[ K S K S ] + 1/2 ( 1 + A A Trace[ K S K S ] )
+	Sum inner;
+	inner.addTerm( SymbolicTermPtr( new CoefficientFraction( 1, 1 ) ) );
+	inner.addTerm( secondOrder.copy() );
+	Product half;
+	half.addTerm( SymbolicTermPtr( new CoefficientFraction( 1, 2 ) ) );
+	half.addTerm( inner.copy() );
+	Sum outer( inner );
+	outer.addTerm( half.copy() );
+
+	ExpansionProfile profile = getExpansionProfile( outer.copy() );
+	for ( ExpansionProfile::iterator entry = profile.begin(); entry != profile.end(); ++entry ) {
+		ss << entry->first.first << "," << entry->first.second << ":" << entry->second << " ";
+	}
+
+	// Order 4 with four MatrixS factors costs 1 + 3, orders above the expansion order cost 1.
+	ExpansionProfile fourthOrder = getExpansionProfile( secondOrder.copy() );
+	ss << estimateExpansionCost( fourthOrder, fourthOrder, 4 ) << " " << estimateExpansionCost( fourthOrder, fourthOrder, 2 ) << " ";
+	ss << estimateExpansionCost( fourthOrder, profile, 4 );
+
+	return ss.str();
+}
+
+string BU01() {
+	stringstream ss;
+
+	Sum A, B;
+	for ( int i = 1; i <= 3; i++ ) A.addTerm( SymbolicTermPtr( new CoefficientFraction( i, 1 ) ) );
+	for ( int i = 1; i <= 7; i++ ) B.addTerm( SymbolicTermPtr( new CoefficientFraction( 1, i ) ) );
+
+	SumPtr shared = static_pointer_cast<Sum>( B.copy() );
+	vector<SumPtr> tiles = splitSumIntoTiles( shared, 3 );
+	for ( vector<SumPtr>::iterator tile = tiles.begin(); tile != tiles.end(); ++tile ) ss << (*tile)->getNumberOfTerms() << " ";
+	ss << ( tiles[ 1 ]->getTerm( 0 ) == shared->getTerm( 3 ) ) << " ";
+	ss << splitSumIntoTiles( shared, 0 ).size() << " " << splitSumIntoTiles( shared, 7 ).size() << " ";
+
+	// The expansion is the same, in the same order, for any tile size.
+	string untiled = multithreaded_getDualExpansionByParts( static_pointer_cast<Sum>( A.copy() ), static_pointer_cast<Sum>( B.copy() ), 2, 0 )->to_string();
+	ss << ( multithreaded_getDualExpansionByParts( static_pointer_cast<Sum>( A.copy() ), static_pointer_cast<Sum>( B.copy() ), 4, 1 )->to_string() == untiled );
+	ss << ( multithreaded_getDualExpansionByParts( static_pointer_cast<Sum>( A.copy() ), static_pointer_cast<Sum>( B.copy() ), 3, 2 )->to_string() == untiled );
+
+	return ss.str();
+}
+
+string BO01() {
+	stringstream ss;
+	vector<IndexContraction> B;
+	B.push_back( IndexContraction( 1, 2 ) );
+	B.push_back( IndexContraction( 1, 3 ) );
+	B.push_back( IndexContraction( 2, 3 ) );
+
+	Sum expr;
+	for ( int i = 0; i < 200; i++ ) {
+		Product term;
+		term.addTerm( TermAPtr( new TermA() ) );
+		term.addTerm( CoefficientFraction( i % 5, 3 ).copy() );
+		term.addTerm( MatrixK( i % 2 == 0 ? "up" : "dn" ).copy() );
+		term.addTerm( FourierSumPtr( new FourierSum( B, 3 ) ) );
+		expr.addTerm( term.copy() );
+	}
+
+	saveSumToBinaryFile( expr, "/tmp/BO01.bin", 100 );
+	saveSumToBinaryFile( expr, "/tmp/BO01.z.bin", 100, true );
+	Sum raw = loadSumFromBinaryFile( "/tmp/BO01.bin" );
+	Sum compressed = loadSumFromBinaryFile( "/tmp/BO01.z.bin" );
+
+	struct stat rawStat, compressedStat;
+	stat( "/tmp/BO01.bin", &rawStat );
+	stat( "/tmp/BO01.z.bin", &compressedStat );
+	ss << ( compressedStat.st_size < rawStat.st_size ) << " " << compressed.getNumberOfTerms() << " ";
+	ss << ( raw.to_string() == compressed.to_string() ) << " " << compressed.getTerm( 3 )->to_string() << " ";
+
+	MappedExpressionReader reader( "/tmp/BO01.z.bin" );
+	int vertices = 0;
+	while ( reader.next() ) vertices += reader.getTerm().getNumberOfVertices();
+	ss << vertices << " ";
+
+	splitSumToArchive( expr, 64, "/tmp/BO01.amc", true );
+	ss << loadSumFromArchive( "/tmp/BO01.amc" ).getNumberOfTerms() << " ";
+
+	// The writer of a compressed archive totals the statistics of its blocks.
+	remove( "/tmp/BO01.z.amc" );
+	ExpressionArchiveWriter archive( "/tmp/BO01.z.amc", true );
+	archive.appendBlock( expr );
+	BlockStatistics statistics = archive.getStatistics();
+	archive.close();
+	ss << statistics.numTerms << " " << ( statistics.storedLength < statistics.payloadLength ) << " ";
+
+	// Text files written with compression are read back transparently.
+	Sum fractions;
+	for ( int i = 0; i < 200; i++ ) fractions.addTerm( CoefficientFraction( i % 7, 3 ).copy() );
+	saveSumToFile( fractions, "/tmp/BO01.out", true );
+	ss << ( loadSumFromFile( "/tmp/BO01.out" ).to_string() == fractions.to_string() ) << " ";
+
+	// Corrupt a byte of the compressed payload of the last block.
+	fstream fs( "/tmp/BO01.z.bin", ios::in | ios::out | ios::binary );
+	fs.seekp( -8, ios::end );
+	fs.put( 'X' );
+	fs.close();
+	ss << loadSumFromBinaryFile( "/tmp/BO01.z.bin" ).getNumberOfTerms();
+
+	remove( "/tmp/BO01.bin" );
+	remove( "/tmp/BO01.z.bin" );
+	remove( "/tmp/BO01.amc" );
+	remove( "/tmp/BO01.z.amc" );
+	remove( "/tmp/BO01.out" );
+	return ss.str();
+}
+
+string BP01() {
+	stringstream ss;
+	vector<IndexContraction> B;
+	B.push_back( IndexContraction( 0, 1 ) );
+	B.push_back( IndexContraction( -1, 2 ) );
+
+	MatrixK K( "up" );
+	K.setIndices( 1, 2 );
+	K.fourierTransform();
+
+	Product A;
+	A.addTerm( TermAPtr( new TermA() ) );
+	A.addTerm( CoefficientFraction( -1, 4 ).copy() );
+	A.addTerm( K.copy() );
+	A.addTerm( TermAPtr( new TermA() ) );
+	A.addTerm( FourierSumPtr( new FourierSum( B, 2 ) ) );
+	A.addTerm( CoefficientFloat( 2 ).copy() );
+	A.addTerm( Delta( 1, 2, true ).copy() );
+
+	Sum expr;
+	expr.addTerm( A.copy() );
+	expr.addTerm( MatrixK( "dn" ).copy() );
+
+	stringstream text;
+	ss << exportSumToInterchangeFormat( expr, text, false ) << " " << text.str();
+
+	stringstream binary;
+	ss << exportSumToInterchangeFormat( expr, binary, true ) << " " << binary.str().size() << " ";
+
+	// Terms which have no representation in the format are rejected.
+	Sum invalid;
+	invalid.addTerm( MatrixS().copy() );
+	stringstream rejected;
+	ss << exportSumToInterchangeFormat( invalid, rejected, false ) << " ";
+
+	saveSumToBinaryFile( expr, "/tmp/BP01.bin", 1 );
+	ss << convertBinaryFileToInterchangeFile( "/tmp/BP01.bin", "/tmp/BP01.txt", false ) << " ";
+	ifstream ifs( "/tmp/BP01.txt" );
+	stringstream converted;
+	converted << ifs.rdbuf();
+	ss << ( converted.str() == text.str() );
+
+	remove( "/tmp/BP01.bin" );
+	remove( "/tmp/BP01.txt" );
+	return ss.str();
+}
+
+string BQ01() {
+	stringstream ss;
+	Product A;
+	A.addTerm( TermAPtr( new TermA() ) );
+	A.addTerm( CoefficientFraction( 1, 2 ).copy() );
+	A.addTerm( TracePtr( new Trace( MatrixK( "up" ).copy() ) ) );
+
+	Sum expr;
+	for ( int i = 0; i < 5; i++ ) {
+		expr.addTerm( A.copy() );
+		expr.addTerm( CoefficientFloat( i ).copy() );
+	}
+
+	stringstream printed;
+	printed << expr;
+
+	// Output written in pages of three terms must match the output written at once.
+	stringstream paged;
+	size_t next = 0;
+	int pages = 0;
+	while ( next < expr.getNumberOfTerms() ) {
+		next = expr.printTerms( paged, next, 3 );
+		pages++;
+	}
+
+	ss << ( printed.str() == expr.to_string() ) << " " << ( paged.str() == printed.str() ) << " " << pages << " ";
+	ss << expr.printTerms( paged, 20, 3 ) << " ";
+
+	stringstream single;
+	single << A;
+	ss << single.str();
+	return ss.str();
+}
+
+string BR01() {
+	stringstream ss;
+	vector<IndexContraction> B;
+	B.push_back( IndexContraction( 0, 1 ) );
+	B.push_back( IndexContraction( -1, 2 ) );
+
+	Sum expr;
+	for ( int n = 0; n < 6; n++ ) {
+		MatrixK K( n % 2 == 0 ? "up" : "dn" );
+		K.setIndices( n, 1 );
+
+		Product term;
+		for ( int i = 0; i < n; i++ ) term.addTerm( TermAPtr( new TermA() ) );
+		term.addTerm( K.copy() );
+		term.addTerm( FourierSumPtr( new FourierSum( B, 2 ) ) );
+		term.addTerm( CoefficientFraction( n, 4 ).copy() );
+		expr.addTerm( term.copy() );
+	}
+
+	exportSumToInterchangeFile( expr, "/tmp/BR01.txt", false );
+	exportSumToInterchangeFile( expr, "/tmp/BR01.ami", true );
+
+	InterchangeExpression serial, threaded, binary;
+	ss << parseInterchangeFile( "/tmp/BR01.txt", serial, 1 ) << " " << parseInterchangeFile( "/tmp/BR01.txt", threaded, 4 ) << " ";
+	ss << parseInterchangeFile( "/tmp/BR01.ami", binary, 1 ) << " ";
+
+	InterchangeExpression* parsed[ 3 ] = { &serial, &threaded, &binary };
+	for ( int p = 0; p < 3; p++ ) {
+		const InterchangeTerm &term = parsed[ p ]->terms[ 5 ];
+		const InterchangeFactor &K = parsed[ p ]->factors[ term.firstFactor ];
+		const InterchangeFactor &F = parsed[ p ]->factors[ term.firstFactor + 1 ];
+		ss << term.orderInA << "," << term.coefficient << "," << term.numFactors << "," << parsed[ p ]->flavors[ K.flavor ] << ","
+		   << parsed[ p ]->indices[ K.firstIndex ] << "," << F.numIndices << "," << parsed[ p ]->indices[ F.firstIndex + 2 ] << " ";
+	}
+
+	// Terms as written by the Python exporter: several C factors, and whitespace between tokens.
+	string legacy = "A,2/C,0.5/D,up,1,2/C,3/;\n A,0/F/ B,1 ,2/;";
+	InterchangeExpression parsedLegacy;
+	const char* errorPosition;
+	ss << parseInterchangeTerms( legacy.data(), legacy.data() + legacy.size(), parsedLegacy, errorPosition ) << " ";
+	ss << parsedLegacy.terms.size() << " " << parsedLegacy.terms[ 0 ].coefficient << " " << parsedLegacy.factors[ 1 ].numIndices << " ";
+
+	string malformed = "A,2/D,up,1/;";
+	InterchangeExpression parsedMalformed;
+	ss << parseInterchangeTerms( malformed.data(), malformed.data() + malformed.size(), parsedMalformed, errorPosition ) << " ";
+	ss << ( errorPosition - malformed.data() ) << " ";
+
+	// An empty file holds an empty expression.
+	ofstream( "/tmp/BR01.txt", ios::trunc ).close();
+	InterchangeExpression empty;
+	ss << parseInterchangeFile( "/tmp/BR01.txt", empty, 4 ) << " " << empty.terms.size();
+
+	remove( "/tmp/BR01.txt" );
+	remove( "/tmp/BR01.ami" );
+	return ss.str();
+}
+
 int main( int argc, char** argv ) {
 	cout << "**********************************************************************" << endl;
 	cout << "  Amaunet Primary Unit Testing" << endl;
@@ -4420,6 +5633,143 @@ int main( int argc, char** argv ) {
 
 	UnitTest( "AX02: makeMultipleProducts() II", &AX02, " {GT_0} {GT_5 + GT_6} {GT_1 + GT_2 + GT_3 + GT_4}      {GT_0} {GT_5 + GT_6} {GT_1}  +  {GT_0} {GT_5 + GT_6} {GT_2}  +  {GT_0} {GT_5 + GT_6} {GT_3}  +  {GT_0} {GT_5 + GT_6} {GT_4} " );
 
+	/*
+	 * combineLikeTraceStructures()
+	 */
+
+	UnitTest( "AY01: combineLikeTraceStructures() I", &AY01, " {A} {A} {3 / 2} {Trace[  {K_dn_( 0, 0 )} {S_(0, 0)}  ]} {Trace[  {K_up_( 0, 0 )} {S_(0, 0)}  ]}  +  {A} {A} {1 / 1} {Trace[  {K_up_( 0, 0 )} {S_(0, 0)}  ]} " );
+
+	UnitTest( "AY02: combineLikeTraceStructures() II", &AY02, "0" );
+
+	UnitTest( "AY03: combineLikeTraceStructures() III", &AY03, " {A} {GT_1}  +  {A} {GT_1}  + 1" );
+
+	/*
+	 * integrateTraceStructures()
+	 */
+
+	UnitTest( "AZ01: integrateTraceStructures() I", &AZ01, "1 1" );
+
+	UnitTest( "AZ02: integrateTraceStructures() II", &AZ02, " {A} {A} {1 / 2} {K_up_( 0, 1 )} {K_up_( 2, 3 )} {1 / 2} {FourierSum[ ( 0, 0 )  ( 0, 0 ) ]}  +  {A} {A} {3 / 1} {K_up_( 0, 1 )} {K_up_( 2, 3 )} {1 / 2} {FourierSum[ ( 0, 0 )  ( 0, 0 ) ]} " );
+
+	/*
+	 * canonicalizeTraces()
+	 */
+
+	UnitTest( "BA01: Trace::rotateToCanonicalForm()", &BA01, "Trace[  {K_dn_( 0, 0 )} {S_(0, 0)} {K_up_( 0, 0 )} {S_(0, 0)}  ]" );
+
+	UnitTest( "BA02: canonicalizeTraces()", &BA02, " {A} {A} {Trace[  {K_up_( 0, 0 )} {S_(0, 0)}  ]} {Trace[  {K_dn_( 0, 0 )} {S_(0, 0)} {K_up_( 0, 0 )} {S_(0, 0)}  ]}  +  {A} {A} {Trace[  {K_up_( 0, 0 )} {S_(0, 0)}  ]} {Trace[  {K_dn_( 0, 0 )} {S_(0, 0)} {K_up_( 0, 0 )} {S_(0, 0)}  ]}     1" );
+
+	/*
+	 * truncateDisconnectedTerms()
+	 */
+
+	UnitTest( "BB01: isConnectedTerm()", &BB01, "100" );
+
+	UnitTest( "BB02: truncateDisconnectedTerms()", &BB02, " {1 / 2} {K__( 0, 1 )} {Delta( 1, 0 )} " );
+
+	UnitTest( "BB03: pathIntegrateExpression() with connected contractions only", &BB03, "7 4 1 4" );
+
+	/*
+	 * DiagramCatalog
+	 */
+
+	UnitTest( "BC01: getCanonicalDiagramForm(), DiagramCatalog", &BC01, "FourierSum[ ( 0, 0 )  ( 0, 2 )  ( 1, 2 )  ( 1, 2 ) ]    0012" );
+
+	UnitTest( "BC02: combineLikeTermsByDiagramID()", &BC02, " {A} {A} {FourierSum[ ( 0, 1 )  ( 0, 1 ) ]} {2 / 1}  +  {A} {A} {FourierSum[ ( 0, 0 )  ( 0, 0 ) ]} {1 / 1} " );
+
+	UnitTest( "BC03: DiagramCatalog, Serialization", &BC03, "010 12    10 20" );
+
+	UnitTest( "BC04: saveDiagramCatalogToFile(), loadDiagramCatalogFromFile() of a damaged file", &BC04, "01 -10 -10" );
+
+	/*
+	 * getDiagramFingerprint()
+	 */
+
+	UnitTest( "BD01: getDiagramFingerprint()", &BD01, "10" );
+
+	/*
+	 * multithreaded_combineLikeTermsByDiagramID()
+	 */
+
+	UnitTest( "BE01: multithreaded_combineLikeTermsByDiagramID()", &BE01, " {A} {A} {FourierSum[ ( 0, 0 )  ( 0, 0 ) ]} {1 / 1}  +  {A} {A} {FourierSum[ ( 0, 1 )  ( 0, 1 ) ]} {2 / 1}    1" );
+
+	/*
+	 * Sorted-run reduction of partitions
+	 */
+
+	UnitTest( "BF01: mergeCombinePartitionsFromArchive(), convertArchiveToInterchangeFile()", &BF01, "1 1:A2  {A} {A} {FourierSum[ ( 0, 1 )  ( 0, 1 ) ]} {2 / 1}  1" );
+
+	/*
+	 * Partitioned output files
+	 */
+
+	UnitTest( "BG01: savePartitionedSumToArchive(), mergeCombinePartitionsFromArchive()", &BG01, "A2_Kdn-1_Kup-2 2    3    {A} {A} {FourierSum[ ( 0, 1 )  ( 0, 1 ) ]} {2 / 1} " );
+
+	UnitTest( "BV01: multithreaded_splitExpandAndEvaluateByPartsToFiles(), partition labels", &BV01, "0:A0 2:A2_K-2 6   0:A0 0:A2_K-2 1:A0 1:A2_K-2 2:A0 2:A2_K-2 " );
+
+	/*
+	 * Compact binary serialization
+	 */
+
+	UnitTest( "BH01: saveSumToBinaryFile(), loadSumFromBinaryFile()", &BH01, "3  {A} {-1 / 3} {K_up_( 1, 2 )} {S_(2, 3)} {DeltaBar( 1, 2 )}  +  {-1.5} {0.5 / 4} {E3_dn} {FourierSum[ ( 0, 1 )  ( -1, 2 ) ]}  +  {K_dn_( 0, 0 )}     0" );
+
+	UnitTest( "BH02: MappedExpressionReader", &BH02, "2 -1.5 2 (0,1) (2,1); 1 1 0; 2 -1.5 2 (0,1) (2,1); 0  {A} {K_up_( 0, 0 )} " );
+
+	/*
+	 * Streaming expression output
+	 */
+
+	UnitTest( "BI01: ExpressionFileWriter", &BI01, "2   1 / 5 + 1 / 7 + 2 / 7 + 3 / 7   A   " );
+
+	/*
+	 * Run checkpointing
+	 */
+
+	UnitTest( "BJ01: saveRunManifest(), loadRunManifest(), verifyRunManifestBlock()", &BJ01, "0 1 1 1 0 0 0" );
+
+	/*
+	 * Expression archives
+	 */
+
+	UnitTest( "BK01: ExpressionArchiveWriter, ExpressionArchiveReader", &BK01, "8 9 9 1 1 1 0  {A}  17" );
+	UnitTest( "BK02: recoverArchiveIndex()", &BK02, "1 2 0:P0 1:P1 3 7:A1  {1 / 2}  +  {2 / 2}  +  {A} " );
+
+	UnitTest( "BL01: loadFilteredSumFromBinaryFile(), loadFilteredSumFromArchive()", &BL01, " {A} {A} {3 / 2} {K_up_( 0, 0 )} {K_dn_( 0, 0 )}    2 001 1" );
+
+	/*
+	 * Prefetching loader
+	 */
+
+	UnitTest( "BM01: PrefetchingLoader", &BM01, "0:1 1:2 2:3 3:4 4:5 5:6 0" );
+
+	UnitTest( "BN01: AsyncBlockWriter", &BN01, "0 01234 -1" );
+
+	UnitTest( "BS01: WorkStealingPool", &BS01, "14950 10 -1" );
+
+	UnitTest( "BT01: getExpansionProfile(), estimateExpansionCost()", &BT01, "0,0:2 2,4:2 4 1 12" );
+
+	UnitTest( "BU01: splitSumIntoTiles(), multithreaded_getDualExpansionByParts() with tiles", &BU01, "3 3 1 1 1 1 11" );
+
+	/*
+	 * Block compression
+	 */
+
+	UnitTest( "BO01: saveSumToBinaryFile() with compression, loadSumFromFile() of compressed file", &BO01, "1 200 1  {A} {3 / 3} {K_dn_( 0, 0 )} {FourierSum[ ( 1, 2 )  ( 1, 3 )  ( 2, 3 ) ]}  600 200 200 1 1 0" );
+
+	/*
+	 * Interchange format export
+	 */
+
+	UnitTest( "BP01: exportSumToInterchangeFormat(), convertBinaryFileToInterchangeFile()", &BP01, "2 A,2/D,up,1,2/F,0,1,-1,2/B,1,2/C,-0.5/;\nA,0/D,dn,0,0/;\n2 36 -1 2 1" );
+
+	UnitTest( "BR01: parseInterchangeFile(), parseInterchangeTerms()", &BR01, "6 6 6 5,1.25,2,dn,5,4,-1 5,1.25,2,dn,5,4,-1 5,1.25,2,dn,5,4,-1 1 2 1.5 0 0 4 0 0" );
+
+	/*
+	 * Streaming output
+	 */
+
+	UnitTest( "BQ01: SymbolicTerm::print(), Sum::printTerms()", &BQ01, "1 1 4 10  {A} {1 / 2} {Trace[ K_up_( 0, 0 ) ]} " );
+
 	cout << "----------------------------------------------------------------------" << endl;
 	cout << UnitTest::passedTests << " tests PASSED, " << UnitTest::failedTests << " tests FAILED." << endl;
 }
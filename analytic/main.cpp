@@ -15,12 +15,15 @@
  */
 
 #include <iostream>
+#include <fstream>
 #include <cstdlib>
 #include <memory>
 #include "PTSymbolicObjects.h"
 #include "PathIntegration.h"
 #include "Multithreading.h"
 #include "ExpressionSerialization.h"
+#include "ExpressionArchive.h"
+#include "InterchangeFormat.h"
 
 using namespace std;
 
@@ -55,14 +58,22 @@ int main( int argc, char** argv ) {
 	int EVALUATION_METHOD = 2;
     int POOL_SIZE = 1000;
     int BLOCK_SIZE = 20;
+    int TILE_SIZE = 50;
     int NUM_THREADS = 10;
+    int LINKED_CLUSTER_EXPANSION = 0;
+    int RESUME = 0;
+    int COMPRESS_ARCHIVES = 1;
 
 	cout << "Loaded parameters:" << endl;
 	cout << "\tExpansion order in A:\t\t" << EXPANSION_ORDER_IN_A << endl;
 	cout << "\tSplit sums by line:\t\t" << SPLIT_SUMS_BY_LINE << endl;
     cout << "\tEvaluation method:\t\t" << EVALUATION_METHOD << endl;
     cout << "\tTerm pool size:\t\t" << POOL_SIZE << endl;
+    cout << "\tTile size:\t\t\t" << TILE_SIZE << endl;
     cout << "\tNumber of threads:\t\t" << NUM_THREADS << endl;
+    cout << "\tLinked cluster expansion:\t" << LINKED_CLUSTER_EXPANSION << endl;
+    cout << "\tResume previous run:\t\t" << RESUME << endl;
+    cout << "\tCompress archives:\t\t" << COMPRESS_ARCHIVES << endl;
 	cout << endl;
 
 	if ( EXPANSION_ORDER_IN_A > 10 ) {
@@ -72,6 +83,15 @@ int main( int argc, char** argv ) {
 
 	cout << endl << "Initializing..." << endl << endl;
 	initializeStaticReferences();
+	Amaunet::LINKED_CLUSTER_EXPANSION = ( LINKED_CLUSTER_EXPANSION == 1 );
+
+	// Warm-load the diagram catalog written by a previous run, if one is present.
+	ifstream catalogFile( "./DiagramCatalog.out" );
+	if ( catalogFile.good() ) {
+		catalogFile.close();
+		loadDiagramCatalogFromFile( Amaunet::DIAGRAM_CATALOG, "./DiagramCatalog.out" );
+		cout << "Diagram catalog: " << Amaunet::DIAGRAM_CATALOG.getNumberOfDiagrams() << " diagrams." << endl;
+	}
 
 	Sum Z, Zup, Zdn;
 	cout << "Generating series for fermion determinant..." << endl;
@@ -111,8 +131,11 @@ int main( int argc, char** argv ) {
         cout << "Truncating odd order terms in expansion..." << endl;
         Z = truncateOddOrders( Z.copy() );
 
-        cout << "Sorting traces by order..." << endl;
-        Z = sortTracesByOrder( Z );
+        cout << "Bringing traces to canonical form..." << endl;
+        Z = canonicalizeTraces( Z );
+
+        cout << "Combining terms with like trace structures..." << endl;
+        Z = combineLikeTraceStructures( Z );
 
         SymbolicTermPtr ZPtr = Z.copy();
         cout << "Indexing trace arguments..." << endl;
@@ -120,7 +143,7 @@ int main( int argc, char** argv ) {
 
         cout << "Computing path integral of expression..." << endl;
         ZPtr->reduceTree();
-        Z = pathIntegrateExpression( ZPtr );
+        Z = pathIntegrateExpression( ZPtr, Amaunet::LINKED_CLUSTER_EXPANSION );
 
         cout << "Expanding integrated expression..." << endl;
         Z = Z.getExpandedExpr();
@@ -128,42 +151,63 @@ int main( int argc, char** argv ) {
         cout << "Reducing expression tree..." << endl;
         Z.reduceTree();
 
+        if ( Amaunet::LINKED_CLUSTER_EXPANSION ) {
+            cout << "Removing disconnected terms..." << endl;
+            Z = truncateDisconnectedTerms( Z );
+        }
+
         cout << "Computing symbolic Fourier transform..." << endl;
         Z = fourierTransformExpression( Z.copy() );
 
         cout << "Reducing dummy indices of Fourier transform..." << endl;
         Z.reduceFourierSumIndices();
 
-        splitSumToFiles( Z, 1000, "./" );
+        splitSumToArchive( Z, 1000, "./EX.amc", COMPRESS_ARCHIVES == 1 );
 
         cout << "Combining like terms..." << endl;
         Z = combineLikeTerms( Z, 1000 );
 
+        exportSumToInterchangeFile( Z, "./ExpressionInterpreter.txt", false );
         cout << Z << endl;
 
     } else if ( EVALUATION_METHOD == 1 ) {
         cout << "Evaluation method is BY PARTS WITH MULTITHREADING." << endl;
-        SumPtr ZPtr = multithreaded_expandAndEvaluateExpressionByParts( static_pointer_cast<Sum>( Zup.copy() ), static_pointer_cast<Sum>( Zdn.copy() ), EXPANSION_ORDER_IN_A, POOL_SIZE, NUM_THREADS );
+        SumPtr ZPtr = multithreaded_expandAndEvaluateExpressionByParts( static_pointer_cast<Sum>( Zup.copy() ), static_pointer_cast<Sum>( Zdn.copy() ), EXPANSION_ORDER_IN_A, POOL_SIZE, NUM_THREADS, TILE_SIZE );
 
-        cout << ZPtr->to_string() << endl;
+        exportSumToInterchangeFile( *ZPtr, "./ExpressionInterpreter.txt", false );
+        cout << *ZPtr << endl;
+        cout << "Trace structure cache: " << Amaunet::TRACE_STRUCTURE_CACHE.getNumberOfEntries() << " structures, "
+             << Amaunet::TRACE_STRUCTURE_CACHE.getNumberOfHits() << " hits, " << Amaunet::TRACE_STRUCTURE_CACHE.getNumberOfMisses() << " misses." << endl;
 
     } else if ( EVALUATION_METHOD == 2 ) {
         // Old method. Save here as comment for now. Here the entire dual expanded expression must be held in memory,
         // which is not suitable for N5LO.
-        // SumPtr ZPtr = multithreaded_getDualExpansionByParts( static_pointer_cast<Sum>( Zup.copy() ), static_pointer_cast<Sum>( Zdn.copy() ), NUM_THREADS );
+        // SumPtr ZPtr = multithreaded_getDualExpansionByParts( static_pointer_cast<Sum>( Zup.copy() ), static_pointer_cast<Sum>( Zdn.copy() ), NUM_THREADS, TILE_SIZE );
         //
         // cout << "Writing split sums to file..." << endl;
         // numFiles = splitSumToFiles( *ZPtr, POOL_SIZE, "." );
 
 
         cout << "Evaluation method is BY PARTS WRITTEN TO FILE WITH MULTITHREADING SUPPORT." << endl;
-        int numFiles = multithreaded_splitExpandAndEvaluateByPartsToFiles( static_pointer_cast<Sum>( Zup.copy() ),
-                                                                           static_pointer_cast<Sum>( Zdn.copy() ), EXPANSION_ORDER_IN_A, POOL_SIZE, BLOCK_SIZE, ".", NUM_THREADS );
-        Z = loadAndCombineSumFromFiles( ".", numFiles, POOL_SIZE );
+        multithreaded_splitExpandAndEvaluateByPartsToFiles( static_pointer_cast<Sum>( Zup.copy() ), static_pointer_cast<Sum>( Zdn.copy() ),
+                                                            EXPANSION_ORDER_IN_A, POOL_SIZE, BLOCK_SIZE, ".", NUM_THREADS, RESUME == 1, TILE_SIZE,
+                                                            COMPRESS_ARCHIVES == 1 );
+        cout << "Trace structure cache: " << Amaunet::TRACE_STRUCTURE_CACHE.getNumberOfEntries() << " structures, "
+             << Amaunet::TRACE_STRUCTURE_CACHE.getNumberOfHits() << " hits, " << Amaunet::TRACE_STRUCTURE_CACHE.getNumberOfMisses() << " misses." << endl;
 
-        cout << Z << endl;
+        // The combined expression is streamed from its archive rather than held in memory.
+        if ( checkpointedMergeCombinePartitionsFromArchive( ".", EXPANSION_ORDER_IN_A, NUM_THREADS, RESUME == 1 ) < 0 ) {
+            cout << "***ERROR: Failed to combine the partitions of the run." << endl;
+            exit( -1 );
+        }
+
+        convertArchiveToInterchangeFile( getCombinedArchiveFilename( "." ), "./ExpressionInterpreter.txt", false );
 
     } else {
         cout << "***ERROR: Invalid evaluation method identifier." << endl;
     }
+
+    cout << "Diagram catalog: " << Amaunet::DIAGRAM_CATALOG.getNumberOfDiagrams() << " diagrams, "
+         << Amaunet::DIAGRAM_CATALOG.getNumberOfHits() << " hits, " << Amaunet::DIAGRAM_CATALOG.getNumberOfMisses() << " misses." << endl;
+    saveDiagramCatalogToFile( Amaunet::DIAGRAM_CATALOG, "./DiagramCatalog.out" );
 }
\ No newline at end of file